@@ -11,6 +11,8 @@
 
 #include <dbconnector/dbconnector.hpp>
 #include <cmath>
+#include <cstring>
+#include <stdint.h>
 #include "viterbi.hpp"
 
 namespace madlib {
@@ -35,6 +37,96 @@ typedef struct __type_info{
 
 static type_info INT4TI(INT4OID);
 
+/**
+ * @brief Scratch space of vcrf_top1_label, kept in the function context so
+ * that it is allocated once per query instead of once per document.
+ *
+ * The transition part of mArray is stored transposed: row curr_label holds
+ * the scores of all previous labels contiguously, and every row (as well as
+ * every vector buffer) starts on a 16-byte boundary so that Eigen can use
+ * aligned vector loads. The copy of mArray is used to detect a change of
+ * model between calls.
+ */
+typedef struct __viterbi_context{
+    double  *m_array;       // copy of mArray
+    size_t  m_array_size;
+    int32_t num_labels;
+    int32_t stride;         // num_labels rounded up to a multiple of 2
+    double  *trans_t;       // num_labels x stride
+    double  *vectors;       // 5 x stride: top1 (prev/curr), norm (prev/curr), scores
+    CacheBuffer<int> path;
+} viterbi_context;
+
+typedef Eigen::Map<Eigen::VectorXd, Eigen::Aligned> AlignedVector;
+typedef Eigen::Map<const Eigen::VectorXd, Eigen::Aligned> ConstAlignedVector;
+
+static double* __alloc_aligned(MemoryContext mem_ctx, size_t n)
+{
+    char *ptr = static_cast<char *>(
+        MemoryContextAlloc(mem_ctx, n * sizeof(double) + 16));
+    return reinterpret_cast<double *>(
+        (reinterpret_cast<uintptr_t>(ptr) + 15) & ~static_cast<uintptr_t>(15));
+}
+
+static viterbi_context* __get_context(
+    AnyType &args, const ArrayHandle<double> &mArray, int32_t numLabels,
+    int doc_len)
+{
+    MemoryContext mem_ctx = args.getCacheMemoryContext();
+    viterbi_context *ctx = static_cast<viterbi_context *>(args.getUserFuncContext());
+    if (ctx == NULL) {
+        ctx = static_cast<viterbi_context *>(
+            MemoryContextAllocZero(mem_ctx, sizeof(viterbi_context)));
+        args.setUserFuncContext(ctx);
+    }
+
+    size_t m_array_size = mArray.size();
+    if (ctx->m_array == NULL || ctx->num_labels != numLabels
+            || ctx->m_array_size != m_array_size
+            || memcmp(ctx->m_array, mArray.ptr(),
+                      m_array_size * sizeof(double)) != 0) {
+        // a context is only ever replaced, never freed: models do not change
+        // within a query in practice
+        ctx->m_array = static_cast<double *>(
+            MemoryContextAlloc(mem_ctx, m_array_size * sizeof(double)));
+        memcpy(ctx->m_array, mArray.ptr(), m_array_size * sizeof(double));
+        ctx->m_array_size = m_array_size;
+        ctx->num_labels = numLabels;
+        ctx->stride = (numLabels + 1) & ~1;
+        ctx->trans_t = __alloc_aligned(mem_ctx,
+            static_cast<size_t>(numLabels) * ctx->stride);
+        ctx->vectors = __alloc_aligned(mem_ctx, 5 * ctx->stride);
+        for (int curr_label = 0; curr_label < numLabels; curr_label++)
+            for (int prev_label = 0; prev_label < numLabels; prev_label++)
+                ctx->trans_t[curr_label * ctx->stride + prev_label] =
+                    mArray[(prev_label + 1) * numLabels + curr_label];
+    }
+
+    ctx->path.reserve(mem_ctx, static_cast<size_t>(doc_len) * numLabels);
+    return ctx;
+}
+
+/**
+ * @brief Numerically stable log-sum-exp of scores kept in units of 1/1000,
+ * i.e., 1000 * log(sum_i exp(v_i / 1000))
+ */
+static double __log_sum_exp(const ConstAlignedVector &v)
+{
+    double max_v = v.maxCoeff();
+    return max_v + 1000.0 * std::log(((v.array() - max_v) / 1000.0).exp().sum());
+}
+
+/**
+ * @brief Index of the first occurrence of value in v
+ */
+static int __first_index_of(const ConstAlignedVector &v, double value)
+{
+    int i = 0;
+    while (i < v.size() - 1 && v[i] != value)
+        i++;
+    return i;
+}
+
 AnyType vcrf_top1_label::run(AnyType& args) {
 
     ArrayHandle<double> mArray = args[0].getAs<ArrayHandle<double> >();
@@ -45,68 +137,66 @@ AnyType vcrf_top1_label::run(AnyType& args) {
         throw std::invalid_argument("Number of labels cannot be zero");
 
     int doc_len = static_cast<int>(rArray.size() / numLabels);
+    if (doc_len == 0) {
+        /* an empty document has no labels, and its only (empty) label
+         * sequence has probability one */
+        MutableArrayHandle<int> result(
+            madlib_construct_array(
+                NULL, 1, INT4TI.oid,
+                   INT4TI.len, INT4TI.byval, INT4TI.align));
+        result[0] = 1000000;
+        return result;
+    }
+    if (mArray.size() < static_cast<size_t>((numLabels + 2) * numLabels))
+        throw std::invalid_argument("Invalid dimension of mArray");
+
+    viterbi_context *ctx = __get_context(args, mArray, numLabels, doc_len);
+    const int stride = ctx->stride;
+    AlignedVector prev_top1(ctx->vectors, numLabels);
+    AlignedVector curr_top1(ctx->vectors + stride, numLabels);
+    AlignedVector prev_norm(ctx->vectors + 2 * stride, numLabels);
+    AlignedVector curr_norm(ctx->vectors + 3 * stride, numLabels);
+    AlignedVector scores(ctx->vectors + 4 * stride, numLabels);
+    ConstAlignedVector const_scores(scores.data(), numLabels);
+    int *path = ctx->path.ptr;
+    const double *end_features = mArray.ptr() + (numLabels + 1) * numLabels;
+
+    memset(path, 0, doc_len * numLabels * sizeof(int));
+
+    for (int label = 0; label < numLabels; label++) {
+        curr_norm[label] = rArray[label] + mArray[label];
+        curr_top1[label] = rArray[label] + mArray[label];
+    }
 
-    double* prev_top1_array = new double[numLabels];
-    double* curr_top1_array = new double[numLabels];
-    double* prev_norm_array = new double[numLabels];
-    double* curr_norm_array = new double[numLabels];
-    int* path = new int[doc_len*numLabels];
-
-    memset(prev_top1_array, 0, numLabels*sizeof(double));
-    memset(prev_norm_array, 0, numLabels*sizeof(double));
-    memset(path, 0, doc_len*numLabels*sizeof(int));
-
-    for(int start_pos = 0; start_pos < doc_len; start_pos++) {
-        memset(curr_top1_array, 0, numLabels*sizeof(double));
-        memset(curr_norm_array, 0, numLabels*sizeof(double));
-
-        if (start_pos == 0) {
-            for (int label = 0; label < numLabels; label++) {
-                 curr_norm_array[label] = rArray[label] + mArray[label];
-                 curr_top1_array[label] = rArray[label] + mArray[label];
+    for(int start_pos = 1; start_pos < doc_len; start_pos++) {
+        prev_top1 = curr_top1;
+        prev_norm = curr_norm;
+        const double *r = rArray.ptr() + start_pos * numLabels;
+        bool is_last = (start_pos == doc_len - 1);
+
+        for (int curr_label = 0; curr_label < numLabels; curr_label++) {
+            ConstAlignedVector trans(ctx->trans_t + curr_label * stride, numLabels);
+
+            /* best previous label; scores below zero are never selected and
+             * leave the path at label 0 */
+            scores.array() = (prev_top1.array() + r[curr_label]) + trans.array();
+            /* last token in a sentence, the end feature should be fired */
+            if (is_last)
+                scores.array() += end_features[curr_label];
+            double top1 = scores.maxCoeff();
+            if (top1 > 0) {
+                curr_top1[curr_label] = top1;
+                path[start_pos * numLabels + curr_label] =
+                    __first_index_of(const_scores, top1);
+            } else {
+                curr_top1[curr_label] = 0;
             }
-        } else {
-            for (int curr_label = 0; curr_label < numLabels; curr_label++) {
-                for (int prev_label = 0; prev_label < numLabels; prev_label++) {
-                    double top1_new_score = prev_top1_array[prev_label]
-                                               + rArray[start_pos*numLabels + curr_label]
-                                               + mArray[(prev_label+1)*numLabels + curr_label];
-
-                    if (start_pos == doc_len - 1)
-                        top1_new_score += mArray[(numLabels+1)*numLabels + curr_label];
-
-                    if (top1_new_score > curr_top1_array[curr_label]) {
-                        curr_top1_array[curr_label] = top1_new_score;
-                        path[start_pos*numLabels + curr_label] = prev_label;
-                    }
-
-                    /* calculate the probability of the best label sequence */
-                    double norm_new_score = prev_norm_array[prev_label]
-                                               + rArray[start_pos * numLabels + curr_label]
-                                               + mArray[(prev_label+1)*numLabels + curr_label];
-
-                    /* last token in a sentence, the end feature should be fired */
-                    if (start_pos == doc_len - 1)
-                        norm_new_score += mArray[(numLabels+1)*numLabels + curr_label];
-
-                    /* The following wants to do z = log(exp(x)+exp(y)), the faster implementation is
-                     *  z=min(x,y) + log(exp(abs(x-y))+1)
-                     *  0.5 is for rounding
-                     */
-                    if (curr_norm_array[curr_label] == 0)
-                        curr_norm_array[curr_label] = norm_new_score;
-                    else {
-                        double x = curr_norm_array[curr_label];
-                        double y = norm_new_score;
-                        curr_norm_array[curr_label] = std::min(x,y) +
-                                static_cast<double>(log(std::exp(std::abs(y-x)/1000.0) +1)*1000.0 + 0.5);
-                    }
-                }
-            }
-        }
-        for (int label = 0; label < numLabels; label++) {
-            prev_top1_array[label] = curr_top1_array[label];
-            prev_norm_array[label] = curr_norm_array[label];
+
+            /* log of the sum of the probabilities of all label sequences */
+            scores.array() = (prev_norm.array() + r[curr_label]) + trans.array();
+            if (is_last)
+                scores.array() += end_features[curr_label];
+            curr_norm[curr_label] = __log_sum_exp(const_scores);
         }
     }
 
@@ -114,8 +204,8 @@ AnyType vcrf_top1_label::run(AnyType& args) {
     double max_score = 0.0;
     int top1_label = 0;
     for(int label = 0; label < numLabels; label++) {
-        if(curr_top1_array[label] > max_score) {
-            max_score = curr_top1_array[label];
+        if(curr_top1[label] > max_score) {
+            max_score = curr_top1[label];
             top1_label = label;
         }
     }
@@ -136,21 +226,9 @@ AnyType vcrf_top1_label::run(AnyType& args) {
         result[pos-1] = top1_label;
     }
 
-    /* compute the sum_i of log(v1[i]/1000), return (e^sum)*1000
-     * used in the UDFs which needs marginalization e.g., normalization
-     * the following wants to do z=log(exp(x)+exp(y)), the faster implementation is
-     * z = min(x,y) + log(exp(abs(x-y))+1)
-     */
-    double norm_factor = 0.0;
-    for (int i = 0; i < numLabels; i++) {
-        if (i==0)
-            norm_factor = curr_norm_array[0];
-        else {
-            double x = curr_norm_array[i];
-            double y = norm_factor;
-            norm_factor = std::min(x,y) + static_cast<double>(log(exp(std::abs(y-x)/1000.0) +1)*1000.0+0.5);
-         }
-    }
+    /* normalization factor: log of the sum over all labels of the last token */
+    double norm_factor = __log_sum_exp(
+        ConstAlignedVector(curr_norm.data(), numLabels));
 
     /* calculate the conditional probability.
      * To convert the probability into integer, firstly,let it multiply 1000000, then later make the product divided by 1000000
@@ -158,12 +236,6 @@ AnyType vcrf_top1_label::run(AnyType& args) {
      */
     result[doc_len] = static_cast<int>(std::exp((max_score - norm_factor)/1000.0)*1000000);
 
-    delete[] prev_top1_array;
-    delete[] curr_top1_array;
-    delete[] prev_norm_array;
-    delete[] curr_norm_array;
-    delete[] path;
-
     return result;
 }
 
@@ -28,4 +28,5 @@
 #include "recursive_partitioning/decision_tree.hpp"
 #include "recursive_partitioning/random_forest.hpp"
 #include "recursive_partitioning/feature_encoding.hpp"
+#include "knn/knn.hpp"
 #include "utilities/utilities.hpp"
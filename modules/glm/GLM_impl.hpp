@@ -41,6 +41,7 @@ GLMAccumulator<Container,Family,Link>::reset() {
     terminated = false;
     loglik = 0.;
     dispersion_accum = 0.;
+    num_buffered_rows = 0;
     grad.setZero();
     hessian.setZero();
 }
@@ -67,6 +68,8 @@ GLMAccumulator<Container,Family,Link>::bind(
         >> loglik
         >> dispersion
         >> dispersion_accum
+        >> first_iteration
+        >> num_buffered_rows
         >> num_coef;
 
         uint16_t M = num_coef.isNull()
@@ -75,7 +78,8 @@ GLMAccumulator<Container,Family,Link>::bind(
         inStream
             >> beta.rebind(M)
             >> grad.rebind(M)
-            >> hessian.rebind(M, M);
+            >> hessian.rebind(M, M)
+            >> x_buffer.rebind(M, BLOCK_SIZE);
 
     // bind vcov and optimizer.hessian onto the same memory as we don't need them
     // at the same time
@@ -86,6 +90,11 @@ GLMAccumulator<Container,Family,Link>::bind(
 
 /**
  * @brief Update the accumulation state by feeding a tuple
+ *
+ * The Hessian \f$ X^T W X \f$ is symmetric, so only its lower triangle is
+ * accumulated. Rows are scaled by \f$ \sqrt{w} \f$ and buffered in
+ * \c x_buffer (one row per column), which is folded into the Hessian once it
+ * is full. See flush().
  */
 template <class Container, class Family, class Link>
 inline
@@ -113,34 +122,46 @@ GLMAccumulator<Container,Family,Link>::operator<<(
         warning("Inconsistent numbers of independent variables.");
     } else {
         // normal case
-        if (beta.norm() == 0.) {
+        double w;
+        if (first_iteration) {
             double mu = Link::init(y);
             double ita = Link::link_func(mu);
             double G_prime = Link::mean_derivative(ita);
             double V = Family::variance(mu);
-            double w = G_prime * G_prime / V;
+            w = G_prime * G_prime / V;
             // dispersion_accum += (y - mu) * (y - mu) / V;
             loglik += Family::loglik(y, mu, dispersion);
-            hessian += x * trans(x) * w; // X_trans_W_X
             grad -= x * w * ita; // X_trans_W_Y
         } else {
             double ita = trans(x) * beta;
             double mu = Link::mean_func(ita);
             double G_prime = Link::mean_derivative(ita);
             double V = Family::variance(mu);
-            double w = G_prime * G_prime / V;
+            w = G_prime * G_prime / V;
             dispersion_accum += (y - mu) * (y - mu) / V;
             loglik += Family::loglik(y, mu, dispersion);
-            
+
             if (!std::isfinite(static_cast<double>(loglik))) {
                 terminated = true;
                 warning("Log-likelihood becomes negative infinite. Maybe the model is not proper for this data set.");
                 return *this;
             }
-            
-            hessian += x * trans(x) * w; // X_trans_W_X
+
             grad -= x * (y - mu) * G_prime / V; // X_trans_W_Y
         }
+
+        // X_trans_W_X
+        if (w >= 0.) {
+            x_buffer.col(static_cast<uint16_t>(num_buffered_rows)) =
+                x * std::sqrt(w);
+            num_buffered_rows++;
+            if (num_buffered_rows == BLOCK_SIZE)
+                flush();
+        } else {
+            // Only possible if the variance function is not positive for
+            // the current mean (e.g., Poisson with identity link)
+            hessian.template selfadjointView<Eigen::Lower>().rankUpdate(x, w);
+        }
         num_rows ++;
         return *this;
     }
@@ -150,6 +171,22 @@ GLMAccumulator<Container,Family,Link>::operator<<(
     return *this;
 }
 
+/**
+ * @brief Fold all buffered rows into the lower triangle of the Hessian
+ */
+template <class Container, class Family, class Link>
+inline
+void
+GLMAccumulator<Container,Family,Link>::flush() {
+    uint16_t k = static_cast<uint16_t>(num_buffered_rows);
+    if (k == 0)
+        return;
+
+    hessian.template selfadjointView<Eigen::Lower>().rankUpdate(
+        x_buffer.leftCols(k));
+    num_buffered_rows = 0;
+}
+
 /**
  * @brief Merge with another accumulation state
  */
@@ -166,10 +203,17 @@ GLMAccumulator<Container,Family,Link>::operator<<(
         warning("Inconsistent numbers of independent variables.");
         terminated = true;
     } else {
+        flush();
         num_rows += inOther.num_rows;
         loglik += inOther.loglik;
         grad += inOther.grad;
-        hessian += inOther.hessian;
+        triangularView<Lower>(hessian) += inOther.hessian;
+        // The other state is immutable, so its pending rows are added here
+        // rather than by flushing it
+        if (inOther.num_buffered_rows > 0)
+            hessian.template selfadjointView<Eigen::Lower>().rankUpdate(
+                inOther.x_buffer.leftCols(
+                    static_cast<uint16_t>(inOther.num_buffered_rows)));
         dispersion_accum += inOther.dispersion_accum;
     }
 
@@ -196,22 +240,198 @@ template <class Container, class Family, class Link>
 inline
 void
 GLMAccumulator<Container,Family,Link>::apply() {
+    flush();
     if (!dbal::eigen_integration::isfinite(hessian) ||
             !dbal::eigen_integration::isfinite(grad)) {
         warning("Hessian or gradient is not finite.");
         terminated = true;
     } else {
+        // only the lower triangle of the hessian is referenced
         SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
                 hessian, EigenvaluesOnly, ComputePseudoInverse);
 
-        if (beta.norm() == 0.) {
+        if (first_iteration) {
             dispersion = 1.;
         } else {
             dispersion = dispersion_accum / static_cast<double>(num_rows);
         }
         hessian = decomposition.pseudoInverse(); // become inverse after apply
         beta -= hessian * grad;
+        first_iteration = false;
+    }
+}
+
+// -----------------------------------------------------------------------
+
+template <class Container, class Family, class Link>
+inline
+GLMLBFGSAccumulator<Container,Family,Link>::GLMLBFGSAccumulator(
+        Init_type& inInitialization)
+: Base(inInitialization) {
+
+    this->initialize();
+}
+
+/**
+ * @brief Reset the accumulator before accumulating the first tuple
+ */
+template <class Container, class Family, class Link>
+inline
+void
+GLMLBFGSAccumulator<Container,Family,Link>::reset() {
+    num_rows = 0;
+    terminated = false;
+    loglik = 0.;
+    grad.setZero();
+}
+
+/**
+ * @brief Bind all elements of the state to the data in the stream
+ */
+template <class Container, class Family, class Link>
+inline
+void
+GLMLBFGSAccumulator<Container,Family,Link>::bind(
+        ByteStream_type& inStream) {
+    inStream
+        >> num_rows
+        >> terminated
+        >> converged
+        >> loglik
+        >> num_coef;
+
+    uint16_t M = num_coef.isNull()
+        ? static_cast<uint16_t>(0)
+        : static_cast<uint16_t>(num_coef);
+    inStream
+        >> coef.rebind(M)
+        >> grad.rebind(M)
+        >> diag.rebind(M)
+        >> ws.rebind(LBFGS::workspaceSize(M, NUM_CORRECTIONS))
+        >> lbfgs_state.rebind(LBFGS::LBFGS_STATE_SIZE)
+        >> mcsrch_state.rebind(LBFGS::MCSRCH_STATE_SIZE);
+}
+
+/**
+ * @brief Update the accumulation state by feeding a tuple
+ */
+template <class Container, class Family, class Link>
+inline
+GLMLBFGSAccumulator<Container,Family,Link>&
+GLMLBFGSAccumulator<Container,Family,Link>::operator<<(
+        const tuple_type& inTuple) {
+    const MappedColumnVector& x = std::get<0>(inTuple);
+    const double& y = std::get<1>(inTuple);
+
+    if (!std::isfinite(y)) {
+        warning("Dependent variables are not finite.");
+    } else if (!Family::in_range(y)) {
+        std::stringstream err_msg;
+        err_msg << "Dependent variables are out of range: "
+            << Family::out_of_range_err_msg();
+        throw std::runtime_error(err_msg.str());
+    } else if (!dbal::eigen_integration::isfinite(x)) {
+        warning("Design matrix is not finite.");
+    } else if (x.size() > std::numeric_limits<uint16_t>::max()) {
+        warning("Number of independent variables cannot be "
+            "larger than 65535.");
+    } else if (num_coef != static_cast<uint16_t>(x.size())) {
+        warning("Inconsistent numbers of independent variables.");
+    } else {
+        double ita = trans(x) * coef;
+        double mu = Link::mean_func(ita);
+        double G_prime = Link::mean_derivative(ita);
+        double V = Family::variance(mu);
+        // dispersion is 1 for the binomial and Poisson families
+        loglik += Family::loglik(y, mu, 1.);
+
+        if (!std::isfinite(static_cast<double>(loglik))) {
+            terminated = true;
+            warning("Log-likelihood becomes negative infinite. Maybe the model is not proper for this data set.");
+            return *this;
+        }
+
+        grad -= x * (y - mu) * G_prime / V;
+        num_rows ++;
+        return *this;
+    }
+
+    // error case
+    terminated = true;
+    return *this;
+}
+
+/**
+ * @brief Merge with another accumulation state
+ */
+template <class Container, class Family, class Link>
+template <class C, class F, class L>
+inline
+GLMLBFGSAccumulator<Container,Family,Link>&
+GLMLBFGSAccumulator<Container,Family,Link>::operator<<(
+        const GLMLBFGSAccumulator<C,F,L>& inOther) {
+    if (this->empty()) {
+        *this = inOther;
+    } else if (inOther.empty()) {
+    } else if (num_coef != inOther.num_coef) {
+        warning("Inconsistent numbers of independent variables.");
+        terminated = true;
+    } else {
+        num_rows += inOther.num_rows;
+        loglik += inOther.loglik;
+        grad += inOther.grad;
+        terminated = terminated || inOther.terminated;
+    }
+
+    return *this;
+}
+
+/**
+ * @brief Copy from a previous state
+ */
+template <class Container, class Family, class Link>
+template <class C, class F, class L>
+inline
+GLMLBFGSAccumulator<Container,Family,Link>&
+GLMLBFGSAccumulator<Container,Family,Link>::operator=(
+        const GLMLBFGSAccumulator<C,F,L>& inOther) {
+    this->copy(inOther);
+    return *this;
+}
+
+/**
+ * @brief Take one step of the optimizer
+ *
+ * The step either moves coef to the next point of the line search, or marks
+ * the state as converged. A converged state is left unchanged.
+ */
+template <class Container, class Family, class Link>
+inline
+void
+GLMLBFGSAccumulator<Container,Family,Link>::apply() {
+    if (converged) { return; }
+
+    if (!dbal::eigen_integration::isfinite(grad)) {
+        warning("Gradient is not finite.");
+        terminated = true;
+        return;
+    }
+
+    double eps = 1e-5;      // accuracy of the solution to be found
+    double xtol = 1.0e-16;  // an estimate of the machine precision
+
+    LBFGS instance(*this);
+    instance.lbfgs(num_coef, NUM_CORRECTIONS, -static_cast<double>(loglik),
+                   grad, eps, xtol);
+    instance.save_state(*this);
+
+    if (instance.iflag < 0 || !dbal::eigen_integration::isfinite(coef)) {
+        warning("Over- or underflow in L-BFGS step, while updating "
+            "coefficients. Input data is likely of poor numerical condition.");
+        terminated = true;
+        return;
     }
+    converged = (instance.iflag == 0);
 }
 
 // -----------------------------------------------------------------------
@@ -10,6 +10,7 @@
 #include "family.hpp"
 #include "link.hpp"
 #include <modules/convex/newton.hpp>
+#include <modules/shared/LBFGS.hpp>
 
 namespace madlib {
 
@@ -29,6 +30,10 @@ public:
     MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
     typedef std::tuple<MappedColumnVector,double> tuple_type;
 
+    // Number of rows buffered before they are folded into the Hessian with
+    // a single rank-k update
+    enum { BLOCK_SIZE = 32 };
+
     GLMAccumulator(Init_type& inInitialization);
     void bind(ByteStream_type& inStream);
     GLMAccumulator& operator<<(const tuple_type& inTuple);
@@ -36,6 +41,7 @@ public:
     GLMAccumulator& operator<<(const GLMAccumulator<C,F,L>& inOther);
     template <class C, class F, class L>
     GLMAccumulator& operator=(const GLMAccumulator<C,F,L>& inOther);
+    void flush();
     void apply();
     void reset();
     bool empty() const { return this->num_rows == 0; }
@@ -45,12 +51,63 @@ public:
     double_type loglik;
     double_type dispersion; // to calculate loglik
     double_type dispersion_accum; // to accumulate the dispersion
+    bool_type first_iteration; // beta has not been estimated yet
+    uint16_type num_buffered_rows;
 
     Matrix_type vcov;
     uint16_type         num_coef;   // number of variables
     ColumnVector_type   beta;       // coefficients
     ColumnVector_type   grad;       // accumulating value of gradient
     Matrix_type         hessian;    // accumulating expected value of Hessian
+                                    // (lower triangle only until apply())
+    Matrix_type         x_buffer;   // sqrt(w) * x of rows not yet in hessian
+};
+
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Accumulator of the limited-memory BFGS optimizer for GLM
+ *
+ * Each iteration accumulates the log-likelihood and its gradient at the
+ * current coefficients, and apply() takes one step of the optimizer. Unlike
+ * GLMAccumulator, the state does not contain a num_coef x num_coef matrix,
+ * only the last NUM_CORRECTIONS correction pairs, so its size is linear in
+ * the number of coefficients. No Hessian is available for the variance of
+ * the coefficients, though.
+ */
+template <class Container, class Family=Binomial, class Link=Logit>
+class GLMLBFGSAccumulator
+  : public DynamicStruct<GLMLBFGSAccumulator<Container,Family,Link>,Container> {
+public:
+    typedef DynamicStruct<GLMLBFGSAccumulator,Container> Base;
+    MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
+    typedef std::tuple<MappedColumnVector,double> tuple_type;
+
+    // Number of corrections used in the LBFGS update
+    enum { NUM_CORRECTIONS = 7 };
+
+    GLMLBFGSAccumulator(Init_type& inInitialization);
+    void bind(ByteStream_type& inStream);
+    GLMLBFGSAccumulator& operator<<(const tuple_type& inTuple);
+    template <class C, class F, class L>
+    GLMLBFGSAccumulator& operator<<(const GLMLBFGSAccumulator<C,F,L>& inOther);
+    template <class C, class F, class L>
+    GLMLBFGSAccumulator& operator=(const GLMLBFGSAccumulator<C,F,L>& inOther);
+    void apply();
+    void reset();
+    bool empty() const { return this->num_rows == 0; }
+
+    uint64_type num_rows;
+    bool_type terminated;
+    bool_type converged;        // set by apply() once the gradient is small
+    double_type loglik;
+    uint16_type num_coef;
+    ColumnVector_type coef;     // coefficients (the LBFGS solution vector)
+    ColumnVector_type grad;     // accumulating gradient of -loglik
+    ColumnVector_type diag;     // LBFGS diagonal of the initial inverse Hessian
+    ColumnVector_type ws;       // LBFGS correction pairs and work space
+    ColumnVector_type lbfgs_state;
+    ColumnVector_type mcsrch_state;
 };
 
 // ------------------------------------------------------------------------
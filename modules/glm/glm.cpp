@@ -45,6 +45,8 @@ typedef GLMAccumulator<MutableRootContainer> MutableGLMState;
             GLMState prev_state = args[3].getAs<ByteString>(); \
             state = prev_state; \
             state.reset(); \
+        } else { \
+            state.first_iteration = true; \
         } \
     } \
  \
@@ -297,6 +299,133 @@ glm_loglik_diff::run(AnyType& args) {
 
 // ------------------------------------------------------------------------
 
+typedef GLMLBFGSAccumulator<RootContainer> GLMLBFGSState;
+typedef GLMLBFGSAccumulator<MutableRootContainer> MutableGLMLBFGSState;
+
+#define DEFINE_GLM_LBFGS_TRANSITION(_state_type) \
+    _state_type state = args[0].getAs<MutableByteString>(); \
+    if (state.terminated || args[1].isNull() || args[2].isNull()) { \
+        return args[0]; \
+    } \
+    double y = args[1].getAs<double>(); \
+    MappedColumnVector x; \
+    try { \
+        MappedColumnVector xx = args[2].getAs<MappedColumnVector>(); \
+        x.rebind(xx.memoryHandle(), xx.size()); \
+    } catch (const ArrayWithNullException &e) { \
+        return args[0]; \
+    } \
+ \
+    if (state.empty()) { \
+        state.num_coef = static_cast<uint16_t>(x.size()); \
+        state.resize(); \
+        if (!args[3].isNull()) { \
+            GLMLBFGSState prev_state = args[3].getAs<ByteString>(); \
+            state = prev_state; \
+            state.reset(); \
+        } else { \
+            state.diag.setOnes(); \
+        } \
+    } \
+ \
+    state << MutableGLMLBFGSState::tuple_type(x, y); \
+    return state.storage()
+
+typedef GLMLBFGSAccumulator<MutableRootContainer,Poisson,Log>
+    MutableGLMLBFGSPoissonLogState;
+
+AnyType
+glm_lbfgs_poisson_log_transition::run(AnyType& args) {
+    DEFINE_GLM_LBFGS_TRANSITION(MutableGLMLBFGSPoissonLogState);
+}
+
+typedef GLMLBFGSAccumulator<MutableRootContainer,Binomial,Probit>
+    MutableGLMLBFGSBinomialProbitState;
+
+AnyType
+glm_lbfgs_binomial_probit_transition::run(AnyType& args) {
+    DEFINE_GLM_LBFGS_TRANSITION(MutableGLMLBFGSBinomialProbitState);
+}
+
+typedef GLMLBFGSAccumulator<MutableRootContainer,Binomial,Logit>
+    MutableGLMLBFGSBinomialLogitState;
+
+AnyType
+glm_lbfgs_binomial_logit_transition::run(AnyType& args) {
+    DEFINE_GLM_LBFGS_TRANSITION(MutableGLMLBFGSBinomialLogitState);
+}
+
+AnyType
+glm_lbfgs_merge_states::run(AnyType& args) {
+    MutableGLMLBFGSState stateLeft = args[0].getAs<MutableByteString>();
+    GLMLBFGSState stateRight = args[1].getAs<ByteString>();
+
+    stateLeft << stateRight;
+    return stateLeft.storage();
+}
+
+AnyType
+glm_lbfgs_final::run(AnyType& args) {
+    MutableGLMLBFGSState state = args[0].getAs<MutableByteString>();
+
+    if (state.empty() || state.terminated) { return Null(); }
+
+    state.apply();
+    if (state.terminated) { return Null(); }
+
+    return state.storage();
+}
+
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Return the result of the L-BFGS optimizer
+ *
+ * The state does not contain the Hessian, so standard errors, z-statistics
+ * and p-values are NULL.
+ */
+AnyType
+glm_lbfgs_result::run(AnyType& args) {
+    if (args[0].isNull()) { return Null(); }
+
+    GLMLBFGSState state = args[0].getAs<ByteString>();
+    MutableNativeColumnVector coef(allocateArray<double>(state.num_coef));
+    coef = state.coef;
+
+    AnyType tuple;
+    tuple << coef
+          << static_cast<double>(state.loglik)
+          << Null()
+          << Null()
+          << Null()
+          << static_cast<uint64_t>(state.num_rows)
+          << 1.; // the binomial and Poisson families have dispersion 1
+
+    return tuple;
+}
+
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Relative difference in log-likelihood, 0 once the optimizer has
+ *     converged
+ */
+AnyType
+glm_lbfgs_loglik_diff::run(AnyType& args) {
+    if (args[0].isNull() || args[1].isNull()) {
+        return std::numeric_limits<double>::infinity();
+    }
+    GLMLBFGSState right = args[1].getAs<ByteString>();
+    if (right.converged) { return 0.; }
+
+    double a = GLMLBFGSState(args[0].getAs<ByteString>()).loglik;
+    double b = right.loglik;
+    if (a >= 0. || b >= 0.) { return 0.; } // probability = 1
+    return std::abs(a - b) / std::min(std::abs(a), std::abs(b));
+}
+
+// ------------------------------------------------------------------------
+
 AnyType glm_predict::run(AnyType &args) {
     try {
         args[0].getAs<MappedColumnVector>();
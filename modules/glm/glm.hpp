@@ -48,6 +48,33 @@ DECLARE_UDF(glm, glm_result_t_stats)
  */
 DECLARE_UDF(glm, glm_loglik_diff)
 
+/**
+ * @brief Generalized linear model (limited-memory BFGS): Transition function
+ */
+DECLARE_UDF(glm, glm_lbfgs_poisson_log_transition)
+DECLARE_UDF(glm, glm_lbfgs_binomial_probit_transition)
+DECLARE_UDF(glm, glm_lbfgs_binomial_logit_transition)
+
+/**
+ * @brief Generalized linear model (limited-memory BFGS): State merge function
+ */
+DECLARE_UDF(glm, glm_lbfgs_merge_states)
+
+/**
+ * @brief Generalized linear model (limited-memory BFGS): Final function
+ */
+DECLARE_UDF(glm, glm_lbfgs_final)
+
+/**
+ * @brief Generalized linear model (limited-memory BFGS): Result function
+ */
+DECLARE_UDF(glm, glm_lbfgs_result)
+
+/**
+ * @brief Generalized linear model (limited-memory BFGS): Distance function
+ */
+DECLARE_UDF(glm, glm_lbfgs_loglik_diff)
+
 /**
  * @brief Generalized linear model: Prediction function
  */
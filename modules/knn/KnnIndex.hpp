@@ -0,0 +1,463 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file KnnIndex.hpp
+ *
+ * @brief Vantage-point tree over a reference set, for exact kNN queries
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_MODULES_KNN_KNN_INDEX_HPP
+#define MADLIB_MODULES_KNN_KNN_INDEX_HPP
+
+#include <dbconnector/dbconnector.hpp>
+
+#include <boost/random/linear_congruential.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "NeighborHeap.hpp"
+
+namespace madlib {
+
+namespace modules {
+
+namespace knn {
+
+// Use Eigen
+using namespace dbal;
+using namespace dbal::eigen_integration;
+
+typedef Eigen::Map<const ColumnVector> ConstPointMap;
+
+// ------------------------------------------------------------------------
+// The index is a vantage-point tree. Every internal node picks one of its
+// points as vantage point and splits the remaining points at the median of
+// their distances to it. Since all supported metrics obey the triangle
+// inequality, a subtree whose distance range to the vantage point is
+// [lo, hi] can only contain a point within distance tau of a query q if
+// d(q, vp) - tau <= hi and d(q, vp) + tau >= lo.
+
+enum KnnIndexMetric {
+    kDistNorm1 = 1,
+    kDistNorm2 = 2,
+    kDistAngle = 3
+};
+
+/**
+ * @brief Resolve a distance function name (with or without schema)
+ */
+inline
+uint16_t
+knnIndexMetric(const std::string& inName) {
+    std::string name = inName;
+    name.erase(0, name.find_first_not_of(" \t\n"));
+    name.erase(name.find_last_not_of(" \t\n") + 1);
+    size_t dot = name.rfind('.');
+    if (dot != std::string::npos)
+        name = name.substr(dot + 1);
+
+    if (name == "dist_norm1")
+        return kDistNorm1;
+    else if (name == "dist_norm2")
+        return kDistNorm2;
+    else if (name == "dist_angle")
+        return kDistAngle;
+
+    throw std::invalid_argument("KNN error: Distance function of a kNN "
+        "index must be one of dist_norm1, dist_norm2 or dist_angle.");
+}
+
+/**
+ * @brief Distance between two points. The norms are only used by dist_angle.
+ *
+ * Same semantics as distNorm1(), distNorm2() and distAngle() in
+ * linalg/metric.cpp.
+ */
+inline
+double
+knnIndexDistance(uint16_t inMetric,
+    const ConstPointMap& inX, double inXNorm,
+    const ConstPointMap& inY, double inYNorm) {
+
+    switch (inMetric) {
+        case kDistNorm1:
+            return (inX - inY).lpNorm<1>();
+        case kDistNorm2:
+            return (inX - inY).norm();
+        default: {
+            if (inXNorm < std::numeric_limits<double>::denorm_min()
+                || inYNorm < std::numeric_limits<double>::denorm_min())
+                return std::acos(-1.);
+
+            double cosine = inX.dot(inY) / (inXNorm * inYNorm);
+            if (cosine > 1)
+                cosine = 1;
+            else if (cosine < -1)
+                cosine = -1;
+            return std::acos(cosine);
+        }
+    }
+}
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Transition state of the index build aggregate
+ *
+ * Collects (id, point) records. The record buffer is the last member, so
+ * growing it with resize() keeps the records collected so far in place.
+ */
+template <class Container>
+class KnnIndexBuildState
+  : public DynamicStruct<KnnIndexBuildState<Container>, Container> {
+public:
+    typedef DynamicStruct<KnnIndexBuildState, Container> Base;
+    MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
+
+    KnnIndexBuildState(Init_type& inInitialization): Base(inInitialization) {
+        this->initialize();
+    }
+
+    void bind(ByteStream_type& inStream) {
+        inStream >> num_points >> capacity >> dimension >> metric;
+
+        uint32_t cap = 0u;
+        uint32_t dim = 0u;
+        if (!capacity.isNull()) {
+            cap = capacity;
+            dim = dimension;
+        }
+        inStream >> records.rebind(static_cast<Index>(cap) * (dim + 1));
+    }
+
+    void append(double inId, const double* inPoint) {
+        if (num_points == capacity) {
+            capacity = std::max(2u * static_cast<uint32_t>(capacity), 16u);
+            this->resize();
+        }
+        double* record = records.data()
+            + static_cast<Index>(num_points) * (dimension + 1);
+        record[0] = inId;
+        std::memcpy(record + 1, inPoint, dimension * sizeof(double));
+        num_points++;
+    }
+
+    template <class OtherContainer>
+    KnnIndexBuildState& operator<<(
+        const KnnIndexBuildState<OtherContainer>& inOther) {
+
+        if (static_cast<uint32_t>(inOther.dimension) != dimension
+                || static_cast<uint16_t>(inOther.metric) != metric) {
+            throw std::runtime_error("KNN error: Inconsistent dimensions "
+                "or distance functions in kNN index build.");
+        }
+        const double* record = inOther.records.data();
+        for (uint32_t i = 0; i < inOther.num_points; i++) {
+            append(record[0], record + 1);
+            record += dimension + 1;
+        }
+        return *this;
+    }
+
+    bool empty() const { return this->num_points == 0; }
+
+    uint32_type num_points;
+    uint32_type capacity;
+    uint32_type dimension;
+    uint16_type metric;
+    ColumnVector_type records;
+};
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Serialized kNN index
+ *
+ * Points are stored as the columns of a matrix, in tree order, so that every
+ * subtree covers a contiguous range of columns. Each node is one column of
+ * the node matrix, see the kNode* offsets below.
+ */
+template <class Container>
+class KnnIndexModel
+  : public DynamicStruct<KnnIndexModel<Container>, Container> {
+public:
+    typedef DynamicStruct<KnnIndexModel, Container> Base;
+    MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
+
+    enum {
+        kNodeBegin = 0,     // first point of the subtree (vantage point)
+        kNodeEnd,           // end of the subtree
+        kNodeInner,         // index of inner child, < 0 for leaf nodes
+        kNodeOuter,         // index of outer child
+        kNodeInnerMin,      // range of d(vp, x) in the inner subtree
+        kNodeInnerMax,
+        kNodeOuterMin,      // range of d(vp, x) in the outer subtree
+        kNodeOuterMax,
+        kNodeWidth
+    };
+
+    KnnIndexModel(Init_type& inInitialization): Base(inInitialization) {
+        this->initialize();
+    }
+
+    void bind(ByteStream_type& inStream) {
+        inStream >> num_points >> dimension >> metric >> num_nodes;
+
+        uint32_t n = 0u;
+        uint32_t dim = 0u;
+        uint32_t n_nodes = 0u;
+        if (!num_nodes.isNull()) {
+            n = num_points;
+            dim = dimension;
+            n_nodes = num_nodes;
+        }
+        inStream
+            >> ids.rebind(n)
+            >> norms.rebind(n)
+            >> points.rebind(dim, n)
+            >> nodes.rebind(kNodeWidth, n_nodes);
+    }
+
+    template <class OtherContainer>
+    void build(const KnnIndexBuildState<OtherContainer>& inState);
+
+    uint32_t search(const ConstPointMap& inQuery, uint32_t inK,
+        Neighbor* outNeighbors) const;
+
+    uint32_type num_points;
+    uint32_type dimension;
+    uint16_type metric;
+    uint32_type num_nodes;
+    ColumnVector_type ids;
+    ColumnVector_type norms;
+    Matrix_type points;
+    Matrix_type nodes;
+
+private:
+    /**
+     * @brief Recursive construction over mPerm[inBegin, inEnd)
+     */
+    class Builder {
+    public:
+        // Subtrees of at most this many points are scanned linearly
+        enum { kLeafSize = 16 };
+
+        Builder(const double* inRecords, uint32_t inNumPoints,
+            uint32_t inDimension, uint16_t inMetric)
+          : mRecords(inRecords), mDimension(inDimension), mMetric(inMetric),
+            mPerm(inNumPoints), mNorms(inNumPoints), mScratch(inNumPoints),
+            mRng(0) {
+
+            for (uint32_t i = 0; i < inNumPoints; i++) {
+                mPerm[i] = i;
+                mNorms[i] = point(i).norm();
+            }
+        }
+
+        ConstPointMap point(uint32_t inIndex) const {
+            return ConstPointMap(mRecords
+                + static_cast<Index>(inIndex) * (mDimension + 1) + 1,
+                mDimension);
+        }
+
+        double id(uint32_t inIndex) const {
+            return mRecords[static_cast<Index>(inIndex) * (mDimension + 1)];
+        }
+
+        double distance(uint32_t inI, uint32_t inJ) const {
+            return knnIndexDistance(mMetric, point(inI), mNorms[inI],
+                point(inJ), mNorms[inJ]);
+        }
+
+        int32_t build(uint32_t inBegin, uint32_t inEnd) {
+            int32_t node = static_cast<int32_t>(mNodes.size() / kNodeWidth);
+            mNodes.resize(mNodes.size() + kNodeWidth, 0.);
+            double* n = &mNodes[node * kNodeWidth];
+            n[kNodeBegin] = inBegin;
+            n[kNodeEnd] = inEnd;
+            n[kNodeInner] = -1;
+            n[kNodeOuter] = -1;
+            if (inEnd - inBegin <= kLeafSize)
+                return node;
+
+            // random vantage point, moved to the front of the range
+            uint32_t vp = inBegin + static_cast<uint32_t>(
+                mRng() % (inEnd - inBegin));
+            std::swap(mPerm[inBegin], mPerm[vp]);
+            for (uint32_t i = inBegin + 1; i < inEnd; i++) {
+                mScratch[i] = std::make_pair(
+                    distance(mPerm[inBegin], mPerm[i]), mPerm[i]);
+            }
+            uint32_t mid = inBegin + 1 + (inEnd - inBegin - 1) / 2;
+            std::nth_element(mScratch.begin() + inBegin + 1,
+                mScratch.begin() + mid, mScratch.begin() + inEnd);
+
+            double inner_min = std::numeric_limits<double>::infinity();
+            double inner_max = -inner_min;
+            double outer_min = inner_min;
+            double outer_max = -inner_min;
+            for (uint32_t i = inBegin + 1; i < inEnd; i++) {
+                double d = mScratch[i].first;
+                mPerm[i] = mScratch[i].second;
+                if (i < mid) {
+                    inner_min = std::min(inner_min, d);
+                    inner_max = std::max(inner_max, d);
+                } else {
+                    outer_min = std::min(outer_min, d);
+                    outer_max = std::max(outer_max, d);
+                }
+            }
+            int32_t inner = build(inBegin + 1, mid);
+            int32_t outer = build(mid, inEnd);
+
+            // mNodes may have been reallocated by the recursive calls
+            n = &mNodes[node * kNodeWidth];
+            n[kNodeInner] = inner;
+            n[kNodeOuter] = outer;
+            n[kNodeInnerMin] = inner_min;
+            n[kNodeInnerMax] = inner_max;
+            n[kNodeOuterMin] = outer_min;
+            n[kNodeOuterMax] = outer_max;
+            return node;
+        }
+
+        const double* mRecords;
+        uint32_t mDimension;
+        uint16_t mMetric;
+        std::vector<uint32_t> mPerm;
+        std::vector<double> mNorms;
+        std::vector<std::pair<double, uint32_t> > mScratch;
+        std::vector<double> mNodes;
+        boost::minstd_rand mRng;
+    };
+
+    /**
+     * @brief Branch-and-bound search state for a single query
+     */
+    class Searcher {
+    public:
+        Searcher(const KnnIndexModel& inModel, const ConstPointMap& inQuery,
+            uint32_t inK, Neighbor* ioHeap)
+          : mModel(inModel), mQuery(inQuery), mQueryNorm(inQuery.norm()),
+            mK(inK), mNum(0), mHeap(ioHeap) { }
+
+        double tau() const {
+            return mNum < mK ? std::numeric_limits<double>::infinity()
+                : mHeap[0].dist;
+        }
+
+        double visitPoint(Index inIndex) {
+            Neighbor candidate;
+            candidate.dist = knnIndexDistance(mModel.metric, mQuery,
+                mQueryNorm,
+                ConstPointMap(mModel.points.data()
+                    + inIndex * mModel.points.rows(), mModel.points.rows()),
+                mModel.norms(inIndex));
+            candidate.id = mModel.ids(inIndex);
+            candidate.label = 0.;
+            mNum = offerNeighbor(mHeap, mNum, mK, candidate);
+            return candidate.dist;
+        }
+
+        void visit(Index inNode) {
+            const double* n = mModel.nodes.data() + inNode * kNodeWidth;
+            Index begin = static_cast<Index>(n[kNodeBegin]);
+            Index end = static_cast<Index>(n[kNodeEnd]);
+            if (n[kNodeInner] < 0) {
+                for (Index i = begin; i < end; i++)
+                    visitPoint(i);
+                return;
+            }
+
+            double d = visitPoint(begin);
+            // descend first into the side the query falls in, which
+            // usually tightens tau the most
+            bool inner_first =
+                d < 0.5 * (n[kNodeInnerMax] + n[kNodeOuterMin]);
+            for (int pass = 0; pass < 2; pass++) {
+                bool inner = (pass == 0) == inner_first;
+                double lo = inner ? n[kNodeInnerMin] : n[kNodeOuterMin];
+                double hi = inner ? n[kNodeInnerMax] : n[kNodeOuterMax];
+                double t = tau();
+                if (d - t <= hi && d + t >= lo) {
+                    visit(static_cast<Index>(
+                        inner ? n[kNodeInner] : n[kNodeOuter]));
+                }
+            }
+        }
+
+        const KnnIndexModel& mModel;
+        const ConstPointMap& mQuery;
+        double mQueryNorm;
+        uint32_t mK;
+        uint32_t mNum;
+        Neighbor* mHeap;
+    };
+};
+
+/**
+ * @brief Build the tree over all records of the build state
+ */
+template <class Container>
+template <class OtherContainer>
+inline
+void
+KnnIndexModel<Container>::build(
+    const KnnIndexBuildState<OtherContainer>& inState) {
+
+    uint32_t n = inState.num_points;
+    uint32_t dim = inState.dimension;
+    Builder builder(inState.records.data(), n, dim, inState.metric);
+    builder.build(0, n);
+
+    num_points = n;
+    dimension = dim;
+    metric = inState.metric;
+    num_nodes = static_cast<uint32_t>(builder.mNodes.size() / kNodeWidth);
+    this->resize();
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t orig = builder.mPerm[i];
+        ids(i) = builder.id(orig);
+        norms(i) = builder.mNorms[orig];
+        points.col(i) = builder.point(orig);
+    }
+    std::copy(builder.mNodes.begin(), builder.mNodes.end(), nodes.data());
+}
+
+/**
+ * @brief Find the (at most) k nearest neighbors of a query point
+ *
+ * @param outNeighbors Array of capacity k, filled in ascending order of
+ *     distance
+ * @return The number of neighbors found
+ */
+template <class Container>
+inline
+uint32_t
+KnnIndexModel<Container>::search(const ConstPointMap& inQuery, uint32_t inK,
+    Neighbor* outNeighbors) const {
+
+    if (static_cast<uint32_t>(inQuery.size()) != dimension) {
+        throw std::invalid_argument("KNN error: Dimension of query point "
+            "does not match the kNN index.");
+    }
+    Searcher searcher(*this, inQuery, inK, outNeighbors);
+    if (num_points > 0 && inK > 0)
+        searcher.visit(0);
+    std::sort_heap(outNeighbors, outNeighbors + searcher.mNum,
+        NeighborLess());
+    return searcher.mNum;
+}
+
+} // namespace knn
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif // defined(MADLIB_MODULES_KNN_KNN_INDEX_HPP)
@@ -0,0 +1,76 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file NeighborHeap.hpp
+ *
+ * @brief Bounded max-heap of the k nearest neighbors seen so far
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_MODULES_KNN_NEIGHBOR_HEAP_HPP
+#define MADLIB_MODULES_KNN_NEIGHBOR_HEAP_HPP
+
+#include <algorithm>
+
+namespace madlib {
+
+namespace modules {
+
+namespace knn {
+
+/**
+ * @brief A candidate neighbor. All members are doubles so that an array of
+ *     neighbors can be stored in (and mapped onto) a ColumnVector.
+ */
+struct Neighbor {
+    double dist;
+    double id;
+    double label;
+};
+
+/**
+ * @brief Order neighbors by distance, then by id
+ *
+ * Same as ReverseLexicographicComparator in linalg/metric.cpp: with this
+ * order, std heap functions build a max-heap whose front is the farthest of
+ * the current k nearest neighbors, and ties are broken by the smaller id.
+ */
+struct NeighborLess {
+    bool operator()(const Neighbor& inN1, const Neighbor& inN2) const {
+        return inN1.dist < inN2.dist ||
+            (inN1.dist == inN2.dist && inN1.id < inN2.id);
+    }
+};
+
+/**
+ * @brief Offer a candidate to a heap of capacity k holding n neighbors
+ *
+ * @return The new number of neighbors in the heap
+ */
+inline
+uint32_t
+offerNeighbor(Neighbor* ioHeap, uint32_t inNumNeighbors, uint32_t inK,
+    const Neighbor& inCandidate) {
+
+    NeighborLess less;
+    if (inNumNeighbors < inK) {
+        ioHeap[inNumNeighbors] = inCandidate;
+        std::push_heap(ioHeap, ioHeap + inNumNeighbors + 1, less);
+        return inNumNeighbors + 1;
+    }
+    if (inK > 0 && less(inCandidate, ioHeap[0])) {
+        // Unfortunately, the STL does not have a decrease-key function,
+        // so we are wasting a bit of performance here
+        std::pop_heap(ioHeap, ioHeap + inK, less);
+        ioHeap[inK - 1] = inCandidate;
+        std::push_heap(ioHeap, ioHeap + inK, less);
+    }
+    return inNumNeighbors;
+}
+
+} // namespace knn
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif // defined(MADLIB_MODULES_KNN_NEIGHBOR_HEAP_HPP)
@@ -0,0 +1,363 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file knn.cpp
+ *
+ * @brief Top-k neighbor selection and voting for k-nearest neighbors
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#include <dbconnector/dbconnector.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "NeighborHeap.hpp"
+#include "KnnIndex.hpp"
+#include "knn.hpp"
+
+namespace madlib {
+
+namespace modules {
+
+namespace knn {
+
+// Use Eigen
+using namespace dbal;
+using namespace dbal::eigen_integration;
+
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Transition state of the top-k vote aggregate
+ *
+ * The state keeps a bounded max-heap of (distance, id, label) triples, so its
+ * size is O(k) regardless of the number of candidate rows. Two states can be
+ * merged by offering the neighbors of one to the heap of the other, which
+ * lets the aggregate run in parallel on segments.
+ */
+template <class Container>
+class KnnVoteState
+  : public DynamicStruct<KnnVoteState<Container>, Container> {
+public:
+    typedef DynamicStruct<KnnVoteState, Container> Base;
+    MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
+
+    KnnVoteState(Init_type& inInitialization): Base(inInitialization) {
+        this->initialize();
+    }
+
+    void bind(ByteStream_type& inStream) {
+        inStream >> k >> num_neighbors >> is_classification >> weighted;
+
+        uint32_t capacity = 0u;
+        if (!k.isNull()) {
+            capacity = k;
+        }
+        inStream >> neighbors.rebind(capacity * kNeighborWidth);
+    }
+
+    KnnVoteState& operator<<(const Neighbor& inNeighbor) {
+        num_neighbors = offerNeighbor(heap(), num_neighbors, k, inNeighbor);
+        return *this;
+    }
+
+    template <class OtherContainer>
+    KnnVoteState& operator<<(const KnnVoteState<OtherContainer>& inOther) {
+        for (uint32_t i = 0; i < inOther.num_neighbors; i++) {
+            *this << inOther.heap()[i];
+        }
+        return *this;
+    }
+
+    Neighbor* heap() {
+        return reinterpret_cast<Neighbor*>(neighbors.data());
+    }
+
+    const Neighbor* heap() const {
+        return reinterpret_cast<const Neighbor*>(neighbors.data());
+    }
+
+    bool empty() const { return this->num_neighbors == 0; }
+
+    static const uint32_t kNeighborWidth =
+        sizeof(Neighbor) / sizeof(double);
+
+    uint32_type k;
+    uint32_type num_neighbors;
+    bool_type is_classification;
+    bool_type weighted;
+    ColumnVector_type neighbors;
+};
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Inverse-distance weights
+ *
+ * If any neighbor coincides with the query point, only the coinciding
+ * neighbors vote, each with weight 1.
+ */
+static
+void
+inverseDistanceWeights(const Neighbor* inNeighbors, uint32_t inNum,
+    double* outWeights) {
+
+    bool has_exact_match = false;
+    for (uint32_t i = 0; i < inNum; i++) {
+        if (inNeighbors[i].dist <= 0.) {
+            has_exact_match = true;
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < inNum; i++) {
+        if (has_exact_match) {
+            outWeights[i] = inNeighbors[i].dist <= 0. ? 1. : 0.;
+        } else {
+            outWeights[i] = 1. / inNeighbors[i].dist;
+        }
+    }
+}
+// ------------------------------------------------------------------------
+
+AnyType
+knn_vote_transition::run(AnyType& args) {
+    KnnVoteState<MutableRootContainer> state =
+        args[0].getAs<MutableByteString>();
+
+    // rows without a distance or a label cannot vote
+    if (args[1].isNull() || args[3].isNull()) {
+        return args[0];
+    }
+
+    if (state.k.isNull() || state.k == 0) {
+        int32_t k = args[4].getAs<int32_t>();
+        if (k <= 0) {
+            throw std::runtime_error(
+                "KNN error: Number of neighbors k must be a positive integer.");
+        }
+        state.k = static_cast<uint32_t>(k);
+        state.num_neighbors = 0;
+        state.is_classification = args[5].getAs<bool>();
+        state.weighted = args[6].getAs<bool>();
+        state.resize();
+    }
+
+    Neighbor neighbor;
+    neighbor.dist = args[1].getAs<double>();
+    neighbor.id = args[2].isNull() ? 0. :
+        static_cast<double>(args[2].getAs<int64_t>());
+    neighbor.label = args[3].getAs<double>();
+    if (std::isnan(neighbor.dist)) {
+        return state.storage();
+    }
+
+    state << neighbor;
+    return state.storage();
+}
+// ------------------------------------------------------------------------
+
+AnyType
+knn_vote_merge::run(AnyType& args) {
+    KnnVoteState<MutableRootContainer> stateLeft =
+        args[0].getAs<MutableByteString>();
+    KnnVoteState<RootContainer> stateRight = args[1].getAs<ByteString>();
+
+    if (stateLeft.empty()) {
+        return stateRight.storage();
+    } else if (stateRight.empty()) {
+        return stateLeft.storage();
+    }
+
+    stateLeft << stateRight;
+    return stateLeft.storage();
+}
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Predict from the k nearest neighbors
+ *
+ * Classification uses (optionally inverse-distance weighted) majority voting,
+ * where ties are resolved in favor of the smallest label. Regression uses
+ * the (optionally inverse-distance weighted) mean of the labels.
+ */
+AnyType
+knn_vote_final::run(AnyType& args) {
+    KnnVoteState<RootContainer> state = args[0].getAs<ByteString>();
+
+    // If we haven't seen any valid data, just return Null. This is the
+    // standard behavior of aggregate function on empty data sets
+    if (state.empty()) { return Null(); }
+
+    const Neighbor* neighbors = state.heap();
+    uint32_t num = state.num_neighbors;
+    ColumnVector weights = ColumnVector::Ones(num);
+    if (state.weighted) {
+        inverseDistanceWeights(neighbors, num, weights.data());
+    }
+
+    if (!state.is_classification) {
+        double weighted_sum = 0.;
+        for (uint32_t i = 0; i < num; i++) {
+            weighted_sum += weights(i) * neighbors[i].label;
+        }
+        return weighted_sum / weights.sum();
+    }
+
+    std::map<double, double> votes;
+    for (uint32_t i = 0; i < num; i++) {
+        votes[neighbors[i].label] += weights(i);
+    }
+    std::map<double, double>::const_iterator winner = votes.begin();
+    for (std::map<double, double>::const_iterator it = votes.begin();
+            it != votes.end(); ++it) {
+        if (it->second > winner->second) { winner = it; }
+    }
+    return winner->first;
+}
+// ------------------------------------------------------------------------
+
+AnyType
+knn_index_transition::run(AnyType& args) {
+    KnnIndexBuildState<MutableRootContainer> state =
+        args[0].getAs<MutableByteString>();
+    if (args[1].isNull() || args[2].isNull()) {
+        return args[0];
+    }
+
+    MappedColumnVector point;
+    try {
+        MappedColumnVector x = args[2].getAs<MappedColumnVector>();
+        point.rebind(x.memoryHandle(), x.size());
+    } catch (const ArrayWithNullException &e) {
+        return args[0];
+    }
+
+    if (state.empty()) {
+        state.dimension = static_cast<uint32_t>(point.size());
+        state.metric = knnIndexMetric(args[3].getAs<char *>());
+    } else if (static_cast<uint32_t>(point.size()) != state.dimension) {
+        throw std::runtime_error("KNN error: All points of a kNN index "
+            "must have the same dimension.");
+    }
+
+    state.append(static_cast<double>(args[1].getAs<int64_t>()), point.data());
+    return state.storage();
+}
+// ------------------------------------------------------------------------
+
+AnyType
+knn_index_merge::run(AnyType& args) {
+    KnnIndexBuildState<MutableRootContainer> stateLeft =
+        args[0].getAs<MutableByteString>();
+    KnnIndexBuildState<RootContainer> stateRight = args[1].getAs<ByteString>();
+
+    if (stateLeft.empty()) {
+        return stateRight.storage();
+    } else if (stateRight.empty()) {
+        return stateLeft.storage();
+    }
+
+    stateLeft << stateRight;
+    return stateLeft.storage();
+}
+// ------------------------------------------------------------------------
+
+AnyType
+knn_index_final::run(AnyType& args) {
+    KnnIndexBuildState<RootContainer> state = args[0].getAs<ByteString>();
+    if (state.empty()) { return Null(); }
+
+    KnnIndexModel<MutableRootContainer> model =
+        defaultAllocator().allocateByteString<
+            dbal::FunctionContext, dbal::DoZero, dbal::ThrowBadAlloc>(0);
+    model.build(state);
+    return model.storage();
+}
+// ------------------------------------------------------------------------
+
+/*
+    @brief Return the serialized index in args[0]
+
+    An index is typically queried once per row with the same model, which can
+    be large. The model is therefore detoasted once and kept in the fn_extra
+    cache of the calling function (see RawDatumKey).
+*/
+struct KnnIndexCache {
+    RawDatumKey key;
+    CacheBuffer<char> model;
+};
+
+static const bytea*
+getKnnIndex(AnyType &args) {
+    const void *raw = args[0].getRawPointer();
+
+    KnnIndexCache *cache =
+        static_cast<KnnIndexCache*>(args.getUserFuncContext());
+    if (cache == NULL) {
+        cache = static_cast<KnnIndexCache*>(MemoryContextAllocZero(
+            args.getCacheMemoryContext(), sizeof(KnnIndexCache)));
+        args.setUserFuncContext(cache);
+    }
+    if (cache->key.matches(raw))
+        return reinterpret_cast<const bytea*>(cache->model.ptr);
+
+    cache->key.invalidate();
+    ByteString model = args[0].getAs<ByteString>();
+    size_t model_size = VARSIZE(model.byteString());
+    char *copy = cache->model.reserve(args.getCacheMemoryContext(),
+                                      model_size);
+    std::memcpy(copy, model.byteString(), model_size);
+    cache->key.assign(args.getCacheMemoryContext(), raw);
+    return reinterpret_cast<const bytea*>(copy);
+}
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Find the k nearest neighbors of a point in a kNN index
+ *
+ * Returns the ids and distances of the neighbors, in ascending order of
+ * distance. Fewer than k neighbors are returned if the index is smaller.
+ */
+AnyType
+knn_index_query::run(AnyType& args) {
+    MappedColumnVector x;
+    try {
+        MappedColumnVector xx = args[1].getAs<MappedColumnVector>();
+        x.rebind(xx.memoryHandle(), xx.size());
+    } catch (const ArrayWithNullException &e) {
+        return Null();
+    }
+    int32_t k = args[2].getAs<int32_t>();
+    if (k <= 0) {
+        throw std::invalid_argument(
+            "KNN error: Number of neighbors k must be a positive integer.");
+    }
+
+    ByteString storage(getKnnIndex(args));
+    KnnIndexModel<RootContainer> model(storage);
+
+    std::vector<Neighbor> neighbors(std::min(static_cast<uint32_t>(k),
+        static_cast<uint32_t>(model.num_points)));
+    uint32_t num = model.search(ConstPointMap(x.data(), x.size()),
+        static_cast<uint32_t>(neighbors.size()), neighbors.data());
+
+    MutableArrayHandle<int64_t> ids = allocateArray<int64_t,
+        dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(num);
+    MutableArrayHandle<double> distances = allocateArray<double,
+        dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(num);
+    for (uint32_t i = 0; i < num; ++i) {
+        ids[i] = static_cast<int64_t>(neighbors[i].id);
+        distances[i] = neighbors[i].dist;
+    }
+
+    AnyType tuple;
+    return tuple << ids << distances;
+}
+
+} // namespace knn
+
+} // namespace modules
+
+} // namespace madlib
@@ -0,0 +1,42 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file knn.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+/**
+ * @brief k-nearest neighbors: Transition function of the top-k vote aggregate
+ */
+DECLARE_UDF(knn, knn_vote_transition)
+
+/**
+ * @brief k-nearest neighbors: State merge function of the top-k vote aggregate
+ */
+DECLARE_UDF(knn, knn_vote_merge)
+
+/**
+ * @brief k-nearest neighbors: Final function of the top-k vote aggregate
+ */
+DECLARE_UDF(knn, knn_vote_final)
+
+/**
+ * @brief k-nearest neighbors: Transition function of the index build
+ *     aggregate
+ */
+DECLARE_UDF(knn, knn_index_transition)
+
+/**
+ * @brief k-nearest neighbors: State merge function of the index build
+ *     aggregate
+ */
+DECLARE_UDF(knn, knn_index_merge)
+
+/**
+ * @brief k-nearest neighbors: Final function of the index build aggregate
+ */
+DECLARE_UDF(knn, knn_index_final)
+
+/**
+ * @brief k-nearest neighbors: Find the k nearest neighbors in an index
+ */
+DECLARE_UDF(knn, knn_index_query)
@@ -15,6 +15,9 @@
 #include <algorithm>
 #include <functional>
 #include <numeric>
+#include <new>
+#include <vector>
+#include <boost/random/linear_congruential.hpp>
 #include "lda.hpp"
 
 namespace madlib {
@@ -53,6 +56,7 @@ static type_info INT8TI(INT8OID);
  *                      multinomial
  * @param beta          The Dirichlet parameter for the per-topic word
  *                      multinomial
+ * @param topic_prs     Scratch buffer of length topic_num
  * @return retopic      The new topic assignment to the word
  * @note The topic ranges from 0 to topic_num - 1.
  *
@@ -64,13 +68,9 @@ static type_info INT8TI(INT8OID);
  **/
 static int32_t __lda_gibbs_sample(
     int32_t topic_num, int32_t topic, const int32_t * count_d_z, const int32_t * count_w_z,
-    const int64_t * count_z, double alpha, double beta)
+    const int64_t * count_z, double alpha, double beta, double * topic_prs)
 {
-    /* The cumulative probability distribution of the topics */
-    double * topic_prs = new double[topic_num];
-    if(!topic_prs)
-        throw std::runtime_error("out of memory");
-
+    /* topic_prs holds the cumulative probability distribution of the topics */
     /* Calculate topic (unnormalised) probabilities */
     double total_unpr = 0;
     for (int32_t i = 0; i < topic_num; i++) {
@@ -110,10 +110,445 @@ static int32_t __lda_gibbs_sample(
         retopic++;
     }
 
-    delete[] topic_prs;
     return retopic;
 }
 
+/**
+ * @brief The topics with a non-zero count for one word of the vocabulary.
+ * The list is built lazily the first time the word is sampled and may
+ * contain stale topics whose count has since dropped to zero; these are
+ * dropped the next time the list is scanned.
+ **/
+typedef struct __word_topics{
+    int32_t *topics;
+    int32_t size;
+    int32_t capacity;
+} word_topics;
+
+/**
+ * @brief State of the sparse sampler, which follows the bucket decomposition
+ * of SparseLDA (Yao, Mimno and McCallum, 2009):
+ *
+ *   p(z) ~ alpha * beta / (n_z + K * beta)               (smoothing bucket)
+ *        + n_dz * beta / (n_z + K * beta)                (document bucket)
+ *        + (n_dz + alpha) * n_wz / (n_z + K * beta)      (word bucket)
+ *
+ * The masses of the first two buckets are maintained incrementally, and the
+ * word bucket only visits the topics with n_wz > 0. Most draws fall into the
+ * word or document bucket, so the cost per token is proportional to the
+ * number of non-zero topics of the word and the document instead of the
+ * total number of topics. The smoothing bucket carries over from one
+ * document to the next, and only the topics of the previous document are
+ * reset when a new document starts.
+ **/
+typedef struct __sparse_sampler{
+    double *coef;               // 1 / (n_z + K * beta)
+    double *doc_coef;           // (n_dz + alpha) * coef[z]
+    double *word_prs;           // scratch: cumulative word bucket
+    int32_t *doc_topics;        // topics with n_dz > 0
+    int32_t *doc_topic_pos;     // position in doc_topics, -1 if absent
+    int32_t doc_topic_size;
+    double smoothing_mass;
+    double doc_mass;
+    int32_t docs_until_refresh; // full recomputation when this reaches 0
+    word_topics *words;         // one entry per word of the vocabulary
+    boost::minstd_rand rng;
+} sparse_sampler;
+
+/**
+ * @brief Read-only view of a model in the sparse format, which is stored in
+ * a bigint[] as follows:
+ *
+ *   [0]                        SPARSE_MODEL_TAG
+ *   [1], [2], [3]              voc_size, topic_num, nnz
+ *   [4, 4 + K)                 corpus topic counts
+ *   [4 + K, 5 + K + V)         row offsets: the entries of word w are
+ *                              [offsets[w], offsets[w + 1])
+ *   [5 + K + V, 5 + K + V + nnz)
+ *                              nnz int32 topics followed by nnz int32
+ *                              counts, sorted by topic within a word
+ *
+ * Only the non-zero word topic counts are stored. The ceiling flag of a word
+ * (column topic_num of the dense format) is stored as an entry with topic
+ * topic_num and count 1, which is thus always the last entry of its word.
+ * A dense model never starts with a negative value, which tells the two
+ * formats apart.
+ **/
+static const int64_t SPARSE_MODEL_TAG = -0x4c44415350LL;
+static const size_t SPARSE_MODEL_HEADER = 4;
+
+typedef struct __sparse_model{
+    int32_t voc_size;
+    int32_t topic_num;
+    int64_t nnz;
+    const int64_t *topic_counts;
+    const int64_t *offsets;
+    const int32_t *topics;
+    const int32_t *counts;
+} sparse_model;
+
+static size_t __sparse_model_size(
+    int32_t voc_size, int32_t topic_num, int64_t nnz)
+{
+    // nnz int32 topics and nnz int32 counts take nnz bigints
+    return SPARSE_MODEL_HEADER + topic_num + (voc_size + 1) + nnz;
+}
+
+static bool __is_sparse_model(
+    const int64_t *model, size_t size, int32_t voc_size, int32_t topic_num)
+{
+    return size >= SPARSE_MODEL_HEADER && model[0] == SPARSE_MODEL_TAG
+        && model[1] == voc_size && model[2] == topic_num;
+}
+
+static void __sparse_model_bind(
+    sparse_model *sm, const int64_t *model, size_t size)
+{
+    sm->voc_size = static_cast<int32_t>(model[1]);
+    sm->topic_num = static_cast<int32_t>(model[2]);
+    sm->nnz = model[3];
+    if (sm->nnz < 0 ||
+            size != __sparse_model_size(sm->voc_size, sm->topic_num, sm->nnz)) {
+        std::stringstream ss;
+        ss << "invalid dimension: sparse model size = " << size;
+        throw std::invalid_argument(ss.str());
+    }
+    sm->topic_counts = model + SPARSE_MODEL_HEADER;
+    sm->offsets = sm->topic_counts + sm->topic_num;
+    sm->topics = reinterpret_cast<const int32_t *>(
+        sm->offsets + sm->voc_size + 1);
+    sm->counts = sm->topics + sm->nnz;
+    if (sm->offsets[0] != 0 || sm->offsets[sm->voc_size] != sm->nnz)
+        throw std::invalid_argument("invalid row offsets in sparse model");
+}
+
+/**
+ * @brief Return the topic count of one word from a sparse model
+ **/
+static int32_t __sparse_model_count(
+    const sparse_model *sm, int32_t wordid, int32_t topic)
+{
+    const int32_t *begin = sm->topics + sm->offsets[wordid];
+    const int32_t *end = sm->topics + sm->offsets[wordid + 1];
+    const int32_t *it = std::lower_bound(begin, end, topic);
+    return (it != end && *it == topic) ? sm->counts[it - sm->topics] : 0;
+}
+
+/**
+ * @brief The topic counts of one word that have been changed by training in
+ * the current statement, which supersede the row of the sparse model
+ **/
+typedef struct __word_row{
+    int32_t *topics;
+    int32_t *counts;
+    int32_t size;
+    int32_t capacity;
+} word_row;
+
+/**
+ * @brief The function context of lda_gibbs_sample, kept across calls
+ *
+ * With a dense model, model is a copy of it and the topic counts of word w
+ * are model[w * (topic_num + 1) ...]. With a sparse model, the topic counts
+ * of the word being sampled are expanded into word_counts, and written back
+ * to rows after the word has been sampled in training.
+ **/
+typedef struct __lda_context{
+    int32_t *model;
+    int64_t *running_topic_counts;
+    double *topic_prs;          // scratch for the dense sampler
+    sparse_sampler *sparse;     // NULL unless the sparse sampler is used
+    sparse_model *sm;           // NULL unless the model is sparse
+    word_row *rows;             // only allocated for training
+    int32_t *word_counts;       // scratch of length topic_num + 1
+} lda_context;
+
+/**
+ * @brief Return the topic counts of a word, with the ceiling flag at index
+ * topic_num. Must be paired with __word_counts_end().
+ **/
+static int32_t * __word_counts_begin(
+    lda_context *context, int32_t wordid, int32_t topic_num)
+{
+    if (context->sm == NULL)
+        return context->model + wordid * (topic_num + 1);
+
+    int32_t *word_counts = context->word_counts;
+    word_row *row = context->rows ? &context->rows[wordid] : NULL;
+    if (row && row->topics) {
+        for (int32_t i = 0; i < row->size; i++)
+            word_counts[row->topics[i]] = row->counts[i];
+    } else {
+        const sparse_model *sm = context->sm;
+        for (int64_t i = sm->offsets[wordid]; i < sm->offsets[wordid + 1]; i++)
+            word_counts[sm->topics[i]] = sm->counts[i];
+    }
+    return word_counts;
+}
+
+/**
+ * @brief Write the topic counts of a word back after training, and clear
+ * the scratch buffer. If wt is not NULL, it lists all topics with a non-zero
+ * count (as maintained by the sparse sampler), otherwise all topics are
+ * scanned.
+ **/
+static void __word_counts_end(
+    lda_context *context, MemoryContext mem_ctx, int32_t wordid,
+    int32_t topic_num, const word_topics *wt)
+{
+    if (context->sm == NULL)
+        return;
+
+    int32_t *word_counts = context->word_counts;
+    int32_t candidate_num = wt ? wt->size : topic_num;
+    if (context->rows) {
+        word_row *row = &context->rows[wordid];
+        int32_t nnz = word_counts[topic_num] != 0 ? 1 : 0;
+        for (int32_t i = 0; i < candidate_num; i++)
+            if (word_counts[wt ? wt->topics[i] : i] > 0)
+                nnz++;
+        if (row->topics == NULL || nnz > row->capacity) {
+            // an allocated row, even an empty one, marks the word as changed
+            int32_t capacity = std::max(nnz, 1);
+            if (row->topics)
+                pfree(row->topics);
+            row->topics = static_cast<int32_t *>(
+                MemoryContextAlloc(mem_ctx, 2 * capacity * sizeof(int32_t)));
+            row->counts = row->topics + capacity;
+            row->capacity = capacity;
+        }
+        row->size = 0;
+        for (int32_t i = 0; i < candidate_num; i++) {
+            int32_t z = wt ? wt->topics[i] : i;
+            if (word_counts[z] > 0) {
+                row->topics[row->size] = z;
+                row->counts[row->size++] = word_counts[z];
+            }
+        }
+        if (word_counts[topic_num] != 0) {
+            row->topics[row->size] = topic_num;
+            row->counts[row->size++] = word_counts[topic_num];
+        }
+    }
+
+    if (wt) {
+        for (int32_t i = 0; i < wt->size; i++)
+            word_counts[wt->topics[i]] = 0;
+        word_counts[topic_num] = 0;
+    } else {
+        memset(word_counts, 0, (topic_num + 1) * sizeof(int32_t));
+    }
+}
+
+static sparse_sampler * __sparse_sampler_create(
+    MemoryContext mem_ctx, int32_t voc_size, int32_t topic_num, uint32_t seed)
+{
+    sparse_sampler *ss = static_cast<sparse_sampler *>(
+        MemoryContextAllocZero(mem_ctx, sizeof(sparse_sampler)));
+    ss->coef = static_cast<double *>(
+        MemoryContextAllocZero(mem_ctx, 3 * topic_num * sizeof(double)));
+    ss->doc_coef = ss->coef + topic_num;
+    ss->word_prs = ss->doc_coef + topic_num;
+    ss->doc_topics = static_cast<int32_t *>(
+        MemoryContextAllocZero(mem_ctx, 2 * topic_num * sizeof(int32_t)));
+    ss->doc_topic_pos = ss->doc_topics + topic_num;
+    ss->words = static_cast<word_topics *>(
+        MemoryContextAllocZero(mem_ctx, voc_size * sizeof(word_topics)));
+    new (&ss->rng) boost::minstd_rand(seed);
+    return ss;
+}
+
+static double __sparse_uniform(sparse_sampler *ss)
+{
+    return static_cast<double>(ss->rng() - ss->rng.min())
+        / (static_cast<double>(ss->rng.max() - ss->rng.min()) + 1.);
+}
+
+static void __word_topics_append(
+    MemoryContext mem_ctx, word_topics *wt, int32_t topic)
+{
+    if (wt->size == wt->capacity) {
+        int32_t capacity = wt->capacity < 4 ? 4 : 2 * wt->capacity;
+        int32_t *topics = static_cast<int32_t *>(
+            MemoryContextAlloc(mem_ctx, capacity * sizeof(int32_t)));
+        if (wt->topics) {
+            memcpy(topics, wt->topics, wt->size * sizeof(int32_t));
+            pfree(wt->topics);
+        }
+        wt->topics = topics;
+        wt->capacity = capacity;
+    }
+    wt->topics[wt->size++] = topic;
+}
+
+static void __word_topics_build(
+    MemoryContext mem_ctx, word_topics *wt, const int32_t *count_w_z,
+    int32_t topic_num)
+{
+    for (int32_t z = 0; z < topic_num; z++)
+        if (count_w_z[z] > 0)
+            __word_topics_append(mem_ctx, wt, z);
+    if (!wt->topics)
+        __word_topics_append(mem_ctx, wt, 0);
+}
+
+/**
+ * @brief Remove the contribution of topic z from the bucket masses. Must be
+ * paired with __sparse_add_topic() once the counts of z have been updated.
+ **/
+static void __sparse_remove_topic(
+    sparse_sampler *ss, int32_t z, int32_t ndz, double alpha, double beta)
+{
+    ss->smoothing_mass -= alpha * beta * ss->coef[z];
+    ss->doc_mass -= beta * ndz * ss->coef[z];
+}
+
+static void __sparse_add_topic(
+    sparse_sampler *ss, int32_t z, int32_t ndz, int64_t nz,
+    int32_t topic_num, double alpha, double beta)
+{
+    ss->coef[z] = 1. / (static_cast<double>(nz) + topic_num * beta);
+    ss->doc_coef[z] = (ndz + alpha) * ss->coef[z];
+    ss->smoothing_mass += alpha * beta * ss->coef[z];
+    ss->doc_mass += beta * ndz * ss->coef[z];
+
+    int32_t pos = ss->doc_topic_pos[z];
+    if (ndz > 0 && pos < 0) {
+        ss->doc_topic_pos[z] = ss->doc_topic_size;
+        ss->doc_topics[ss->doc_topic_size++] = z;
+    } else if (ndz == 0 && pos >= 0) {
+        int32_t last = ss->doc_topics[--ss->doc_topic_size];
+        ss->doc_topics[pos] = last;
+        ss->doc_topic_pos[last] = pos;
+        ss->doc_topic_pos[z] = -1;
+    }
+}
+
+/**
+ * @brief Set up the document bucket for a new document
+ *
+ * Only the topics of the previous document and of the new one are visited,
+ * so the cost is proportional to the document lengths rather than to
+ * topic_num. Every topic_num documents, all bucket masses are recomputed
+ * from scratch instead, which bounds the floating point drift of the
+ * incremental updates at an amortized O(1) cost per document.
+ **/
+static void __sparse_begin_doc(
+    sparse_sampler *ss, int32_t topic_num, const int32_t *count_d_z,
+    const int32_t *assignments, int32_t word_count, const int64_t *count_z,
+    double alpha, double beta)
+{
+    if (ss->docs_until_refresh <= 0) {
+        ss->smoothing_mass = 0.;
+        for (int32_t z = 0; z < topic_num; z++) {
+            ss->coef[z] = 1. / (static_cast<double>(count_z[z])
+                + topic_num * beta);
+            ss->doc_coef[z] = alpha * ss->coef[z];
+            ss->smoothing_mass += alpha * beta * ss->coef[z];
+            ss->doc_topic_pos[z] = -1;
+        }
+        ss->docs_until_refresh = topic_num;
+    } else {
+        for (int32_t i = 0; i < ss->doc_topic_size; i++) {
+            int32_t z = ss->doc_topics[i];
+            ss->doc_coef[z] = alpha * ss->coef[z];
+            ss->doc_topic_pos[z] = -1;
+        }
+    }
+    ss->docs_until_refresh--;
+    ss->doc_topic_size = 0;
+    ss->doc_mass = 0.;
+
+    for (int32_t i = 0; i < word_count; i++) {
+        int32_t z = assignments[i];
+        if (ss->doc_topic_pos[z] >= 0)
+            continue;
+        ss->doc_topic_pos[z] = ss->doc_topic_size;
+        ss->doc_topics[ss->doc_topic_size++] = z;
+        ss->doc_coef[z] = (count_d_z[z] + alpha) * ss->coef[z];
+        ss->doc_mass += beta * count_d_z[z] * ss->coef[z];
+    }
+}
+
+/**
+ * @brief Draw a topic for a word whose current assignment has already been
+ * removed from all the counts, using the bucket decomposition above.
+ * @note Returns the same distribution as __lda_gibbs_sample.
+ **/
+static int32_t __lda_sparse_gibbs_sample(
+    sparse_sampler *ss, int32_t topic_num, word_topics *wt,
+    const int32_t *count_d_z, const int32_t *count_w_z,
+    double alpha, double beta)
+{
+    /* Word bucket: visit the non-zero topics of the word, dropping stale
+     * entries along the way */
+    double word_mass = 0.;
+    for (int32_t i = 0; i < wt->size; ) {
+        int32_t z = wt->topics[i];
+        if (count_w_z[z] <= 0) {
+            wt->topics[i] = wt->topics[--wt->size];
+            continue;
+        }
+        word_mass += count_w_z[z] * ss->doc_coef[z];
+        ss->word_prs[i] = word_mass;
+        i++;
+    }
+
+    double r = __sparse_uniform(ss)
+        * (ss->smoothing_mass + ss->doc_mass + word_mass);
+    if (r < word_mass) {
+        int32_t i = static_cast<int32_t>(
+            std::upper_bound(ss->word_prs, ss->word_prs + wt->size, r)
+                - ss->word_prs);
+        return wt->topics[std::min(i, wt->size - 1)];
+    }
+
+    r -= word_mass;
+    if (r < ss->doc_mass && ss->doc_topic_size > 0) {
+        int32_t i = 0;
+        for (; i < ss->doc_topic_size - 1; i++) {
+            int32_t z = ss->doc_topics[i];
+            r -= beta * count_d_z[z] * ss->coef[z];
+            if (r < 0)
+                break;
+        }
+        return ss->doc_topics[i];
+    }
+
+    r -= ss->doc_mass;
+    int32_t z = 0;
+    for (; z < topic_num - 1; z++) {
+        r -= alpha * beta * ss->coef[z];
+        if (r < 0)
+            break;
+    }
+    return z;
+}
+
+/**
+ * @brief Change the document and model counts of topic z for one word,
+ * keeping the sparse sampler state consistent
+ **/
+static void __sparse_update_counts(
+    sparse_sampler *ss, MemoryContext mem_ctx, word_topics *wt, int32_t z,
+    int32_t *count_d_z, int32_t *count_w_z, int64_t *count_z,
+    int32_t doc_delta, int32_t model_delta,
+    int32_t topic_num, double alpha, double beta)
+{
+    __sparse_remove_topic(ss, z, count_d_z[z], alpha, beta);
+    count_d_z[z] += doc_delta;
+    if (model_delta != 0) {
+        // Increments only happen right after the word list has been scanned
+        // by the sampler, at which point it holds exactly the non-zero
+        // topics, so appending on 0 -> 1 cannot create duplicates.
+        if (count_w_z[z] == 0 && model_delta > 0)
+            __word_topics_append(mem_ctx, wt, z);
+        count_w_z[z] += model_delta;
+        count_z[z] += model_delta;
+    }
+    __sparse_add_topic(ss, z, count_d_z[z], count_z[z], topic_num, alpha, beta);
+}
+
 /**
  * @brief Get the min value of an array - for parameter checking
  * @return      The min value
@@ -163,7 +598,7 @@ static int32_t __sum(ArrayHandle<int32_t> ah){
  * @param args[1]   The counts of each unique words
  * @param args[2]   The topic counts and topic assignments in the document
  * @param args[3]   The model (word topic counts and corpus topic
- *                  counts)
+ *                  counts), in the dense or the sparse format
  * @param args[4]   The Dirichlet parameter for per-document topic
  *                  multinomial, i.e. alpha
  * @param args[5]   The Dirichlet parameter for per-topic word
@@ -171,8 +606,14 @@ static int32_t __sum(ArrayHandle<int32_t> ah){
  * @param args[6]   The size of vocabulary
  * @param args[7]   The number of topics
  * @param args[8]   The number of iterations (=1:training, >1:prediction)
+ * @param args[9]   (Optional) Whether to use the sparse sampler
+ * @param args[10]  (Optional) The seed of the sparse sampler; if NULL, a
+ *                  fixed default seed is used
  * @return          The updated topic counts and topic assignments for
  *                  the document
+ * @note The sparse sampler draws from the same conditional distribution,
+ * except that in prediction the current word is not subtracted from the
+ * (fixed) model counts, which it is not part of.
  **/
 AnyType lda_gibbs_sample::run(AnyType & args)
 {
@@ -221,72 +662,186 @@ AnyType lda_gibbs_sample::run(AnyType & args)
         __max(doc_topic, topic_num, word_count) >= topic_num)
         throw std::invalid_argument( "invalid values in topic_assignment");
 
+    bool use_sparse = args.numFields() > 9 && !args[9].isNull()
+        && args[9].getAs<bool>();
+
     if (!args.getUserFuncContext()) {
         ArrayHandle<int64_t> model64 = args[3].getAs<ArrayHandle<int64_t> >();
-        if (model64.size() != model64_size) {
-            std::stringstream ss;
-            ss << "invalid dimension: model64.size() = " << model64.size();
-            throw std::invalid_argument(ss.str());
-        }
-        if (__min(model64) < 0) {
-            throw std::invalid_argument("invalid topic counts in model");
-        }
+        lda_context *context =
+            static_cast<lda_context *>(
+                MemoryContextAllocZero(
+                    args.getCacheMemoryContext(), sizeof(lda_context)));
+
+        if (__is_sparse_model(model64.ptr(), model64.size(), voc_size,
+                              topic_num)) {
+            // Keep the sparse model as is: word topic counts are expanded
+            // one word at a time, and only words changed by training get a
+            // mutable row
+            int64_t *model_copy = static_cast<int64_t *>(
+                MemoryContextAlloc(
+                    args.getCacheMemoryContext(),
+                    model64.size() * sizeof(int64_t)));
+            memcpy(model_copy, model64.ptr(), model64.size() * sizeof(int64_t));
+            context->sm = static_cast<sparse_model *>(
+                MemoryContextAllocZero(
+                    args.getCacheMemoryContext(), sizeof(sparse_model)));
+            __sparse_model_bind(context->sm, model_copy,
+                                model64.size());
 
-        int32_t *context =
-            static_cast<int32_t *>(
+            context->running_topic_counts = static_cast<int64_t *>(
+                MemoryContextAlloc(
+                    args.getCacheMemoryContext(),
+                    topic_num * sizeof(int64_t)));
+            memcpy(context->running_topic_counts,
+                   context->sm->topic_counts,
+                   topic_num * sizeof(int64_t));
+            context->word_counts = static_cast<int32_t *>(
                 MemoryContextAllocZero(
                     args.getCacheMemoryContext(),
-                    model64.size() * sizeof(int64_t)
-                        + topic_num * sizeof(int64_t)));
-        memcpy(context, model64.ptr(), model64.size() * sizeof(int64_t));
-        int32_t *model = context;
+                    (topic_num + 1) * sizeof(int32_t)));
+            if (iter_num == 1) {
+                context->rows = static_cast<word_row *>(
+                    MemoryContextAllocZero(
+                        args.getCacheMemoryContext(),
+                        voc_size * sizeof(word_row)));
+            }
+        } else {
+            if (model64.size() != model64_size) {
+                std::stringstream ss;
+                ss << "invalid dimension: model64.size() = " << model64.size();
+                throw std::invalid_argument(ss.str());
+            }
+            if (__min(model64) < 0) {
+                throw std::invalid_argument("invalid topic counts in model");
+            }
 
-        int64_t *running_topic_counts = reinterpret_cast<int64_t *>(
-                context + model64_size * sizeof(int64_t) / sizeof(int32_t));
-        for (int i = 0; i < voc_size; i ++) {
-            for (int j = 0; j < topic_num; j ++) {
-                running_topic_counts[j] += model[i * (topic_num + 1) + j];
+            context->model =
+                static_cast<int32_t *>(
+                    MemoryContextAllocZero(
+                        args.getCacheMemoryContext(),
+                        model64.size() * sizeof(int64_t)
+                            + topic_num * sizeof(int64_t)));
+            memcpy(context->model, model64.ptr(), model64.size() * sizeof(int64_t));
+            int32_t *model = context->model;
+
+            int64_t *running_topic_counts = reinterpret_cast<int64_t *>(
+                    model + model64_size * sizeof(int64_t) / sizeof(int32_t));
+            for (int i = 0; i < voc_size; i ++) {
+                for (int j = 0; j < topic_num; j ++) {
+                    running_topic_counts[j] += model[i * (topic_num + 1) + j];
+                }
             }
+            context->running_topic_counts = running_topic_counts;
         }
+        context->topic_prs =
+            static_cast<double *>(
+                MemoryContextAllocZero(
+                    args.getCacheMemoryContext(),
+                    topic_num * sizeof(double)));
 
         args.setUserFuncContext(context);
     }
 
-    int32_t *context = static_cast<int32_t *>(args.getUserFuncContext());
+    lda_context *context = static_cast<lda_context *>(args.getUserFuncContext());
     if (context == NULL) {
         throw std::runtime_error("args.mSysInfo->user_fctx is null");
     }
-    int32_t *model = context;
-    int64_t *running_topic_counts = reinterpret_cast<int64_t *>(
-            context + model64_size * sizeof(int64_t) / sizeof(int32_t));
+    int64_t *running_topic_counts = context->running_topic_counts;
+
+    if (use_sparse && context->sparse == NULL) {
+        uint32_t seed = (args.numFields() > 10 && !args[10].isNull())
+            ? static_cast<uint32_t>(args[10].getAs<int32_t>())
+            : 1u;
+        context->sparse = __sparse_sampler_create(
+            args.getCacheMemoryContext(), voc_size, topic_num, seed);
+    }
 
     int32_t unique_word_count = static_cast<int32_t>(words.size());
+    if (use_sparse) {
+        sparse_sampler *ss = context->sparse;
+        MemoryContext mem_ctx = args.getCacheMemoryContext();
+        int32_t *count_d_z = doc_topic.ptr();
+        bool is_training = (iter_num == 1);
+        __sparse_begin_doc(ss, topic_num, count_d_z, count_d_z + topic_num,
+                           word_count, running_topic_counts, alpha, beta);
+        for(int32_t it = 0; it < iter_num; it++){
+            int32_t word_index = topic_num;
+            for(int32_t i = 0; i < unique_word_count; i++) {
+                int32_t wordid = words[i];
+                int32_t *count_w_z =
+                    __word_counts_begin(context, wordid, topic_num);
+                word_topics *wt = &ss->words[wordid];
+                if (wt->topics == NULL)
+                    __word_topics_build(mem_ctx, wt, count_w_z, topic_num);
+
+                for(int32_t j = 0; j < counts[i]; j++){
+                    int32_t topic = doc_topic[word_index];
+
+                    /* Take the word out of the counts */
+                    bool in_model = is_training && count_w_z[topic] > 0
+                        && running_topic_counts[topic] > 0;
+                    __sparse_update_counts(ss, mem_ctx, wt, topic, count_d_z,
+                        count_w_z, running_topic_counts, -1, in_model ? -1 : 0,
+                        topic_num, alpha, beta);
+
+                    int32_t retopic = __lda_sparse_gibbs_sample(
+                        ss, topic_num, wt, count_d_z, count_w_z, alpha, beta);
+
+                    /* Put it back with the new topic. Same overflow rule as
+                     * the dense sampler: the model keeps the old topic if the
+                     * new count would get too large. */
+                    int64_t retopic_count = count_w_z[retopic]
+                        + ((in_model && retopic == topic) ? 1 : 0);
+                    bool model_moves = in_model && retopic_count <= 2e9;
+                    if (in_model && !model_moves) {
+                        __sparse_update_counts(ss, mem_ctx, wt, topic,
+                            count_d_z, count_w_z, running_topic_counts, 0, 1,
+                            topic_num, alpha, beta);
+                    }
+                    __sparse_update_counts(ss, mem_ctx, wt, retopic, count_d_z,
+                        count_w_z, running_topic_counts, 1, model_moves ? 1 : 0,
+                        topic_num, alpha, beta);
+                    if (in_model && !model_moves)
+                        count_w_z[topic_num] = 1;
+
+                    doc_topic[word_index] = retopic;
+                    word_index++;
+                }
+                __word_counts_end(context, mem_ctx, wordid, topic_num, wt);
+            }
+        }
+        return doc_topic;
+    }
+
     for(int32_t it = 0; it < iter_num; it++){
         int32_t word_index = topic_num;
         for(int32_t i = 0; i < unique_word_count; i++) {
             int32_t wordid = words[i];
+            int32_t *count_w_z =
+                __word_counts_begin(context, wordid, topic_num);
             for(int32_t j = 0; j < counts[i]; j++){
                 int32_t topic = doc_topic[word_index];
                 int32_t retopic = __lda_gibbs_sample(
-                    topic_num, topic, doc_topic.ptr(),
-                    model + wordid * (topic_num + 1),
-                    running_topic_counts, alpha, beta);
+                    topic_num, topic, doc_topic.ptr(), count_w_z,
+                    running_topic_counts, alpha, beta, context->topic_prs);
                 doc_topic[word_index] = retopic;
                 doc_topic[topic]--;
                 doc_topic[retopic]++;
 
                 if(iter_num == 1) {
-                    if (model[wordid * (topic_num + 1) + retopic] <= 2e9) {
+                    if (count_w_z[retopic] <= 2e9) {
                         running_topic_counts[topic] --;
                         running_topic_counts[retopic] ++;
-                        model[wordid * (topic_num + 1) + topic]--;
-                        model[wordid * (topic_num + 1) + retopic]++;
+                        count_w_z[topic]--;
+                        count_w_z[retopic]++;
                     } else {
-                        model[wordid * (topic_num + 1) + topic_num] = 1;
+                        count_w_z[topic_num] = 1;
                     }
                 }
                 word_index++;
             }
+            __word_counts_end(context, args.getCacheMemoryContext(), wordid,
+                              topic_num, NULL);
         }
     }
 
@@ -434,6 +989,271 @@ AnyType lda_count_topic_prefunc::run(AnyType & args)
     return state1;
 }
 
+/**
+ * @brief An entry of the state of the sparse topic count aggregate, with
+ * key = wordid * (topic_num + 1) + topic
+ **/
+typedef struct __topic_count{
+    int64_t key;
+    int64_t count;
+} topic_count;
+
+static bool __topic_count_less(const topic_count &a, const topic_count &b)
+{
+    return a.key < b.key;
+}
+
+/**
+ * The state of the sparse topic count aggregate is a bigint[] holding
+ * voc_size, topic_num, the number of entries, the number of sorted entries,
+ * and then the entries. The entries in [0, num_sorted) form a sorted run
+ * without duplicate keys; new entries are appended behind it and merged into
+ * it whenever the state is full, so the state stays proportional to the
+ * number of non-zero word topic counts.
+ **/
+static const size_t TOPIC_COUNT_STATE_HEADER = 4;
+
+static topic_count * __topic_count_entries(MutableArrayHandle<int64_t> &state)
+{
+    return reinterpret_cast<topic_count *>(
+        state.ptr() + TOPIC_COUNT_STATE_HEADER);
+}
+
+/**
+ * @brief Sort the entries and collapse equal keys
+ * @return The number of entries left
+ **/
+static int64_t __topic_count_compact(
+    topic_count *entries, int64_t num_sorted, int64_t num_entries)
+{
+    std::sort(entries + num_sorted, entries + num_entries, __topic_count_less);
+    std::inplace_merge(entries, entries + num_sorted, entries + num_entries,
+                       __topic_count_less);
+    int64_t n = 0;
+    for (int64_t i = 0; i < num_entries; i++) {
+        if (n > 0 && entries[n - 1].key == entries[i].key)
+            entries[n - 1].count += entries[i].count;
+        else
+            entries[n++] = entries[i];
+    }
+    return n;
+}
+
+/**
+ * @brief Make room for num_new entries, compacting the state first and
+ * moving it to a larger array unless compaction freed at least half of it
+ **/
+static MutableArrayHandle<int64_t> __topic_count_reserve(
+    MutableArrayHandle<int64_t> state, int64_t num_new)
+{
+    int64_t capacity = static_cast<int64_t>(
+        (state.size() - TOPIC_COUNT_STATE_HEADER) / 2);
+    if (state[2] + num_new <= capacity)
+        return state;
+
+    state[2] = __topic_count_compact(
+        __topic_count_entries(state), state[3], state[2]);
+    state[3] = state[2];
+    if (2 * (state[2] + num_new) <= capacity)
+        return state;
+
+    int64_t new_capacity = std::max(2 * capacity, 2 * (state[2] + num_new));
+    MutableArrayHandle<int64_t> grown(
+        madlib_construct_array(
+            NULL,
+            static_cast<int>(TOPIC_COUNT_STATE_HEADER + 2 * new_capacity),
+            INT8TI.oid, INT8TI.len, INT8TI.byval, INT8TI.align));
+    memcpy(grown.ptr(), state.ptr(),
+           (TOPIC_COUNT_STATE_HEADER + 2 * state[2]) * sizeof(int64_t));
+    return grown;
+}
+
+/**
+ * @brief This function is the sfunc for the aggregator computing the topic
+ * counts in the sparse format. It scans the topic assignments in a document
+ * and appends its non-zero word topic counts to the state.
+ * @param args[0]   The state variable, current topic counts
+ * @param args[1]   The unique words in the document
+ * @param args[2]   The counts of each unique word in the document
+ * @param args[3]   The topic assignments in the document
+ * @param args[4]   The size of vocabulary
+ * @param args[5]   The number of topics
+ * @return          The updated state
+ **/
+AnyType lda_count_topic_sparse_sfunc::run(AnyType & args)
+{
+    if(args[4].isNull() || args[5].isNull())
+        throw std::invalid_argument("null parameter - voc_size and/or \
+        topic_num is null");
+
+    if(args[1].isNull() || args[2].isNull() || args[3].isNull())
+        return args[0];
+
+    int32_t voc_size = args[4].getAs<int32_t>();
+    int32_t topic_num = args[5].getAs<int32_t>();
+    if(voc_size <= 0)
+        throw std::invalid_argument(
+            "invalid argument - voc_size");
+    if(topic_num <= 0)
+        throw std::invalid_argument(
+            "invalid argument - topic_num");
+
+    ArrayHandle<int32_t> words = args[1].getAs<ArrayHandle<int32_t> >();
+    ArrayHandle<int32_t> counts = args[2].getAs<ArrayHandle<int32_t> >();
+    ArrayHandle<int32_t> topic_assignment = args[3].getAs<ArrayHandle<int32_t> >();
+    if(words.size() != counts.size())
+        throw std::invalid_argument(
+            "dimensions mismatch - words.size() != counts.size()");
+    if(__min(words) < 0 || __max(words) >= voc_size)
+        throw std::invalid_argument(
+            "invalid values in words");
+    if(__min(counts) <= 0)
+        throw std::invalid_argument(
+            "invalid values in counts");
+    if(__min(topic_assignment) < 0 || __max(topic_assignment) >= topic_num)
+        throw std::invalid_argument("invalid values in topics");
+    if((size_t)__sum(counts) != topic_assignment.size())
+        throw std::invalid_argument(
+            "dimension mismatch - sum(counts) != topic_assignment.size()");
+
+    // Collapse the document into its (word, topic) counts first
+    std::vector<int64_t> keys(topic_assignment.size());
+    int32_t word_index = 0;
+    for(size_t i = 0; i < words.size(); i++){
+        for(int32_t j = 0; j < counts[i]; j++){
+            keys[word_index] = static_cast<int64_t>(words[i]) * (topic_num + 1)
+                + topic_assignment[word_index];
+            word_index++;
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    int64_t num_new = 0;
+    for(size_t i = 0; i < keys.size(); i++)
+        if (i == 0 || keys[i] != keys[i - 1])
+            num_new++;
+
+    MutableArrayHandle<int64_t> state(NULL);
+    if(args[0].isNull()) {
+        int64_t capacity = std::max(static_cast<int64_t>(64), 2 * num_new);
+        state = madlib_construct_array(
+            NULL, static_cast<int>(TOPIC_COUNT_STATE_HEADER + 2 * capacity),
+            INT8TI.oid, INT8TI.len, INT8TI.byval, INT8TI.align);
+        state[0] = voc_size;
+        state[1] = topic_num;
+    } else {
+        state = args[0].getAs<MutableArrayHandle<int64_t> >();
+    }
+    state = __topic_count_reserve(state, num_new);
+
+    topic_count *entries = __topic_count_entries(state);
+    int64_t n = state[2];
+    for(size_t i = 0; i < keys.size(); i++){
+        if (i > 0 && keys[i] == keys[i - 1]) {
+            entries[n - 1].count++;
+        } else {
+            entries[n].key = keys[i];
+            entries[n].count = 1;
+            n++;
+        }
+    }
+    state[2] = n;
+    return state;
+}
+
+/**
+ * @brief This function is the prefunc for the aggregator computing the
+ * topic counts in the sparse format.
+ * @param args[0]   The state variable, local topic counts
+ * @param args[1]   The state variable, local topic counts
+ * @return          The merged state
+ **/
+AnyType lda_count_topic_sparse_prefunc::run(AnyType & args)
+{
+    MutableArrayHandle<int64_t> state1 = args[0].getAs<MutableArrayHandle<int64_t> >();
+    ArrayHandle<int64_t> state2 = args[1].getAs<ArrayHandle<int64_t> >();
+
+    if(state1[0] != state2[0] || state1[1] != state2[1])
+        throw std::invalid_argument("invalid dimension");
+
+    int64_t num_new = state2[2];
+    state1 = __topic_count_reserve(state1, num_new);
+    memcpy(__topic_count_entries(state1) + state1[2],
+           state2.ptr() + TOPIC_COUNT_STATE_HEADER,
+           num_new * sizeof(topic_count));
+    state1[2] += num_new;
+
+    return state1;
+}
+
+/**
+ * @brief This function is the finalfunc for the aggregator computing the
+ * topic counts in the sparse format. It applies the same count ceiling as
+ * lda_count_topic_sfunc.
+ * @param args[0]   The state variable, global topic counts
+ * @return          The model in the sparse format
+ **/
+AnyType lda_count_topic_sparse_ffunc::run(AnyType & args)
+{
+    ArrayHandle<int64_t> state = args[0].getAs<ArrayHandle<int64_t> >();
+    int32_t voc_size = static_cast<int32_t>(state[0]);
+    int32_t topic_num = static_cast<int32_t>(state[1]);
+
+    // the state must not be modified by the final function
+    const topic_count *state_entries = reinterpret_cast<const topic_count *>(
+        state.ptr() + TOPIC_COUNT_STATE_HEADER);
+    std::vector<topic_count> entries(state_entries, state_entries + state[2]);
+    int64_t n = entries.empty() ? 0
+        : __topic_count_compact(&entries[0], state[3], state[2]);
+
+    // counts stop at 2e9 + 1, and the word is flagged if it went beyond
+    const int64_t ceiling = static_cast<int64_t>(2e9) + 1;
+    std::vector<int64_t> row_sizes(voc_size, 0);
+    std::vector<bool> flagged(voc_size, false);
+    for (int64_t i = 0; i < n; i++) {
+        int32_t wordid = static_cast<int32_t>(entries[i].key / (topic_num + 1));
+        row_sizes[wordid]++;
+        if (entries[i].count > ceiling && !flagged[wordid]) {
+            flagged[wordid] = true;
+            row_sizes[wordid]++;
+        }
+    }
+    int64_t nnz = std::accumulate(row_sizes.begin(), row_sizes.end(),
+                                  static_cast<int64_t>(0));
+
+    MutableArrayHandle<int64_t> model(
+        madlib_construct_array(
+            NULL, static_cast<int>(__sparse_model_size(voc_size, topic_num, nnz)),
+            INT8TI.oid, INT8TI.len, INT8TI.byval, INT8TI.align));
+    model[0] = SPARSE_MODEL_TAG;
+    model[1] = voc_size;
+    model[2] = topic_num;
+    model[3] = nnz;
+    int64_t *topic_counts = model.ptr() + SPARSE_MODEL_HEADER;
+    int64_t *offsets = topic_counts + topic_num;
+    int32_t *topics = reinterpret_cast<int32_t *>(offsets + voc_size + 1);
+    int32_t *word_topic_counts = topics + nnz;
+
+    for (int32_t w = 0; w < voc_size; w++)
+        offsets[w + 1] = offsets[w] + row_sizes[w];
+    int64_t pos = 0;
+    for (int64_t i = 0; i < n; i++) {
+        int32_t wordid = static_cast<int32_t>(entries[i].key / (topic_num + 1));
+        int32_t topic = static_cast<int32_t>(entries[i].key % (topic_num + 1));
+        int64_t count = std::min(entries[i].count, ceiling);
+        topics[pos] = topic;
+        word_topic_counts[pos] = static_cast<int32_t>(count);
+        topic_counts[topic] += count;
+        pos++;
+        if (flagged[wordid] && pos == offsets[wordid + 1] - 1) {
+            topics[pos] = topic_num;
+            word_topic_counts[pos] = 1;
+            pos++;
+        }
+    }
+
+    return model;
+}
+
 /**
  * @brief This function transposes a matrix represented by a 2-D array
  * @param args[0]   The input matrix
@@ -474,6 +1294,8 @@ typedef struct __sr_ctx{
     int32_t maxcall;
     int32_t dim;
     int32_t curcall;
+    bool is_sparse;
+    sparse_model sm;
 } sr_ctx;
 
 void * lda_unnest_transpose::SRF_init(AnyType &args)
@@ -485,6 +1307,10 @@ void * lda_unnest_transpose::SRF_init(AnyType &args)
     ctx->maxcall = args[2].getAs<int32_t>();
     ctx->dim = args[1].getAs<int32_t>();
     ctx->curcall = 0;
+    ctx->is_sparse = __is_sparse_model(
+        inarray64.ptr(), inarray64.size(), ctx->dim, ctx->maxcall);
+    if (ctx->is_sparse)
+        __sparse_model_bind(&ctx->sm, inarray64.ptr(), inarray64.size());
 
     return ctx;
 }
@@ -504,8 +1330,14 @@ AnyType lda_unnest_transpose::SRF_next(void *user_fctx, bool *is_last_call)
         madlib_construct_array(
             NULL, ctx->dim, INT4TI.oid, INT4TI.len, INT4TI.byval,
             INT4TI.align));
-    for (int i = 0; i < ctx->dim; i ++) {
-        outarray[i] = ctx->inarray[(ctx->maxcall + 1) * i + ctx->curcall];
+    if (ctx->is_sparse) {
+        for (int i = 0; i < ctx->dim; i ++) {
+            outarray[i] = __sparse_model_count(&ctx->sm, i, ctx->curcall);
+        }
+    } else {
+        for (int i = 0; i < ctx->dim; i ++) {
+            outarray[i] = ctx->inarray[(ctx->maxcall + 1) * i + ctx->curcall];
+        }
     }
 
     ctx->curcall++;
@@ -524,6 +1356,10 @@ void * lda_unnest::SRF_init(AnyType &args)
     ctx->maxcall = args[1].getAs<int32_t>();
     ctx->dim = args[2].getAs<int32_t>();
     ctx->curcall = 0;
+    ctx->is_sparse = __is_sparse_model(
+        inarray64.ptr(), inarray64.size(), ctx->maxcall, ctx->dim);
+    if (ctx->is_sparse)
+        __sparse_model_bind(&ctx->sm, inarray64.ptr(), inarray64.size());
 
     return ctx;
 }
@@ -543,8 +1379,17 @@ AnyType lda_unnest::SRF_next(void *user_fctx, bool *is_last_call)
         madlib_construct_array(
             NULL, ctx->dim, INT4TI.oid, INT4TI.len, INT4TI.byval,
             INT4TI.align));
-    for (int i = 0; i < ctx->dim; i ++) {
-        outarray[i] = ctx->inarray[ctx->curcall * (ctx->dim + 1) + i];
+    if (ctx->is_sparse) {
+        const sparse_model *sm = &ctx->sm;
+        for (int64_t i = sm->offsets[ctx->curcall];
+                i < sm->offsets[ctx->curcall + 1]; i ++) {
+            if (sm->topics[i] < ctx->dim)
+                outarray[sm->topics[i]] = sm->counts[i];
+        }
+    } else {
+        for (int i = 0; i < ctx->dim; i ++) {
+            outarray[i] = ctx->inarray[ctx->curcall * (ctx->dim + 1) + i];
+        }
     }
 
     ctx->curcall++;
@@ -561,7 +1406,7 @@ AnyType lda_unnest::SRF_next(void *user_fctx, bool *is_last_call)
  * @param args[2]   The counts of each unique words
  * @param args[3]   The topic counts in the document
  * @param args[4]   The model (word topic counts and corpus topic
- *                  counts)
+ *                  counts), in the dense or the sparse format
  * @param args[5]   The Dirichlet parameter for per-document topic
  *                  multinomial, i.e. alpha
  * @param args[6]   The Dirichlet parameter for per-topic word
@@ -611,38 +1456,52 @@ AnyType lda_perplexity_sfunc::run(AnyType & args){
     if (args[0].isNull()) {
         ArrayHandle<int64_t> model64 = args[4].getAs<ArrayHandle<int64_t> >();
 
-        if (model64.size() != model64_size) {
-            std::stringstream ss;
-            ss << "invalid dimension: model64.size() = " << model64.size();
-            throw std::invalid_argument(ss.str());
-        }
-        if(__min(model64) < 0) {
-            throw std::invalid_argument("invalid topic counts in model");
-        }
+        if (__is_sparse_model(model64.ptr(), model64.size(), voc_size,
+                              topic_num)) {
+            // the state is the sparse model followed by the perplexity;
+            // binding it validates the layout
+            sparse_model sm;
+            __sparse_model_bind(&sm, model64.ptr(), model64.size());
+            state = madlib_construct_array(NULL,
+                                           static_cast<int>(model64.size())
+                                               + sizeof(double) / sizeof(int64_t),
+                                           INT8TI.oid,
+                                           INT8TI.len,
+                                           INT8TI.byval,
+                                           INT8TI.align);
+            memcpy(state.ptr(), model64.ptr(), model64.size() * sizeof(int64_t));
+        } else {
+            if (model64.size() != model64_size) {
+                std::stringstream ss;
+                ss << "invalid dimension: model64.size() = " << model64.size();
+                throw std::invalid_argument(ss.str());
+            }
+            if(__min(model64) < 0) {
+                throw std::invalid_argument("invalid topic counts in model");
+            }
 
-        state =  madlib_construct_array(NULL,
-                                        static_cast<int>(model64.size())
-                                            + topic_num
-                                            + sizeof(double) / sizeof(int64_t),
-                                        INT8TI.oid,
-                                        INT8TI.len,
-                                        INT8TI.byval,
-                                        INT8TI.align);
-
-        memcpy(state.ptr(), model64.ptr(), model64.size() * sizeof(int64_t));
-        int32_t *_model = reinterpret_cast<int32_t *>(state.ptr());
-        int64_t *_total_topic_counts = reinterpret_cast<int64_t *>(state.ptr() + model64.size());
-        for (int i = 0; i < voc_size; i ++) {
-            for (int j = 0; j < topic_num; j ++) {
-                _total_topic_counts[j] += _model[i * (topic_num + 1) + j];
+            state =  madlib_construct_array(NULL,
+                                            static_cast<int>(model64.size())
+                                                + topic_num
+                                                + sizeof(double) / sizeof(int64_t),
+                                            INT8TI.oid,
+                                            INT8TI.len,
+                                            INT8TI.byval,
+                                            INT8TI.align);
+
+            memcpy(state.ptr(), model64.ptr(), model64.size() * sizeof(int64_t));
+            int32_t *_model = reinterpret_cast<int32_t *>(state.ptr());
+            int64_t *_total_topic_counts = reinterpret_cast<int64_t *>(state.ptr() + model64.size());
+            for (int i = 0; i < voc_size; i ++) {
+                for (int j = 0; j < topic_num; j ++) {
+                    _total_topic_counts[j] += _model[i * (topic_num + 1) + j];
+                }
             }
         }
     } else {
         state = args[0].getAs<MutableArrayHandle<int64_t> >();
     }
 
-    int32_t *model = reinterpret_cast<int32_t *>(state.ptr());
-    int64_t *total_topic_counts = reinterpret_cast<int64_t *>(state.ptr() + model64_size);
     double *perp = reinterpret_cast<double *>(state.ptr() + state.size() - 1);
 
     int32_t n_d = 0;
@@ -650,6 +1509,41 @@ AnyType lda_perplexity_sfunc::run(AnyType & args){
         n_d += counts[i];
     }
 
+    if (__is_sparse_model(state.ptr(), state.size() - 1, voc_size, topic_num)) {
+        sparse_model sm;
+        __sparse_model_bind(&sm, state.ptr(), state.size() - 1);
+
+        // The beta part of sum_p is the same for all words of the document,
+        // and the n_wz part only involves the non-zero topics of the word
+        double smoothing_p = 0.0;
+        for(int32_t z = 0; z < topic_num; z++){
+            smoothing_p += beta * (doc_topic_counts[z] + alpha)
+                / (static_cast<double>(sm.topic_counts[z]) + voc_size * beta);
+        }
+
+        for(size_t i = 0; i < words.size(); i++){
+            int32_t w = words[i];
+            int32_t n_dw = counts[i];
+
+            double sum_p = smoothing_p;
+            for(int64_t j = sm.offsets[w]; j < sm.offsets[w + 1]; j++){
+                int32_t z = sm.topics[j];
+                if (z >= topic_num)
+                    continue;
+                sum_p += static_cast<double>(sm.counts[j])
+                    * (doc_topic_counts[z] + alpha)
+                    / (static_cast<double>(sm.topic_counts[z]) + voc_size * beta);
+            }
+            sum_p /= (n_d + topic_num * alpha);
+
+            *perp += n_dw * log(sum_p);
+        }
+        return state;
+    }
+
+    int32_t *model = reinterpret_cast<int32_t *>(state.ptr());
+    int64_t *total_topic_counts = reinterpret_cast<int64_t *>(state.ptr() + model64_size);
+
     for(size_t i = 0; i < words.size(); i++){
         int32_t w = words[i];
         int32_t n_dw = counts[i];
@@ -706,11 +1600,23 @@ lda_check_count_ceiling::run(AnyType &args) {
 
     int example_words_hit_ceiling[10];
     int count = 0;
-    const int32_t *model = reinterpret_cast<const int32_t *>(model64.ptr());
-    for (int wordid = 0; wordid < voc_size; wordid ++) {
-        int flag = model[wordid * (topic_num + 1) + topic_num];
-        if (flag != 0) {
-            example_words_hit_ceiling[count ++] = wordid;
+    if (__is_sparse_model(model64.ptr(), model64.size(), voc_size, topic_num)) {
+        // the flag is the last entry of its word
+        sparse_model sm;
+        __sparse_model_bind(&sm, model64.ptr(), model64.size());
+        for (int wordid = 0; wordid < voc_size && count < 10; wordid ++) {
+            int64_t end = sm.offsets[wordid + 1];
+            if (end > sm.offsets[wordid] && sm.topics[end - 1] == topic_num) {
+                example_words_hit_ceiling[count ++] = wordid;
+            }
+        }
+    } else {
+        const int32_t *model = reinterpret_cast<const int32_t *>(model64.ptr());
+        for (int wordid = 0; wordid < voc_size && count < 10; wordid ++) {
+            int flag = model[wordid * (topic_num + 1) + topic_num];
+            if (flag != 0) {
+                example_words_hit_ceiling[count ++] = wordid;
+            }
         }
     }
 
@@ -721,6 +1627,13 @@ lda_check_count_ceiling::run(AnyType &args) {
     return ret;
 }
 
+AnyType
+lda_is_sparse_model::run(AnyType &args) {
+    ArrayHandle<int64_t> model64 = args[0].getAs<ArrayHandle<int64_t> >();
+    return __is_sparse_model(model64.ptr(), model64.size(),
+                             args[1].getAs<int32_t>(), args[2].getAs<int32_t>());
+}
+
 AnyType l1_norm_with_smoothing::run(AnyType & args){
     MutableArrayHandle<double> arr = args[0].getAs<MutableArrayHandle<double> >();
     double smooth = args[1].getAs<double>();
@@ -739,12 +1652,41 @@ AnyType l1_norm_with_smoothing::run(AnyType & args){
     return arr;
 }
 
+/**
+ * @brief Copy the topic counts of words [begin, end) of a dense (sm is NULL)
+ * or sparse model into a zero-initialized voc_size x topic_num matrix
+ **/
+static void __copy_word_topic_counts(
+    const int32_t *model, const sparse_model *sm, int32_t topic_num,
+    int32_t begin, int32_t end, int32_t *out)
+{
+    for(int32_t i = begin; i < end; i++){
+        int32_t *row = out + (i - begin) * topic_num;
+        if (sm) {
+            for(int64_t k = sm->offsets[i]; k < sm->offsets[i + 1]; k++){
+                if (sm->topics[k] < topic_num)
+                    row[sm->topics[k]] = sm->counts[k];
+            }
+        } else {
+            for(int32_t j = 0; j < topic_num; j++){
+                row[j] = model[i * (topic_num+1) + j];
+            }
+        }
+    }
+}
+
 AnyType lda_parse_model::run(AnyType & args){
     ArrayHandle<int64_t> state = args[0].getAs<ArrayHandle<int64_t> >();
     int32_t voc_size = args[1].getAs<int32_t>();
     int32_t topic_num = args[2].getAs<int32_t>();
 
     const int32_t *model = reinterpret_cast<const int32_t *>(state.ptr());
+    sparse_model sparse;
+    const sparse_model *sm = NULL;
+    if (__is_sparse_model(state.ptr(), state.size(), voc_size, topic_num)) {
+        __sparse_model_bind(&sparse, state.ptr(), state.size());
+        sm = &sparse;
+    }
 
     int dims[2] = {voc_size/2, topic_num};
     int lbs[2] = {1, 1};
@@ -752,12 +1694,8 @@ AnyType lda_parse_model::run(AnyType & args){
         madlib_construct_md_array(
             NULL, NULL, 2, dims, lbs, INT4TI.oid, INT4TI.len, INT4TI.byval,
             INT4TI.align));
-
-    for(int32_t i = 0; i < voc_size/2; i++){
-        for(int32_t j = 0; j < topic_num; j++){
-               model_part1[i * topic_num + j] = model[i * (topic_num+1) + j];
-        }
-    }
+    __copy_word_topic_counts(model, sm, topic_num, 0, voc_size/2,
+                             model_part1.ptr());
 
     int dims2[2] = {voc_size - voc_size/2, topic_num};
 
@@ -765,21 +1703,20 @@ AnyType lda_parse_model::run(AnyType & args){
         madlib_construct_md_array(
             NULL, NULL, 2, dims2, lbs, INT4TI.oid, INT4TI.len, INT4TI.byval,
             INT4TI.align));
-
-    for(int32_t i = voc_size/2; i < voc_size; i++){
-        for(int32_t j = 0; j < topic_num; j++){
-               model_part2[(i-voc_size/2) * topic_num + j] = model[i * (topic_num+1) + j];
-        }
-    }
-
-    //int dims3[1] = {topic_num};
-    //int lbs3[1] = {1};
+    __copy_word_topic_counts(model, sm, topic_num, voc_size/2, voc_size,
+                             model_part2.ptr());
 
     MutableNativeColumnVector total_topic_counts(allocateArray<double>(topic_num));
 
-    for (int i = 0; i < voc_size; i ++) {
+    if (sm) {
         for (int j = 0; j < topic_num; j ++) {
-            total_topic_counts[j] += static_cast<double>(model[i * (topic_num + 1) + j]);
+            total_topic_counts[j] = static_cast<double>(sm->topic_counts[j]);
+        }
+    } else {
+        for (int i = 0; i < voc_size; i ++) {
+            for (int j = 0; j < topic_num; j ++) {
+                total_topic_counts[j] += static_cast<double>(model[i * (topic_num + 1) + j]);
+            }
         }
     }
 
@@ -0,0 +1,132 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file RandomizedSvd.hpp
+ *
+ * @brief Transition state of the randomized SVD range finder
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_MODULES_LINALG_RANDOMIZED_SVD_HPP
+#define MADLIB_MODULES_LINALG_RANDOMIZED_SVD_HPP
+
+#include <dbconnector/dbconnector.hpp>
+
+#include <cmath>
+
+namespace madlib {
+
+namespace modules {
+
+namespace linalg {
+
+// Use Eigen
+using namespace dbal;
+using namespace dbal::eigen_integration;
+
+/**
+ * @brief One pass of the randomized range finder over the rows of A
+ *
+ * For an n x l matrix of test vectors Omega, every row a_i of A contributes
+ * the row y_i = a_i^T Omega of Y = A Omega. The state keeps the triangular
+ * factor R of the QR decomposition Y = QR, and C = Y^T A (l x n). Neither Y
+ * nor Q is ever stored: Q^T A = R^{-T} C is recovered in the final function.
+ *
+ * R is updated by Givens rotations, one row of Y at a time, and two states
+ * are merged by rotating the rows of one R factor into the other. This is
+ * the tall-skinny QR (TSQR) reduction, with the partial factors computed
+ * on the segments.
+ */
+template <class Container>
+class RandomizedSvdState
+  : public DynamicStruct<RandomizedSvdState<Container>, Container> {
+public:
+    typedef DynamicStruct<RandomizedSvdState, Container> Base;
+    MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
+
+    RandomizedSvdState(Init_type& inInitialization): Base(inInitialization) {
+        this->initialize();
+    }
+
+    void bind(ByteStream_type& inStream) {
+        inStream >> num_rows >> dimension >> num_vectors;
+
+        uint32_t n = 0u;
+        uint32_t l = 0u;
+        if (!num_vectors.isNull()) {
+            n = dimension;
+            l = num_vectors;
+        }
+        inStream >> r.rebind(l, l) >> c.rebind(l, n);
+    }
+
+    /**
+     * @brief Add the row a of A, with y = Omega^T a
+     *
+     * y is used as scratch space and overwritten.
+     */
+    template <class RowY, class RowA>
+    void update(RowY& ioY, const RowA& inA) {
+        c.noalias() += ioY * inA.transpose();
+        rotateIntoR(ioY);
+        num_rows++;
+    }
+
+    template <class OtherContainer>
+    RandomizedSvdState& operator<<(
+        const RandomizedSvdState<OtherContainer>& inOther) {
+
+        if (static_cast<uint32_t>(inOther.dimension) != dimension
+                || static_cast<uint32_t>(inOther.num_vectors) != num_vectors) {
+            throw std::runtime_error("SVD error: Inconsistent dimensions "
+                "in randomized SVD.");
+        }
+        c += inOther.c;
+        ColumnVector y(static_cast<Index>(num_vectors));
+        for (uint32_t i = 0; i < num_vectors; i++) {
+            y = inOther.r.row(i).transpose();
+            rotateIntoR(y);
+        }
+        num_rows += inOther.num_rows;
+        return *this;
+    }
+
+    bool empty() const { return this->num_rows == 0; }
+
+    uint64_type num_rows;
+    uint32_type dimension;
+    uint32_type num_vectors;
+    Matrix_type r;
+    Matrix_type c;
+
+private:
+    /**
+     * @brief Replace R by the triangular factor of [R; y^T]
+     */
+    template <class RowY>
+    void rotateIntoR(RowY& ioY) {
+        Index l = static_cast<Index>(num_vectors);
+        for (Index j = 0; j < l; j++) {
+            if (ioY(j) == 0.) { continue; }
+
+            double h = std::sqrt(r(j, j) * r(j, j) + ioY(j) * ioY(j));
+            double cs = r(j, j) / h;
+            double sn = ioY(j) / h;
+            r(j, j) = h;
+            ioY(j) = 0.;
+            for (Index t = j + 1; t < l; t++) {
+                double a = r(j, t);
+                double b = ioY(t);
+                r(j, t) = cs * a + sn * b;
+                ioY(t) = cs * b - sn * a;
+            }
+        }
+    }
+};
+
+} // namespace linalg
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif // defined(MADLIB_MODULES_LINALG_RANDOMIZED_SVD_HPP)
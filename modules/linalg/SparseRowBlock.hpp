@@ -0,0 +1,267 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file SparseRowBlock.hpp
+ *
+ * @brief Packed block of consecutive rows of a sparse matrix, in CSR format
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_MODULES_LINALG_SPARSE_ROW_BLOCK_HPP
+#define MADLIB_MODULES_LINALG_SPARSE_ROW_BLOCK_HPP
+
+#include <dbconnector/dbconnector.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace madlib {
+
+namespace modules {
+
+namespace linalg {
+
+// Use Eigen
+using namespace dbal;
+using namespace dbal::eigen_integration;
+
+/**
+ * @brief Transition state of the row-block packing aggregate
+ *
+ * Collects (row, column, value) records, with 0-based row and column
+ * indices. The record buffer is the last member, so growing it with resize()
+ * keeps the records collected so far in place.
+ */
+template <class Container>
+class SparseRowBlockBuildState
+  : public DynamicStruct<SparseRowBlockBuildState<Container>, Container> {
+public:
+    typedef DynamicStruct<SparseRowBlockBuildState, Container> Base;
+    MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
+
+    SparseRowBlockBuildState(Init_type& inInitialization): Base(inInitialization) {
+        this->initialize();
+    }
+
+    void bind(ByteStream_type& inStream) {
+        inStream >> num_entries >> capacity;
+
+        uint32_t cap = 0u;
+        if (!capacity.isNull()) {
+            cap = capacity;
+        }
+        inStream >> records.rebind(static_cast<Index>(cap) * kRecordWidth);
+    }
+
+    void append(double inRow, double inCol, double inValue) {
+        if (num_entries == capacity) {
+            capacity = std::max(2u * static_cast<uint32_t>(capacity), 64u);
+            this->resize();
+        }
+        double* record = records.data()
+            + static_cast<Index>(num_entries) * kRecordWidth;
+        record[0] = inRow;
+        record[1] = inCol;
+        record[2] = inValue;
+        num_entries++;
+    }
+
+    template <class OtherContainer>
+    SparseRowBlockBuildState& operator<<(
+        const SparseRowBlockBuildState<OtherContainer>& inOther) {
+
+        const double* record = inOther.records.data();
+        for (uint32_t i = 0; i < inOther.num_entries; i++) {
+            append(record[0], record[1], record[2]);
+            record += kRecordWidth;
+        }
+        return *this;
+    }
+
+    bool empty() const { return this->num_entries == 0; }
+
+    static const uint32_t kRecordWidth = 3;
+
+    uint32_type num_entries;
+    uint32_type capacity;
+    ColumnVector_type records;
+};
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Serialized block of the rows [row_offset, row_offset + num_rows) of
+ *     a sparse matrix
+ *
+ * The non-zeros of row row_offset + r are values[k] at the columns
+ * col_idx[k], for row_ptr[r] <= k < row_ptr[r + 1]. Within a row, columns are
+ * ascending and unique. All indices are 0-based, and num_cols is one past the
+ * largest column index, i.e., the smallest number of columns of a matrix that
+ * contains the block.
+ */
+template <class Container>
+class SparseRowBlock
+  : public DynamicStruct<SparseRowBlock<Container>, Container> {
+public:
+    typedef DynamicStruct<SparseRowBlock, Container> Base;
+    MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
+
+    SparseRowBlock(Init_type& inInitialization): Base(inInitialization) {
+        this->initialize();
+    }
+
+    void bind(ByteStream_type& inStream) {
+        inStream >> row_offset >> num_rows >> num_cols >> nnz;
+
+        uint32_t n_rows = 0u;
+        uint32_t n = 0u;
+        if (!nnz.isNull()) {
+            n_rows = num_rows;
+            n = nnz;
+        }
+        inStream
+            >> row_ptr.rebind(n_rows + 1)
+            >> col_idx.rebind(n)
+            >> values.rebind(n);
+    }
+
+    template <class OtherContainer>
+    void build(const SparseRowBlockBuildState<OtherContainer>& inState);
+
+    /**
+     * @brief Add the product of this block and a vector to a vector
+     *
+     * Without transposition, y[row_offset + r] += A(r, :) * x for every row
+     * r of the block. With transposition, y += A^T * x[row_offset + r]
+     * summed over r, i.e., x is indexed by rows and y by columns. The caller
+     * is responsible for the sizes of x and y, see rowEnd() and num_cols.
+     */
+    void multiply(const double* inX, double* outY, bool inTranspose) const {
+        const int32_t* ptr = row_ptr.data();
+        const int32_t* col = col_idx.data();
+        const double* val = values.data();
+        uint32_t offset = row_offset;
+
+        if (inTranspose) {
+            for (uint32_t r = 0; r < num_rows; r++) {
+                double x = inX[offset + r];
+                if (x == 0.) { continue; }
+                for (int32_t k = ptr[r]; k < ptr[r + 1]; k++)
+                    outY[col[k]] += val[k] * x;
+            }
+        } else {
+            for (uint32_t r = 0; r < num_rows; r++) {
+                double sum = 0.;
+                for (int32_t k = ptr[r]; k < ptr[r + 1]; k++)
+                    sum += val[k] * inX[col[k]];
+                outY[offset + r] += sum;
+            }
+        }
+    }
+
+    uint64_t rowEnd() const {
+        return static_cast<uint64_t>(row_offset) + num_rows;
+    }
+
+    uint32_type row_offset;
+    uint32_type num_rows;
+    uint32_type num_cols;
+    uint32_type nnz;
+    IntegerVector_type row_ptr;
+    IntegerVector_type col_idx;
+    ColumnVector_type values;
+
+private:
+    /**
+     * @brief Order of records by (row, column)
+     */
+    struct RecordLess {
+        RecordLess(const double* inRecords): mRecords(inRecords) { }
+
+        bool operator()(uint32_t inA, uint32_t inB) const {
+            const double* a = mRecords + static_cast<size_t>(inA) * kWidth;
+            const double* b = mRecords + static_cast<size_t>(inB) * kWidth;
+            return a[0] < b[0] || (a[0] == b[0] && a[1] < b[1]);
+        }
+
+        static const uint32_t kWidth =
+            SparseRowBlockBuildState<Container>::kRecordWidth;
+        const double* mRecords;
+    };
+};
+
+/**
+ * @brief Pack all records of the build state, summing up duplicate entries
+ */
+template <class Container>
+template <class OtherContainer>
+inline
+void
+SparseRowBlock<Container>::build(
+    const SparseRowBlockBuildState<OtherContainer>& inState) {
+
+    const uint32_t width = SparseRowBlockBuildState<OtherContainer>::kRecordWidth;
+    const double* records = inState.records.data();
+    uint32_t n_entries = inState.num_entries;
+
+    std::vector<uint32_t> perm(n_entries);
+    for (uint32_t i = 0; i < n_entries; i++)
+        perm[i] = i;
+    std::sort(perm.begin(), perm.end(), RecordLess(records));
+
+    // First pass: size of the block
+    uint32_t n = 0;
+    double max_col = 0.;
+    const double* last = NULL;
+    for (uint32_t i = 0; i < n_entries; i++) {
+        const double* record = records + static_cast<size_t>(perm[i]) * width;
+        if (last == NULL || last[0] != record[0] || last[1] != record[1]) {
+            max_col = std::max(max_col, record[1]);
+            n++;
+        }
+        last = record;
+    }
+
+    uint32_t first_row = 0u;
+    if (n > 0) {
+        first_row = static_cast<uint32_t>(records[
+            static_cast<size_t>(perm[0]) * width]);
+        row_offset = first_row;
+        num_rows = static_cast<uint32_t>(last[0]) - first_row + 1;
+        num_cols = static_cast<uint32_t>(max_col) + 1;
+    } else {
+        row_offset = 0u;
+        num_rows = 0u;
+        num_cols = 0u;
+    }
+    nnz = n;
+    this->resize();
+
+    // Second pass: fill in the entries, row_ptr(r) is set once row r starts
+    int32_t k = -1;
+    uint32_t r = 0;
+    row_ptr(0) = 0;
+    last = NULL;
+    for (uint32_t i = 0; i < n_entries; i++) {
+        const double* record = records + static_cast<size_t>(perm[i]) * width;
+        if (last != NULL && last[0] == record[0] && last[1] == record[1]) {
+            values(k) += record[2];
+            continue;
+        }
+        k++;
+        uint32_t row = static_cast<uint32_t>(record[0]) - first_row;
+        while (r < row)
+            row_ptr(++r) = k;
+        col_idx(k) = static_cast<int32_t>(record[1]);
+        values(k) = record[2];
+        last = record;
+    }
+    while (r < num_rows)
+        row_ptr(++r) = static_cast<int32_t>(n);
+}
+
+} // namespace linalg
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif // defined(MADLIB_MODULES_LINALG_SPARSE_ROW_BLOCK_HPP)
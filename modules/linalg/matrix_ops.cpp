@@ -45,6 +45,16 @@ typedef struct __type_info{
 static type_info FLOAT8TI(FLOAT8OID);
 static type_info INT4TI(INT4OID);
 
+// PostgreSQL stores 2-d arrays in row-major order
+typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    RowMajorMatrix;
+typedef Eigen::Map<const RowMajorMatrix> ConstRowMajorMap;
+typedef Eigen::Map<RowMajorMatrix> RowMajorMap;
+
+// Tile size of the blocked transpose: two 32x32 tiles of doubles fit into
+// L1 cache
+static const int kTransposeBlockSize = 32;
+
 AnyType matrix_densify_sfunc::run(AnyType & args)
 {
     int32_t col_dim = args[1].getAs<int32_t>();
@@ -176,15 +186,15 @@ AnyType matrix_mem_mult::run(AnyType & args)
             NULL, NULL, 2, dims, lbs, FLOAT8TI.oid,
             FLOAT8TI.len, FLOAT8TI.byval, FLOAT8TI.align);
 
-    for (int i = 0; i < row_a; i++){
-        for(int j = 0; j < col_a; j++){
-            for(int k = 0; k < dims[1]; k++){
-                *(r.ptr() + i * dims[1] + k) += trans_b ?
-                    *(a.ptr() + i * col_a + j) * *(b.ptr() + k * col_b + j) :
-                        *(a.ptr() + i * col_a + j) * *(b.ptr() + j * col_b + k);
-            }
-        }
-    }
+    // Eigen's GEMM is cache-blocked and handles the transposed operand
+    // natively, so B is never materialized in transposed form
+    ConstRowMajorMap ma(a.ptr(), row_a, col_a);
+    ConstRowMajorMap mb(b.ptr(), row_b, col_b);
+    RowMajorMap mr(r.ptr(), dims[0], dims[1]);
+    if (trans_b)
+        mr.noalias() = ma * mb.transpose();
+    else
+        mr.noalias() = ma * mb;
     return r;
 }
 
@@ -206,9 +216,15 @@ AnyType matrix_mem_trans::run(AnyType & args)
             NULL, NULL, 2, dims, lbs, FLOAT8TI.oid,
             FLOAT8TI.len, FLOAT8TI.byval, FLOAT8TI.align);
 
-    for (int i = 0; i < row_m; i++){
-        for(int j = 0; j < col_m; j++){
-                *(r.ptr() + j * row_m + i) = *(m.ptr() + i * col_m + j);
+    // Transpose tile by tile, so that both the rows read and the rows
+    // written stay in cache
+    ConstRowMajorMap mm(m.ptr(), row_m, col_m);
+    RowMajorMap mr(r.ptr(), col_m, row_m);
+    for (int i = 0; i < row_m; i += kTransposeBlockSize) {
+        int rows = std::min(kTransposeBlockSize, row_m - i);
+        for (int j = 0; j < col_m; j += kTransposeBlockSize) {
+            int cols = std::min(kTransposeBlockSize, col_m - j);
+            mr.block(j, i, cols, rows) = mm.block(i, j, rows, cols).transpose();
         }
     }
     return r;
@@ -14,6 +14,7 @@
 #include <algorithm>
 #include <sstream>
 #include <cmath>
+#include <cstring>
 #include <boost/algorithm/string.hpp>
 
 #include "metric.hpp"
@@ -275,15 +276,6 @@ distJaccard(const ArrayHandle<text*>& inX, const ArrayHandle<text*>& inY) {
     return 1.0 - static_cast<double>(n_intersection) / static_cast<double>(n_union);
 }
 
-/**
- * @brief Compute the k columns of a matrix that are closest to a vector
- *
- * For performance, we cheat here: For the following four distance functions, we
- * take a special shortcut.
- * FIXME: FunctionHandle should be tuned so that this shortcut no longer
- * impacts performance by more than, say, ~10%.
- */
-
 std::string dist_fn_name(string s)
 {
     std::istringstream ss(s);
@@ -293,38 +285,348 @@ std::string dist_fn_name(string s)
     return fname;
 }
 
+namespace {
+
+/**
+ * @brief Matrix of candidate columns together with the per-column quantities
+ *     that the distance kernels precompute
+ *
+ * The object and all its arrays live in the fn_extra cache of the calling
+ * function, so that a matrix that is passed unchanged to many calls (e.g.,
+ * the centroids in a k-means iteration) is only prepared once.
+ */
+struct ColumnSet {
+    Index rows;
+    Index cols;
+    // copy of the matrix, used to detect changes
+    CacheBuffer<double> columns;
+    // columns scaled to unit length (zero stays zero)
+    CacheBuffer<double> normalized;
+    CacheBuffer<double> squaredNorms;
+    double maxSquaredNorm;
+    // scratch: distance to every column
+    CacheBuffer<double> distances;
+    bool hasSquaredNorms;
+    bool hasNormalized;
+
+    Eigen::Map<const Matrix> matrix() const {
+        return Eigen::Map<const Matrix>(columns.ptr, rows, cols);
+    }
+};
+
+/**
+ * @brief A kernel computes the distances between a vector and all columns of
+ *     a ColumnSet in a single pass
+ */
+typedef void (*DistanceKernel)(const ColumnSet&, const MappedColumnVector&,
+    double*);
+
+struct DistanceKernelInfo {
+    const char *name;
+    DistanceKernel kernel;
+    // exact pairwise function, used to recompute the reported distances of
+    // the closest columns when the kernel uses an algebraic expansion
+    double (*exact)(const MappedColumnVector&, const MappedColumnVector&);
+    bool needsSquaredNorms;
+    bool needsNormalized;
+    // the kernel computes squared L2 distances by the expansion
+    // ||x||^2 + ||c||^2 - 2 x.c, so that near-ties must be re-ranked exactly
+    bool expandsNorm2;
+};
+
+void
+squaredDistNorm2Kernel(const ColumnSet& inSet, const MappedColumnVector& inX,
+    double* outDist) {
+
+    // ||x - c||^2 = ||x||^2 + ||c||^2 - 2 x.c
+    Eigen::Map<ColumnVector> dist(outDist, inSet.cols);
+    dist.noalias() = -2. * (trans(inSet.matrix()) * inX);
+    dist.array() += Eigen::Map<const ColumnVector>(inSet.squaredNorms.ptr,
+        inSet.cols).array() + inX.squaredNorm();
+    dist = dist.cwiseMax(0.);
+}
+
+void
+distNorm1Kernel(const ColumnSet& inSet, const MappedColumnVector& inX,
+    double* outDist) {
+
+    Eigen::Map<ColumnVector> dist(outDist, inSet.cols);
+    dist = trans((inSet.matrix().colwise() - inX).cwiseAbs().colwise().sum());
+}
+
+void
+distAngleKernel(const ColumnSet& inSet, const MappedColumnVector& inX,
+    double* outDist) {
+
+    // Angle is not defined if one of the norms is zero. Just return \pi.
+    const double pi = std::acos(-1);
+    Eigen::Map<ColumnVector> dist(outDist, inSet.cols);
+    double xnorm = inX.norm();
+    if (xnorm < std::numeric_limits<double>::denorm_min()) {
+        dist.setConstant(pi);
+        return;
+    }
+    dist.noalias() = trans(Eigen::Map<const Matrix>(inSet.normalized.ptr,
+        inSet.rows, inSet.cols)) * inX;
+    for (Index i = 0; i < inSet.cols; ++i) {
+        if (inSet.squaredNorms.ptr[i] <= 0.)
+            outDist[i] = pi;
+        else
+            outDist[i] = std::acos(std::max(-1., std::min(1.,
+                outDist[i] / xnorm)));
+    }
+}
+
+void
+distTanimotoKernel(const ColumnSet& inSet, const MappedColumnVector& inX,
+    double* outDist) {
+
+    Eigen::Map<ColumnVector> dist(outDist, inSet.cols);
+    dist.noalias() = trans(inSet.matrix()) * inX;
+    double xSquaredNorm = inX.squaredNorm();
+    for (Index i = 0; i < inSet.cols; ++i) {
+        double tanimoto = xSquaredNorm + inSet.squaredNorms.ptr[i];
+        outDist[i] = (tanimoto - 2 * outDist[i]) / (tanimoto - outDist[i]);
+    }
+}
+
+/**
+ * @brief Registry of the distance functions that are evaluated natively,
+ *     sorted in the order of expected use
+ */
+const DistanceKernelInfo kDistanceKernels[] = {
+    { "squared_dist_norm2", squaredDistNorm2Kernel, squaredDistNorm2,
+        true, false, true },
+    // ranks by the squared distance, which has the same order
+    { "dist_norm2", squaredDistNorm2Kernel, distNorm2, true, false, true },
+    { "dist_norm1", distNorm1Kernel, NULL, false, false, false },
+    { "dist_angle", distAngleKernel, distAngle, true, true, false },
+    { "dist_tanimoto", distTanimotoKernel, distTanimoto, true, false, false }
+};
+
+const DistanceKernelInfo*
+findDistanceKernel(const std::string& inName) {
+    for (size_t i = 0; i < sizeof(kDistanceKernels) / sizeof(kDistanceKernels[0]);
+            ++i) {
+        if (inName.compare(kDistanceKernels[i].name) == 0)
+            return &kDistanceKernels[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Function context of the closest_column(s) functions
+ *
+ * The distance function is resolved only once: by OID for the functions that
+ * take a function handle, by name for the *_fixed variants.
+ */
+struct ClosestColumnContext {
+    Oid funcOid;
+    char metricName[NAMEDATALEN];
+    const DistanceKernelInfo *kernel;   // NULL means calling the UDF
+    ColumnSet set;
+};
+
+ClosestColumnContext*
+getClosestColumnContext(AnyType& args) {
+    ClosestColumnContext *ctx
+        = static_cast<ClosestColumnContext*>(args.getUserFuncContext());
+    if (ctx == NULL) {
+        ctx = static_cast<ClosestColumnContext*>(
+            MemoryContextAllocZero(args.getCacheMemoryContext(),
+                sizeof(ClosestColumnContext)));
+        ctx->funcOid = InvalidOid;
+        args.setUserFuncContext(ctx);
+    }
+    return ctx;
+}
+
+void
+resolveKernelByOid(ClosestColumnContext* ctx, FunctionHandle& inDist,
+    const string& inName) {
+
+    if (ctx->funcOid != inDist.funcID()) {
+        ctx->kernel = findDistanceKernel(dist_fn_name(inName));
+        ctx->funcOid = inDist.funcID();
+    }
+}
+
+void
+resolveKernelByName(ClosestColumnContext* ctx, const string& inName) {
+    if (ctx->kernel != NULL
+            && std::strncmp(ctx->metricName, inName.c_str(), NAMEDATALEN) == 0)
+        return;
+
+    string name = inName;
+    boost::trim(name);
+    const DistanceKernelInfo *kernel = findDistanceKernel(dist_fn_name(name));
+    if (kernel == NULL || (name.find('.') != string::npos
+            && name.compare(0, name.find('.'), "madlib") != 0)) {
+        string errorMessage = string("Invalid distance metric provided: ") + \
+                                name + \
+                                string(". Currently only madlib provided distance functions are supported.");
+        throw std::invalid_argument(errorMessage);
+    }
+    ctx->kernel = kernel;
+    std::strncpy(ctx->metricName, inName.c_str(), NAMEDATALEN - 1);
+    ctx->metricName[NAMEDATALEN - 1] = '\0';
+}
+
+/**
+ * @brief Make the cached ColumnSet reflect inMatrix, recomputing the
+ *     precomputed quantities only if the matrix has changed
+ */
+void
+prepareColumnSet(AnyType& args, ColumnSet& ioSet, const MappedMatrix& inMatrix,
+    const DistanceKernelInfo& inKernel) {
+
+    Index size = inMatrix.rows() * inMatrix.cols();
+    bool changed = ioSet.columns.ptr == NULL
+        || ioSet.rows != inMatrix.rows() || ioSet.cols != inMatrix.cols()
+        || std::memcmp(ioSet.columns.ptr, inMatrix.data(),
+               size * sizeof(double)) != 0;
+
+    if (changed) {
+        MemoryContext memCtx = args.getCacheMemoryContext();
+        // invalidate until the new matrix is complete
+        ioSet.rows = 0;
+        std::memcpy(ioSet.columns.reserve(memCtx, size), inMatrix.data(),
+            size * sizeof(double));
+        ioSet.normalized.reserve(memCtx, size);
+        ioSet.squaredNorms.reserve(memCtx, inMatrix.cols());
+        ioSet.distances.reserve(memCtx, inMatrix.cols());
+        ioSet.rows = inMatrix.rows();
+        ioSet.cols = inMatrix.cols();
+        ioSet.hasSquaredNorms = false;
+        ioSet.hasNormalized = false;
+    }
+
+    if (inKernel.needsSquaredNorms && !ioSet.hasSquaredNorms) {
+        Eigen::Map<ColumnVector> squaredNorms(ioSet.squaredNorms.ptr,
+            ioSet.cols);
+        squaredNorms = trans(ioSet.matrix().colwise().squaredNorm());
+        ioSet.maxSquaredNorm = ioSet.cols > 0 ? squaredNorms.maxCoeff() : 0.;
+        ioSet.hasSquaredNorms = true;
+    }
+    if (inKernel.needsNormalized && !ioSet.hasNormalized) {
+        Eigen::Map<Matrix> normalized(ioSet.normalized.ptr, ioSet.rows,
+            ioSet.cols);
+        for (Index i = 0; i < ioSet.cols; ++i) {
+            double norm = std::sqrt(ioSet.squaredNorms.ptr[i]);
+            if (norm < std::numeric_limits<double>::denorm_min())
+                normalized.col(i).setZero();
+            else
+                normalized.col(i) = ioSet.matrix().col(i) / norm;
+        }
+        ioSet.hasNormalized = true;
+    }
+}
+
+} // anonymous namespace
+
+/**
+ * @brief Compute the k columns of a matrix that are closest to a vector,
+ *     using the distance kernel registered for the distance function
+ *
+ * All distances are computed in one pass over the (cached) matrix. The
+ * distances reported for the closest columns are recomputed with the exact
+ * pairwise function if the kernel uses an algebraic expansion.
+ *
+ * The L2 expansion \f$ \|x\|^2 + \|c\|^2 - 2 x \cdot c \f$ loses up to
+ * about \f$ (d + 2) \epsilon (\|x\|^2 + \|c\|^2) \f$ to cancellation,
+ * which can exceed the gap between two nearby columns. All columns within
+ * twice that bound of the k-th smallest expanded distance are therefore
+ * candidates, and the closest columns are selected among them by their
+ * exact distance.
+ */
+template <class RandomAccessIterator>
+void
+closestColumnsAndDistancesKernel(
+    AnyType& args,
+    ClosestColumnContext* ctx,
+    const MappedMatrix& inMatrix,
+    const MappedColumnVector& inVector,
+    RandomAccessIterator ioFirst,
+    RandomAccessIterator ioLast) {
+
+    if (inMatrix.rows() != inVector.size()) {
+        throw std::runtime_error("Found input arrays of "
+                "different lengths unexpectedly.");
+    }
+
+    const DistanceKernelInfo& kernel = *ctx->kernel;
+    ColumnSet& set = ctx->set;
+    prepareColumnSet(args, set, inMatrix, kernel);
+    kernel.kernel(set, inVector, set.distances.ptr);
+
+    ReverseLexicographicComparator<
+        typename std::iterator_traits<RandomAccessIterator>::value_type>
+            comparator;
+
+    std::fill(ioFirst, ioLast,
+        std::make_tuple(0, std::numeric_limits<double>::infinity()));
+    for (Index i = 0; i < set.cols; ++i) {
+        double currentDist = set.distances.ptr[i];
+
+        // outIndicesAndDistances is a heap, so the first element is maximal
+        if (currentDist < std::get<1>(*ioFirst)) {
+            std::pop_heap(ioFirst, ioLast, comparator);
+            *(ioLast - 1) = std::make_tuple(i, currentDist);
+            std::push_heap(ioFirst, ioLast, comparator);
+        }
+    }
+
+    if (kernel.expandsNorm2 && !std::isinf(std::get<1>(*ioFirst))) {
+        double cutoff = std::get<1>(*ioFirst)
+            + 2. * static_cast<double>(set.rows + 2)
+                * std::numeric_limits<double>::epsilon()
+                * (inVector.squaredNorm() + set.maxSquaredNorm);
+
+        std::fill(ioFirst, ioLast,
+            std::make_tuple(0, std::numeric_limits<double>::infinity()));
+        for (Index i = 0; i < set.cols; ++i) {
+            if (set.distances.ptr[i] > cutoff)
+                continue;
+            double currentDist = kernel.exact(
+                MappedColumnVector(inMatrix.col(i)), inVector);
+            if (currentDist < std::get<1>(*ioFirst)) {
+                std::pop_heap(ioFirst, ioLast, comparator);
+                *(ioLast - 1) = std::make_tuple(i, currentDist);
+                std::push_heap(ioFirst, ioLast, comparator);
+            }
+        }
+    } else if (kernel.exact != NULL) {
+        for (RandomAccessIterator it = ioFirst; it != ioLast; ++it) {
+            if (std::isinf(std::get<1>(*it)))
+                continue;
+            std::get<1>(*it) = kernel.exact(
+                MappedColumnVector(inMatrix.col(std::get<0>(*it))), inVector);
+        }
+        std::make_heap(ioFirst, ioLast, comparator);
+    }
+    std::sort_heap(ioFirst, ioLast, comparator);
+}
 
 template <class RandomAccessIterator>
 inline
 void
 closestColumnsAndDistancesShortcut(
+    AnyType& args,
     const MappedMatrix& inMatrix,
     const MappedColumnVector& inVector,
     FunctionHandle &inDist,
-    std::string fname,
+    const string& inDistName,
     RandomAccessIterator ioFirst,
     RandomAccessIterator ioLast) {
 
-    // Sorted in the order of expected use
-    if (fname.compare("squared_dist_norm2") == 0)
-        closestColumnsAndDistances(inMatrix, inVector, squaredDistNorm2,
-            ioFirst, ioLast);
-    else if (fname.compare("dist_norm2") == 0)
-        closestColumnsAndDistances(inMatrix, inVector, distNorm2,
-            ioFirst, ioLast);
-    else if (fname.compare("dist_norm1") == 0)
-        closestColumnsAndDistances(inMatrix, inVector, distNorm1,
-            ioFirst, ioLast);
-    else if (fname.compare("dist_angle") == 0)
-        closestColumnsAndDistances(inMatrix, inVector, distAngle,
+    ClosestColumnContext *ctx = getClosestColumnContext(args);
+    resolveKernelByOid(ctx, inDist, inDistName);
+    if (ctx->kernel != NULL)
+        closestColumnsAndDistancesKernel(args, ctx, inMatrix, inVector,
             ioFirst, ioLast);
-    else if (fname.compare("dist_tanimoto") == 0) {
-        closestColumnsAndDistances(inMatrix, inVector, distTanimoto,
-            ioFirst, ioLast);
-    } else {
+    else
         closestColumnsAndDistancesUDF(inMatrix, inVector, ioFirst,
                 ioLast, inDist.funcID());
-    }
 }
 
 
@@ -338,16 +640,15 @@ closestColumnsAndDistancesShortcut(
  */
 AnyType
 closest_column::run(AnyType& args) {
-    //if (true) throw std::runtime_error("Begin cc run\n");
     try{
         MappedMatrix M = args[0].getAs<MappedMatrix>();
         MappedColumnVector x = args[1].getAs<MappedColumnVector>();
         FunctionHandle dist = args[2].getAs<FunctionHandle>()
             .unsetFunctionCallOptions(FunctionHandle::GarbageCollectionAfterCall);
         string dist_fname = args[3].getAs<char *>();
-        std::string fname = dist_fn_name(dist_fname);
         std::tuple<Index, double> result;
-        closestColumnsAndDistancesShortcut(M, x, dist, fname, &result, &result + 1);
+        closestColumnsAndDistancesShortcut(args, M, x, dist, dist_fname,
+            &result, &result + 1);
 
         AnyType tuple;
         return tuple
@@ -363,38 +664,16 @@ closest_column_fixed::run(AnyType& args) {
     MappedMatrix M = args[0].getAs<MappedMatrix>();
     MappedColumnVector x = args[1].getAs<MappedColumnVector>();
     string distance_metric_str = args[2].getAs<char *>();
-    boost::trim(distance_metric_str);
-
-    double (*distance_metric)(const MappedColumnVector&, const MappedColumnVector&);
 
-    // we hard-code comparision and selection of the distance function since
+    // we hard-code the selection of the distance function since
     // we are currently limited in not being able to access the catalog
     // in a function executed at the segments. This is a limitation in HAWQ
     // and will probably be eliminated in a future HAWQ release
-    if ((distance_metric_str.compare("squared_dist_norm2") == 0) ||
-            (distance_metric_str.compare("madlib.squared_dist_norm2") == 0)){
-        distance_metric = squaredDistNorm2;
-    } else if ((distance_metric_str.compare("dist_norm2") == 0) ||
-            (distance_metric_str.compare("madlib.dist_norm2") == 0)){
-        distance_metric = distNorm2;
-    } else if ((distance_metric_str.compare("dist_norm1") == 0) ||
-            (distance_metric_str.compare("madlib.dist_norm1") == 0)){
-        distance_metric = distNorm1;
-    } else if ((distance_metric_str.compare("dist_angle") == 0) ||
-            (distance_metric_str.compare("madlib.dist_angle") == 0)){
-        distance_metric = distAngle;
-    } else if ((distance_metric_str.compare("dist_tanimoto") == 0) ||
-            (distance_metric_str.compare("madlib.dist_tanimoto") == 0)){
-        distance_metric = distTanimoto;
-    } else{
-        string errorMessage = string("Invalid distance metric provided: ") + \
-                                distance_metric_str + \
-                                string(". Currently only madlib provided distance functions are supported.");
-        throw std::invalid_argument(errorMessage);
-    }
+    ClosestColumnContext *ctx = getClosestColumnContext(args);
+    resolveKernelByName(ctx, distance_metric_str);
 
     std::tuple<Index, double> result;
-    closestColumnsAndDistances(M, x, distance_metric, &result, &result + 1);
+    closestColumnsAndDistancesKernel(args, ctx, M, x, &result, &result + 1);
 
     AnyType tuple;
     return tuple
@@ -419,11 +698,9 @@ closest_columns::run(AnyType& args) {
         .unsetFunctionCallOptions(FunctionHandle::GarbageCollectionAfterCall);
     string dist_fname = args[4].getAs<char *>();
 
-    std::string fname = dist_fn_name(dist_fname);
-
     std::vector<std::tuple<Index, double> > result(num);
-    closestColumnsAndDistancesShortcut(M, x, dist, fname, result.begin(),
-        result.end());
+    closestColumnsAndDistancesShortcut(args, M, x, dist, dist_fname,
+        result.begin(), result.end());
 
     MutableArrayHandle<int32_t> indices = allocateArray<int32_t,
         dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(num);
@@ -442,38 +719,17 @@ closest_columns_fixed::run(AnyType& args) {
     MappedColumnVector x = args[1].getAs<MappedColumnVector>();
     uint32_t num = args[2].getAs<uint32_t>();
     string distance_metric_str = args[3].getAs<char *>();
-    boost::trim(distance_metric_str);
 
     if (0 == num) {
         throw std::invalid_argument("the parameter number should be a positive integer");
     }
 
-    double (*distance_metric)(const MappedColumnVector&, const MappedColumnVector&);
-
-    if ((distance_metric_str.compare("squared_dist_norm2") == 0) ||
-            (distance_metric_str.compare("madlib.squared_dist_norm2") == 0)){
-        distance_metric = squaredDistNorm2;
-    } else if ((distance_metric_str.compare("dist_norm2") == 0) ||
-            (distance_metric_str.compare("madlib.dist_norm2") == 0)){
-        distance_metric = distNorm2;
-    } else if ((distance_metric_str.compare("dist_norm1") == 0) ||
-            (distance_metric_str.compare("madlib.dist_norm1") == 0)){
-        distance_metric = distNorm1;
-    } else if ((distance_metric_str.compare("dist_angle") == 0) ||
-            (distance_metric_str.compare("madlib.dist_angle") == 0)){
-        distance_metric = distAngle;
-    } else if ((distance_metric_str.compare("dist_tanimoto") == 0) ||
-            (distance_metric_str.compare("madlib.dist_tanimoto") == 0)){
-        distance_metric = distTanimoto;
-    } else{
-        string errorMessage = string("Invalid distance metric provided: ") + \
-                                distance_metric_str + \
-                                string(". Currently only madlib provided distance functions are supported.");
-        throw std::invalid_argument(errorMessage);
-    }
+    ClosestColumnContext *ctx = getClosestColumnContext(args);
+    resolveKernelByName(ctx, distance_metric_str);
 
     std::vector<std::tuple<Index, double> > result(num);
-    closestColumnsAndDistances(M, x, distance_metric, result.begin(), result.end());
+    closestColumnsAndDistancesKernel(args, ctx, M, x, result.begin(),
+        result.end());
 
     MutableArrayHandle<int32_t> indices = allocateArray<int32_t,
         dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(num);
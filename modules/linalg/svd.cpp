@@ -14,8 +14,15 @@
 #include <algorithm>
 #include <functional>
 #include <numeric>
+#include <cstring>
+#include <limits>
+#include "RandomizedSvd.hpp"
+#include "SparseRowBlock.hpp"
 #include "svd.hpp"
 #include <Eigen/SVD>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/variate_generator.hpp>
+#include <boost/random/linear_congruential.hpp>
 
 namespace madlib {
 
@@ -509,6 +516,307 @@ AnyType svd_sparse_lanczos_sfunc::run(AnyType & args){
     return state;
 }
 
+/**
+ * @brief This function is the transition function of the aggregator packing
+ * a sparse matrix into row blocks
+ * @param args[0]   State variable
+ * @param args[1]   Row ID
+ * @param args[2]   Column ID
+ * @param args[3]   Value
+ **/
+AnyType svd_sparse_block_transition::run(AnyType & args){
+    SparseRowBlockBuildState<MutableRootContainer> state =
+        args[0].getAs<MutableByteString>();
+    if (args[1].isNull() || args[2].isNull() || args[3].isNull()) {
+        return args[0];
+    }
+
+    int32_t row_id = args[1].getAs<int32_t>();
+    int32_t col_id = args[2].getAs<int32_t>();
+    if (row_id <= 0 || col_id <= 0) {
+        throw std::invalid_argument(
+            "invalid parameter - row and column IDs should be positive");
+    }
+
+    state.append(row_id - 1, col_id - 1, args[3].getAs<double>());
+    return state.storage();
+}
+
+AnyType svd_sparse_block_merge::run(AnyType & args){
+    SparseRowBlockBuildState<MutableRootContainer> stateLeft =
+        args[0].getAs<MutableByteString>();
+    SparseRowBlockBuildState<RootContainer> stateRight =
+        args[1].getAs<ByteString>();
+
+    if (stateLeft.empty()) {
+        return stateRight.storage();
+    } else if (stateRight.empty()) {
+        return stateLeft.storage();
+    }
+
+    stateLeft << stateRight;
+    return stateLeft.storage();
+}
+
+AnyType svd_sparse_block_final::run(AnyType & args){
+    SparseRowBlockBuildState<RootContainer> state = args[0].getAs<ByteString>();
+    if (state.empty()) { return Null(); }
+
+    SparseRowBlock<MutableRootContainer> block =
+        defaultAllocator().allocateByteString<
+            dbal::FunctionContext, dbal::DoZero, dbal::ThrowBadAlloc>(0);
+    block.build(state);
+    return block.storage();
+}
+
+/**
+ * @brief This function is the transition function of the aggregator computing
+ * the Lanczos vectors over a packed sparse matrix, one row block per call
+ * @param args[0]   State variable (i.e. A * q_j OR A_trans * p_(j-1))
+ * @param args[1]   Row block
+ * @param args[2]   Previous P/Q vector
+ * @param args[3]   Row/Column dimension
+ * @param args[4]   Whether to multiply with the transposed block
+ **/
+AnyType svd_sparse_block_lanczos_sfunc::run(AnyType & args){
+    if (args[1].isNull()) {
+        return args[0];
+    }
+
+    SparseRowBlock<RootContainer> block = args[1].getAs<ByteString>();
+    MappedColumnVector vec = args[2].getAs<MappedColumnVector>();
+    int32_t dim = args[3].getAs<int32_t>();
+    bool trans = args[4].getAs<bool>();
+
+    uint64_t vec_size = static_cast<uint64_t>(vec.size());
+    uint64_t out_size = static_cast<uint64_t>(dim);
+    if (trans ? (block.rowEnd() > vec_size || block.num_cols > out_size)
+              : (block.num_cols > vec_size || block.rowEnd() > out_size)) {
+        throw std::invalid_argument(
+            "dimension mismatch: row block does not fit the vector dimensions");
+    }
+
+    MutableArrayHandle<double> state(NULL);
+    if(args[0].isNull()){
+        state = MutableArrayHandle<double>(
+            madlib_construct_array(
+                NULL, dim, FLOAT8TI.oid, FLOAT8TI.len, FLOAT8TI.byval,
+                FLOAT8TI.align));
+    }else{
+        state = args[0].getAs<MutableArrayHandle<double> >();
+    }
+
+    block.multiply(vec.data(), state.ptr(), trans);
+    return state;
+}
+
+// -- Randomized SVD ----------------------------------------------------------
+/*
+    @brief Test vectors Omega of the randomized range finder
+
+    Omega is the same n x l matrix for all rows of a pass, so it is kept in the
+    fn_extra cache of the transition function. Gaussian test vectors are
+    generated once from the seed and never stored in a table. Test vectors
+    passed in as argument (the right singular vectors of the previous pass,
+    in power iterations) are copied once (see RawDatumKey). The l doubles
+    behind Omega are scratch space for y = Omega^T a.
+*/
+struct RandomizedSvdCache {
+    RawDatumKey key;        // not set for Gaussian test vectors
+    int32_t seed;
+    uint32_t rows;
+    uint32_t cols;
+    CacheBuffer<double> omega;
+};
+
+static double*
+getRandomizedSvdTestVectors(AnyType &args, uint32_t inRows, uint32_t inCols,
+    int32_t inSeed) {
+
+    const void *raw = args[2].isNull() ? NULL : args[2].getRawPointer();
+
+    RandomizedSvdCache *cache =
+        static_cast<RandomizedSvdCache*>(args.getUserFuncContext());
+    if (cache == NULL) {
+        cache = static_cast<RandomizedSvdCache*>(MemoryContextAllocZero(
+            args.getCacheMemoryContext(), sizeof(RandomizedSvdCache)));
+        args.setUserFuncContext(cache);
+    }
+    if (cache->omega.ptr != NULL && cache->rows == inRows
+            && cache->cols == inCols
+            && (raw == NULL ? cache->key.size == 0 && cache->seed == inSeed
+                            : cache->key.matches(raw))) {
+        return cache->omega.ptr;
+    }
+
+    // Invalidate until the new matrix is complete
+    cache->rows = 0;
+    cache->key.invalidate();
+    size_t size = static_cast<size_t>(inRows) * inCols;
+    double *omega = cache->omega.reserve(args.getCacheMemoryContext(),
+                                         size + inCols);
+
+    if (raw == NULL) {
+        boost::minstd_rand generator(inSeed);
+        boost::normal_distribution<> nd_dist(0., 1.);
+        boost::variate_generator<boost::minstd_rand&,
+            boost::normal_distribution<> > nd(generator, nd_dist);
+        for (size_t i = 0; i < size; i++)
+            omega[i] = nd();
+    } else {
+        MappedColumnVector vectors = args[2].getAs<MappedColumnVector>();
+        if (static_cast<size_t>(vectors.size()) != size) {
+            throw std::invalid_argument(
+                "dimension mismatch: test vectors do not match the row size");
+        }
+        std::memcpy(omega, vectors.data(), size * sizeof(double));
+        cache->key.assign(args.getCacheMemoryContext(), raw);
+    }
+    cache->seed = inSeed;
+    cache->rows = inRows;
+    cache->cols = inCols;
+    return omega;
+}
+
+/**
+ * @brief This function is the transition function of the aggregator running
+ * one pass of the randomized range finder
+ * @param args[0]   State variable
+ * @param args[1]   Matrix row array
+ * @param args[2]   Test vectors (n x l, column-major), NULL for Gaussian ones
+ * @param args[3]   Number of Gaussian test vectors (l)
+ * @param args[4]   Seed of the Gaussian test vectors
+ **/
+AnyType svd_randomized_transition::run(AnyType & args){
+    RandomizedSvdState<MutableRootContainer> state =
+        args[0].getAs<MutableByteString>();
+    if (args[1].isNull()) {
+        return args[0];
+    }
+
+    MappedColumnVector row_vec = args[1].getAs<MappedColumnVector>();
+    uint32_t n = static_cast<uint32_t>(row_vec.size());
+    int32_t seed = args[4].getAs<int32_t>();
+
+    if (state.empty()) {
+        int32_t l = 0;
+        if (args[2].isNull()) {
+            l = args[3].getAs<int32_t>();
+        } else {
+            ArrayHandle<double> omega = args[2].getAs<ArrayHandle<double> >();
+            if (n > 0 && omega.size() % n == 0)
+                l = static_cast<int32_t>(omega.size() / n);
+        }
+        if (n == 0 || l <= 0) {
+            throw std::invalid_argument(
+                "invalid parameter - the number of test vectors should be "
+                "positive");
+        }
+        state.dimension = n;
+        state.num_vectors = static_cast<uint32_t>(l);
+        state.resize();
+    } else if (n != state.dimension) {
+        throw std::invalid_argument(
+            "dimension mismatch: all rows should have the same size");
+    }
+
+    uint32_t l = state.num_vectors;
+    double *omega_data = getRandomizedSvdTestVectors(args, n, l, seed);
+    Eigen::Map<const Matrix> omega(omega_data, n, l);
+    Eigen::Map<ColumnVector> y(omega_data + static_cast<size_t>(n) * l, l);
+
+    y.noalias() = omega.transpose() * row_vec;
+    state.update(y, row_vec);
+    return state.storage();
+}
+
+AnyType svd_randomized_merge::run(AnyType & args){
+    RandomizedSvdState<MutableRootContainer> stateLeft =
+        args[0].getAs<MutableByteString>();
+    RandomizedSvdState<RootContainer> stateRight = args[1].getAs<ByteString>();
+
+    if (stateLeft.empty()) {
+        return stateRight.storage();
+    } else if (stateRight.empty()) {
+        return stateLeft.storage();
+    }
+
+    stateLeft << stateRight;
+    return stateLeft.storage();
+}
+
+/**
+ * @brief This function is the final function of the aggregator running one
+ * pass of the randomized range finder
+ *
+ * Q = Y R^{-1} has orthonormal columns, so B = Q^T A = R^{-T} C carries the
+ * projection of A onto the range of Y. With R = U S V^T, B is U S^{-1} V^T C,
+ * where U can be dropped as it does not change the singular values or the
+ * right singular vectors. Directions of the range that are numerically zero
+ * are dropped as well. The small matrix B is then decomposed in memory.
+ *
+ * @param args[0]   State variable
+ * @return The singular values of B, and its right singular vectors as an
+ *     n x rank matrix in column-major order
+ **/
+AnyType svd_randomized_final::run(AnyType & args){
+    RandomizedSvdState<RootContainer> state = args[0].getAs<ByteString>();
+    if (state.empty()) { return Null(); }
+
+    Eigen::JacobiSVD<Matrix> svd_r(Matrix(state.r), Eigen::ComputeFullV);
+    const ColumnVector &s_r = svd_r.singularValues();
+    double tol = s_r(0) * static_cast<double>(s_r.size())
+        * std::numeric_limits<double>::epsilon();
+    Index rank = 0;
+    while (rank < s_r.size() && s_r(rank) > tol)
+        rank++;
+    if (rank == 0) { return Null(); }
+
+    Matrix b = s_r.head(rank).cwiseInverse().asDiagonal()
+        * svd_r.matrixV().leftCols(rank).transpose() * state.c;
+
+    // B^T = U_b S_b W^T, so the right singular vectors of B are U_b
+    Eigen::JacobiSVD<Matrix> svd_b(b.transpose(), Eigen::ComputeThinU);
+    ColumnVector singular_values = svd_b.singularValues();
+    Matrix right = svd_b.matrixU();
+    ColumnVector right_vectors =
+        Eigen::Map<ColumnVector>(right.data(), right.size());
+
+    AnyType tuple;
+    tuple << singular_values << right_vectors;
+    return tuple;
+}
+
+/**
+ * @brief Left singular vector entries of a matrix row: u = S^{-1} V^T a
+ * @param args[0]   Matrix row array
+ * @param args[1]   Right singular vectors (n x rank, column-major)
+ * @param args[2]   Singular values
+ * @param args[3]   Number of singular vectors (k)
+ **/
+AnyType svd_randomized_left_vec::run(AnyType & args){
+    MappedColumnVector row_vec = args[0].getAs<MappedColumnVector>();
+    MappedColumnVector right_vectors = args[1].getAs<MappedColumnVector>();
+    MappedColumnVector singular_values = args[2].getAs<MappedColumnVector>();
+    int32_t k = args[3].getAs<int32_t>();
+
+    Index n = row_vec.size();
+    if (n == 0 || right_vectors.size() % n != 0) {
+        throw std::invalid_argument(
+            "dimension mismatch: right singular vectors do not match the row size");
+    }
+    Index rank = right_vectors.size() / n;
+    if (k <= 0 || k > rank || k > singular_values.size()) {
+        throw std::invalid_argument(
+            "invalid parameter - k should be in the range of [1, rank]");
+    }
+
+    Eigen::Map<const Matrix> v(right_vectors.data(), n, rank);
+    ColumnVector u = v.leftCols(k).transpose() * row_vec;
+    u.array() /= singular_values.head(k).array();
+    return u;
+}
+
 /*
  *  @brief In-memory multiplication of a vector with a matrix
  *  @param vec  a 1 x r vector
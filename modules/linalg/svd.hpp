@@ -24,7 +24,16 @@ DECLARE_UDF(linalg, svd_decompose_bidiagonal_prefunc)
 
 DECLARE_UDF(linalg, svd_block_lanczos_sfunc)
 DECLARE_UDF(linalg, svd_sparse_lanczos_sfunc)
+DECLARE_UDF(linalg, svd_sparse_block_transition)
+DECLARE_UDF(linalg, svd_sparse_block_merge)
+DECLARE_UDF(linalg, svd_sparse_block_final)
+DECLARE_UDF(linalg, svd_sparse_block_lanczos_sfunc)
 DECLARE_UDF(linalg, svd_decompose_bidiag)
 
+DECLARE_UDF(linalg, svd_randomized_transition)
+DECLARE_UDF(linalg, svd_randomized_merge)
+DECLARE_UDF(linalg, svd_randomized_final)
+DECLARE_UDF(linalg, svd_randomized_left_vec)
+
 DECLARE_UDF(linalg, svd_vec_mult_matrix)
 DECLARE_SR_UDF(linalg, svd_vec_trans_mult_matrix)
@@ -0,0 +1,318 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file CompiledTree.hpp
+ *
+ * @brief Flattened, pointer-free decision tree used for scoring
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_MODULES_RP_COMPILED_TREE_HPP
+#define MADLIB_MODULES_RP_COMPILED_TREE_HPP
+
+#include <cstring>
+#include <cmath>
+#include <deque>
+#include <utility>
+
+#include <dbconnector/dbconnector.hpp>
+
+namespace madlib {
+
+namespace modules {
+
+namespace recursive_partitioning {
+
+// Use Eigen
+using namespace dbal;
+using namespace dbal::eigen_integration;
+
+// ------------------------------------------------------------------------
+// CompiledTree is a read-only, scoring-only representation of a
+// DecisionTree. The complete (2^depth - 1) node layout of DecisionTree is
+// renumbered breadth-first over the existing nodes only, and all attributes
+// needed to route a row are packed into one struct per node. The two
+// children of an internal node are always adjacent (false child =
+// true child + 1), so a traversal touches one node per level.
+//
+// The whole object lives in a single contiguous block so that it can be
+// placed in memory owned by the backend (e.g., the fn_extra cache of a UDF)
+// and reused across calls without any further allocation. Which model a
+// cached compilation belongs to is tracked by a RawDatumKey.
+
+class CompiledTree {
+public:
+    // 32 bytes: two nodes per 64-byte cache line
+    struct Node {
+        double threshold;
+        int32_t feature_index;  // < 0 for leaf nodes
+        int32_t true_child;     // false child is true_child + 1
+        int32_t surr_begin;     // offset into surrogate array
+        uint16_t n_surr;
+        uint8_t is_categorical;
+        uint8_t majority_is_true;
+        int32_t leaf_index;     // offset into leaf arrays (leaf nodes only)
+        int32_t padding;
+    };
+
+    struct Surrogate {
+        double threshold;
+        int32_t feature_index;
+        int32_t status;         // same encoding as DecisionTree::surr_status
+    };
+
+    /**
+     * @brief Number of bytes needed to compile the given tree
+     */
+    template <class DTree>
+    static size_t storageSize(const DTree &dt) {
+        size_t n_nodes = 0, n_leaves = 0, n_surr = 0;
+        countNodes(dt, n_nodes, n_leaves, n_surr);
+        return sizeof(CompiledTree)
+            + n_nodes * sizeof(Node)
+            + n_surr * sizeof(Surrogate)
+            + n_leaves * (predictionWidth(dt) + 1) * sizeof(double);
+    }
+
+    /**
+     * @brief Build a compiled tree in the given buffer, which must be at
+     * least storageSize() bytes and suitably aligned for double.
+     */
+    template <class DTree>
+    static CompiledTree* compile(void *buffer, const DTree &dt);
+
+    template <class CatVector, class ConVector>
+    Index search(const CatVector &cat_features,
+                 const ConVector &con_features) const;
+
+    // Step-wise traversal, used to walk several trees level by level.
+    // Node 0 is the root.
+    bool isLeaf(Index node_index) const {
+        return nodesPtr()[node_index].feature_index < 0;
+    }
+
+    Index leafIndex(Index node_index) const {
+        return nodesPtr()[node_index].leaf_index;
+    }
+
+    template <class CatVector, class ConVector>
+    Index child(Index node_index,
+                const CatVector &cat_features,
+                const ConVector &con_features) const;
+
+    bool isRegression() const { return mIsRegression; }
+
+    Index predictionWidth() const { return mPredictionWidth; }
+
+    const double* prediction(Index leaf_index) const {
+        return predictionsPtr() + leaf_index * mPredictionWidth;
+    }
+
+    double response(Index leaf_index) const {
+        return responsesPtr()[leaf_index];
+    }
+
+private:
+    template <class DTree>
+    static Index predictionWidth(const DTree &dt) {
+        return dt.is_regression ? 1 : static_cast<Index>(dt.n_y_labels);
+    }
+
+    template <class DTree>
+    static void countNodes(const DTree &dt, size_t &n_nodes,
+                           size_t &n_leaves, size_t &n_surr);
+
+    template <class DTree>
+    static uint16_t countSurrogates(const DTree &dt, Index node_index) {
+        uint16_t count = 0;
+        for (Index i = node_index * dt.max_n_surr;
+                i < (node_index + 1) * dt.max_n_surr; i++) {
+            if (dt.surr_indices(i) < 0)
+                break;
+            count++;
+        }
+        return count;
+    }
+
+    char* base() { return reinterpret_cast<char*>(this) + sizeof(CompiledTree); }
+    const char* base() const {
+        return reinterpret_cast<const char*>(this) + sizeof(CompiledTree);
+    }
+    const Node* nodesPtr() const {
+        return reinterpret_cast<const Node*>(base());
+    }
+    const Surrogate* surrogatesPtr() const {
+        return reinterpret_cast<const Surrogate*>(nodesPtr() + mNumNodes);
+    }
+    const double* predictionsPtr() const {
+        return reinterpret_cast<const double*>(surrogatesPtr() + mNumSurrogates);
+    }
+    const double* responsesPtr() const {
+        return predictionsPtr() + mNumLeaves * mPredictionWidth;
+    }
+
+    template <class CatVector, class ConVector>
+    bool surrogateSplit(const Node &node,
+                        const CatVector &cat_features,
+                        const ConVector &con_features) const;
+
+    Index mNumNodes;
+    Index mNumLeaves;
+    Index mNumSurrogates;
+    Index mPredictionWidth;
+    bool mIsRegression;
+};
+
+// ------------------------------------------------------------------------
+
+template <class DTree>
+inline
+void
+CompiledTree::countNodes(const DTree &dt, size_t &n_nodes,
+                         size_t &n_leaves, size_t &n_surr) {
+    std::deque<Index> queue(1, 0);
+    while (!queue.empty()) {
+        Index current = queue.front();
+        queue.pop_front();
+        n_nodes++;
+        if (dt.feature_indices(current) >= 0) {
+            n_surr += countSurrogates(dt, current);
+            queue.push_back(dt.trueChild(current));
+            queue.push_back(dt.falseChild(current));
+        } else {
+            n_leaves++;
+        }
+    }
+}
+// ------------------------------------------------------------------------
+
+template <class DTree>
+inline
+CompiledTree*
+CompiledTree::compile(void *buffer, const DTree &dt) {
+    size_t n_nodes = 0, n_leaves = 0, n_surr = 0;
+    countNodes(dt, n_nodes, n_leaves, n_surr);
+
+    CompiledTree *compiled = static_cast<CompiledTree*>(buffer);
+    compiled->mNumNodes = static_cast<Index>(n_nodes);
+    compiled->mNumLeaves = static_cast<Index>(n_leaves);
+    compiled->mNumSurrogates = static_cast<Index>(n_surr);
+    compiled->mPredictionWidth = predictionWidth(dt);
+    compiled->mIsRegression = dt.is_regression;
+
+    Node *nodes = const_cast<Node*>(compiled->nodesPtr());
+    Surrogate *surrogates = const_cast<Surrogate*>(compiled->surrogatesPtr());
+    double *predictions = const_cast<double*>(compiled->predictionsPtr());
+    double *responses = const_cast<double*>(compiled->responsesPtr());
+
+    // breadth-first renumbering: the children of an internal node are
+    // appended as a pair, so their new indices are consecutive
+    std::deque<std::pair<Index, Index> > queue;   // (original, compiled)
+    queue.push_back(std::make_pair(Index(0), Index(0)));
+    Index next_node = 1, next_leaf = 0, next_surr = 0;
+    while (!queue.empty()) {
+        Index orig = queue.front().first;
+        Node &node = nodes[queue.front().second];
+        queue.pop_front();
+        std::memset(&node, 0, sizeof(Node));
+
+        node.feature_index = dt.feature_indices(orig);
+        if (node.feature_index >= 0) {
+            node.threshold = dt.feature_thresholds(orig);
+            node.is_categorical = dt.is_categorical(orig) != 0;
+            node.majority_is_true = dt.getMajoritySplit(orig);
+            node.true_child = static_cast<int32_t>(next_node);
+            node.surr_begin = static_cast<int32_t>(next_surr);
+            node.n_surr = countSurrogates(dt, orig);
+            for (uint16_t s = 0; s < node.n_surr; s++) {
+                Index surr_index = orig * dt.max_n_surr + s;
+                surrogates[next_surr].threshold = dt.surr_thresholds(surr_index);
+                surrogates[next_surr].feature_index = dt.surr_indices(surr_index);
+                surrogates[next_surr].status = dt.surr_status(surr_index);
+                next_surr++;
+            }
+            queue.push_back(std::make_pair(dt.trueChild(orig), next_node++));
+            queue.push_back(std::make_pair(dt.falseChild(orig), next_node++));
+        } else {
+            node.leaf_index = static_cast<int32_t>(next_leaf);
+            ColumnVector leaf_prediction = dt.statPredict(dt.predictions.row(orig));
+            std::memcpy(predictions + next_leaf * compiled->mPredictionWidth,
+                        leaf_prediction.data(),
+                        compiled->mPredictionWidth * sizeof(double));
+            responses[next_leaf] = dt.predict_response(orig);
+            next_leaf++;
+        }
+    }
+    return compiled;
+}
+// ------------------------------------------------------------------------
+
+template <class CatVector, class ConVector>
+inline
+bool
+CompiledTree::surrogateSplit(const Node &node,
+                             const CatVector &cat_features,
+                             const ConVector &con_features) const {
+    const Surrogate *surr = surrogatesPtr() + node.surr_begin;
+    for (uint16_t s = 0; s < node.n_surr; s++, surr++) {
+        bool split_response;
+        if (std::abs(surr->status) == 1) {
+            if (cat_features(surr->feature_index) < 0)
+                continue;
+            split_response = cat_features(surr->feature_index) <= surr->threshold;
+        } else {
+            if (std::isnan(con_features(surr->feature_index)))
+                continue;
+            split_response = con_features(surr->feature_index) <= surr->threshold;
+        }
+        // negative status is a reverse split (> relation)
+        return (surr->status > 0) ? split_response : !split_response;
+    }
+    return node.majority_is_true;
+}
+// ------------------------------------------------------------------------
+
+template <class CatVector, class ConVector>
+inline
+Index
+CompiledTree::child(Index node_index,
+                    const CatVector &cat_features,
+                    const ConVector &con_features) const {
+    const Node &node = nodesPtr()[node_index];
+    bool is_split_true;
+    if (node.is_categorical) {
+        int value = cat_features(node.feature_index);
+        is_split_true = (value < 0) ?
+            surrogateSplit(node, cat_features, con_features) :
+            (value <= node.threshold);
+    } else {
+        double value = con_features(node.feature_index);
+        is_split_true = std::isnan(value) ?
+            surrogateSplit(node, cat_features, con_features) :
+            (value <= node.threshold);
+    }
+    return node.true_child + (is_split_true ? 0 : 1);
+}
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Route a row to its leaf. Returns the leaf offset to be used with
+ * prediction() and response(). Equivalent to DecisionTree::search().
+ */
+template <class CatVector, class ConVector>
+inline
+Index
+CompiledTree::search(const CatVector &cat_features,
+                     const ConVector &con_features) const {
+    Index current = 0;
+    while (!isLeaf(current))
+        current = child(current, cat_features, con_features);
+    return leafIndex(current);
+}
+
+} // namespace recursive_partitioning
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif // defined(MADLIB_MODULES_RP_COMPILED_TREE_HPP)
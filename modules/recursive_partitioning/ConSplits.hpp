@@ -3,6 +3,13 @@
 
 #include <dbconnector/dbconnector.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
 namespace madlib {
 namespace modules {
 namespace recursive_partitioning {
@@ -12,15 +19,41 @@ using namespace dbal;
 using namespace dbal::eigen_integration;
 // -------------------------------------------------------------------------
 
+/**
+ * @brief Mergeable quantile sketch of all continuous features
+ *
+ * This is a KLL sketch (Karnin, Lang, Liberty: "Optimal Quantile
+ * Approximation in Streams", FOCS 2016) that summarizes all features at once.
+ * Items at level h stand for 2^h rows. Level h holds up to
+ * max(8, k * (2/3)^(H - 1 - h)) items, where H is the number of levels, so
+ * the state has O(k) items per feature regardless of the number of rows. When
+ * the sketch is full, the lowest full level is compacted: its items are
+ * sorted and every other one is promoted to the next level. A fair coin per
+ * compaction decides whether the even or the odd items are kept, so that the
+ * errors of the compactions cancel in expectation, and the normalized rank
+ * error of a quantile is O(sqrt(log(1 / delta)) / k) with probability
+ * 1 - delta. The coin is a pseudo-random generator whose state is part of
+ * the sketch, so the result is reproducible for the same input order.
+ *
+ * The level capacities only change with the number of levels, so they are
+ * kept in the state and recomputed only when a level is added.
+ *
+ * Every row has a value for every feature, so all features share the same
+ * level layout, and item j of a level is column j of the level's block of
+ * the items matrix (one row per feature). Levels are stored from the top
+ * down, so that new rows are appended at the end of the matrix.
+ */
 template<class Container>
-class ConSplitsSample
-  : public DynamicStruct<ConSplitsSample<Container>, Container> {
+class ConSplitsSketch
+  : public DynamicStruct<ConSplitsSketch<Container>, Container> {
 public:
-    typedef DynamicStruct<ConSplitsSample, Container> Base;
+    typedef DynamicStruct<ConSplitsSketch, Container> Base;
     MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
 
+    enum { MAX_LEVELS = 64, MIN_LEVEL_CAPACITY = 8 };
+
     // functions
-    ConSplitsSample(Init_type& inInitialization): Base(inInitialization) {
+    ConSplitsSketch(Init_type& inInitialization): Base(inInitialization) {
         this->initialize();
     }
 
@@ -28,31 +61,228 @@ public:
         inStream >> num_rows
             >> num_splits
             >> num_features
-            >> buff_size;
+            >> num_levels
+            >> k
+            >> num_items
+            >> capacity
+            >> total_capacity
+            >> coin
+            >> level_sizes.rebind(MAX_LEVELS)
+            >> level_capacities.rebind(MAX_LEVELS);
 
         uint16_t n_features = 0u;
-        uint32_t buff_sz = 0;
+        uint32_t cap = 0u;
         if (!num_rows.isNull()) {
             n_features = num_features;
-            buff_sz = buff_size;
+            cap = capacity;
         }
 
-        inStream >> sample.rebind(n_features, buff_sz);
+        inStream >> items.rebind(n_features, cap);
     }
 
-    ConSplitsSample& operator<<(const MappedColumnVector& inVec) {
-        sample.col(num_rows) = inVec;
+    ConSplitsSketch& operator<<(const MappedColumnVector& inVec) {
+        compress();
+        reserve(static_cast<uint32_t>(num_items) + 1);
+        items.col(static_cast<uint32_t>(num_items)) = inVec;
+        level_sizes(0) += 1.;
+        num_items++;
         num_rows++;
         return *this;
     }
 
+    template <class OtherContainer>
+    ConSplitsSketch& operator<<(const ConSplitsSketch<OtherContainer>& inOther) {
+        if (static_cast<uint16_t>(inOther.num_features) != num_features) {
+            throw std::runtime_error("Decision tree error: Inconsistent "
+                "numbers of continuous features.");
+        }
+        reserve(static_cast<uint32_t>(num_items)
+                + static_cast<uint32_t>(inOther.num_items));
+        if (static_cast<uint16_t>(inOther.num_levels) > num_levels) {
+            num_levels = inOther.num_levels;
+            updateCapacities();
+        }
+
+        Index n_features = num_features;
+        for (uint16_t h = 0; h < inOther.num_levels; h++) {
+            Index m = static_cast<Index>(inOther.level_sizes(h));
+            if (m == 0) { continue; }
+
+            // make room at the end of level h, and copy the other level
+            Index pos = levelStart(h) + static_cast<Index>(level_sizes(h));
+            double* data = items.data();
+            std::memmove(data + (pos + m) * n_features,
+                         data + pos * n_features,
+                         (static_cast<uint32_t>(num_items) - pos)
+                            * n_features * sizeof(double));
+            std::memcpy(data + pos * n_features,
+                        inOther.items.data() + inOther.levelStart(h) * n_features,
+                        m * n_features * sizeof(double));
+            level_sizes(h) += static_cast<double>(m);
+            num_items += static_cast<uint32_t>(m);
+        }
+        num_rows += inOther.num_rows;
+        compress();
+        return *this;
+    }
+
+    /**
+     * @brief Recompute the item capacities of all levels
+     *
+     * Must be called whenever k or num_levels changes.
+     */
+    void updateCapacities() {
+        double cap = static_cast<double>(k);
+        uint32_t total = 0;
+        for (uint16_t h = num_levels; h-- > 0; ) {
+            uint32_t level_cap = std::max(
+                static_cast<uint32_t>(MIN_LEVEL_CAPACITY),
+                static_cast<uint32_t>(std::ceil(cap)));
+            level_capacities(h) = static_cast<double>(level_cap);
+            total += level_cap;
+            cap *= 2. / 3.;
+        }
+        total_capacity = total;
+    }
+
+    /**
+     * @brief Index of the first column of a level in the items matrix
+     */
+    Index levelStart(uint16_t inLevel) const {
+        double start = 0.;
+        for (uint16_t h = inLevel + 1; h < num_levels; h++) {
+            start += level_sizes(h);
+        }
+        return static_cast<Index>(start);
+    }
+
+    /**
+     * @brief Compute the quantile of a feature at the given rank
+     *
+     * @param inFeature Index of the feature
+     * @param inRanks Ascending ranks in [1, num_rows]
+     * @param outQuantiles For each rank r, the smallest item such that the
+     *     total weight of items less than or equal to it is at least r
+     */
+    void quantiles(Index inFeature, const ColumnVector& inRanks,
+                   ColumnVector& outQuantiles) const {
+        std::vector<std::pair<double, double> > weighted(
+            static_cast<uint32_t>(num_items));
+        Index pos = 0;
+        for (uint16_t h = num_levels; h-- > 0; ) {
+            double weight = std::ldexp(1., h);
+            for (Index j = 0; j < static_cast<Index>(level_sizes(h)); j++) {
+                weighted[pos] = std::make_pair(items(inFeature, pos), weight);
+                pos++;
+            }
+        }
+        std::sort(weighted.begin(), weighted.end());
+
+        outQuantiles.resize(inRanks.size());
+        double cumulative_weight = 0.;
+        size_t item = 0;
+        for (Index r = 0; r < inRanks.size(); r++) {
+            while (item < weighted.size() - 1 &&
+                   cumulative_weight + weighted[item].second < inRanks(r)) {
+                cumulative_weight += weighted[item].second;
+                item++;
+            }
+            outQuantiles(r) = weighted[item].first;
+        }
+    }
+
     bool empty() const { return this->num_rows == 0; }
 
-    uint32_type num_rows;
+    uint64_type num_rows;
     uint16_type num_splits;
     uint16_type num_features;
-    uint32_type buff_size;
-    Matrix_type sample;
+    uint16_type num_levels;
+    uint32_type k;
+    uint32_type num_items;
+    uint32_type capacity;
+    uint32_type total_capacity; // sum of level_capacities
+    uint64_type coin;           // state of the compaction coin generator
+    ColumnVector_type level_sizes;
+    ColumnVector_type level_capacities;
+    Matrix_type items;
+
+private:
+    void reserve(uint32_t inNumItems) {
+        if (inNumItems > capacity) {
+            capacity = std::max(std::max(2u * static_cast<uint32_t>(capacity),
+                                         inNumItems), 64u);
+            this->resize();
+        }
+    }
+
+    void compress() {
+        while (static_cast<uint32_t>(num_items)
+                >= static_cast<uint32_t>(total_capacity)) {
+            uint16_t h = 0;
+            while (level_sizes(h) < level_capacities(h)) { h++; }
+            if (h + 1 == num_levels) {
+                if (num_levels == MAX_LEVELS) {
+                    throw std::runtime_error("Decision tree error: Too many "
+                        "rows for the quantile sketch.");
+                }
+                num_levels++;
+                updateCapacities();
+            }
+            compact(h);
+        }
+    }
+
+    /**
+     * @brief Flip the compaction coin (SplitMix64 step)
+     */
+    Index flipCoin() {
+        uint64_t z = static_cast<uint64_t>(coin)
+            + 0x9E3779B97F4A7C15ULL;
+        coin = z;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return static_cast<Index>((z ^ (z >> 31)) >> 63);
+    }
+
+    /**
+     * @brief Promote every other item of a level to the next level
+     *
+     * Level h + 1 directly precedes level h, so the promoted items are
+     * written to the beginning of level h, which becomes the end of level
+     * h + 1. If the level has an odd number of items, its largest item stays.
+     */
+    void compact(uint16_t inLevel) {
+        Index n_features = num_features;
+        Index start = levelStart(inLevel);
+        Index m = static_cast<Index>(level_sizes(inLevel));
+        Index num_pairs = m / 2;
+        Index num_left = m % 2;
+        Index offset = flipCoin();
+
+        ColumnVector sorted(m);
+        for (Index i = 0; i < n_features; i++) {
+            sorted = trans(items.row(i).segment(start, m));
+            std::sort(sorted.data(), sorted.data() + m);
+            for (Index j = 0; j < num_pairs; j++) {
+                items(i, start + j) = sorted(2 * j + offset);
+            }
+            if (num_left > 0) {
+                items(i, start + num_pairs) = sorted(m - 1);
+            }
+        }
+
+        // close the gap to the lower levels
+        Index src = start + m;
+        Index dst = start + num_pairs + num_left;
+        double* data = items.data();
+        std::memmove(data + dst * n_features, data + src * n_features,
+                     (static_cast<uint32_t>(num_items) - src)
+                        * n_features * sizeof(double));
+
+        level_sizes(inLevel + 1) += static_cast<double>(num_pairs);
+        level_sizes(inLevel) = static_cast<double>(num_left);
+        num_items -= static_cast<uint32_t>(num_pairs);
+    }
 };
 // ------------------------------------------------------------
 
@@ -86,6 +316,107 @@ public:
     Matrix_type con_splits;
 };
 
+// ------------------------------------------------------------
+
+/**
+ * @brief Index of the bin of a continuous value
+ *
+ * Assuming each row in con_splits is sorted in ascending order, bin j covers
+ * (con_splits(i, j-1), con_splits(i, j)], and the last bin (with index
+ * con_splits.cols()) covers (con_splits(i, cols-1), +inf). Hence,
+ * value <= con_splits(i, j) if and only if the bin index is <= j.
+ */
+inline
+Index
+conBinIndex(const MappedMatrix &con_splits, Index feature_index,
+            double value) {
+    Index low = 0;
+    Index high = con_splits.cols();
+    while (low < high) {
+        Index mid = (low + high) / 2;
+        if (con_splits(feature_index, mid) < value)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+// ------------------------------------------------------------
+
+/**
+ * @brief Continuous features of a row, encoded as bin indices
+ *
+ * The encoding is a byte string of one uint8 per feature if there are at
+ * most 255 bins (i.e., fewer than 255 splits) and one uint16 per feature
+ * otherwise. The largest value of the type stands for NULL (NaN). This is
+ * the output of _dst_encode_con_features(), and the input of the binned
+ * training aggregate, which then needs neither the feature values nor any
+ * comparisons against the splits.
+ */
+class ConBinnedFeatures {
+public:
+    enum { NULL_BIN8 = 0xFF, NULL_BIN16 = 0xFFFF };
+
+    ConBinnedFeatures(const char *inData, size_t inBytes, Index inNumSplits)
+      : mData(reinterpret_cast<const unsigned char*>(inData)),
+        mWidth(width(inNumSplits)),
+        mSize(static_cast<Index>(inBytes / width(inNumSplits))) { }
+
+    /**
+     * @brief Number of bytes per feature for the given number of splits
+     */
+    static size_t width(Index inNumSplits) {
+        return inNumSplits < NULL_BIN8 ? 1 : 2;
+    }
+
+    static void encode(char *outData, Index inNumSplits, Index inIndex,
+                       Index inBin) {
+        if (width(inNumSplits) == 1) {
+            reinterpret_cast<unsigned char*>(outData)[inIndex] =
+                static_cast<unsigned char>(inBin < 0 ? NULL_BIN8 : inBin);
+        } else {
+            uint16_t bin = static_cast<uint16_t>(inBin < 0 ? NULL_BIN16 : inBin);
+            std::memcpy(outData + 2 * inIndex, &bin, sizeof(uint16_t));
+        }
+    }
+
+    Index size() const { return mSize; }
+
+    /**
+     * @brief Bin index of a feature, or -1 if the feature is NULL
+     */
+    Index operator()(Index inIndex) const {
+        if (mWidth == 1) {
+            unsigned char bin = mData[inIndex];
+            return bin == NULL_BIN8 ? -1 : static_cast<Index>(bin);
+        }
+        uint16_t bin;
+        std::memcpy(&bin, mData + 2 * inIndex, sizeof(uint16_t));
+        return bin == NULL_BIN16 ? -1 : static_cast<Index>(bin);
+    }
+
+    /**
+     * @brief A value in each bin that is on the same side of every split
+     *
+     * This is the upper bound of the bin, +inf for the last bin, and NaN for
+     * NULL, so that a tree can be searched with the decoded values.
+     */
+    double value(Index inIndex, const MappedMatrix &con_splits) const {
+        Index bin = (*this)(inIndex);
+        if (bin < 0) {
+            return std::numeric_limits<double>::quiet_NaN();
+        } else if (bin < con_splits.cols()) {
+            return con_splits(inIndex, bin);
+        }
+        return std::numeric_limits<double>::infinity();
+    }
+
+private:
+    const unsigned char *mData;
+    size_t mWidth;
+    Index mSize;
+};
+
 } // namespace recursive_partitioning
 } // namespace modules
 } // namespace madlib
@@ -484,7 +484,8 @@ DecisionTree<Container>::expand(const Accumulator &state,
         Index current = n_non_leaf_nodes + i;
         if (feature_indices(current) == IN_PROCESS_LEAF) {
             // 1. Set the prediction for current node from stats of all rows
-            predictions.row(current) = state.node_stats.row(i);
+            Index slot = state.leafSlot(i);
+            predictions.row(current) = state.node_stats.row(slot);
 
             // 2. Compute the best feature to split current node by
 
@@ -502,13 +503,13 @@ DecisionTree<Container>::expand(const Accumulator &state,
                     // each value of feature
                     Index fv_index = state.indexCatStats(f, v, true);
                     double gain = impurityGain(
-                        state.cat_stats.row(i).segment(fv_index, sps * 2), sps);
+                        state.cat_stats.row(slot).segment(fv_index, sps * 2), sps);
                     if (gain > max_impurity_gain){
                         max_impurity_gain = gain;
                         max_feat = f;
                         max_bin = v;
                         max_is_cat = true;
-                        max_stats = state.cat_stats.row(i).segment(fv_index,
+                        max_stats = state.cat_stats.row(slot).segment(fv_index,
                                                                    sps * 2);
                     }
                 }
@@ -519,13 +520,13 @@ DecisionTree<Container>::expand(const Accumulator &state,
                     // each bin of feature
                     Index fb_index = state.indexConStats(f, b, true);
                     double gain = impurityGain(
-                        state.con_stats.row(i).segment(fb_index, sps * 2), sps);
+                        state.con_stats.row(slot).segment(fb_index, sps * 2), sps);
                     if (gain > max_impurity_gain){
                         max_impurity_gain = gain;
                         max_feat = f;
                         max_bin = b;
                         max_is_cat = false;
-                        max_stats = state.con_stats.row(i).segment(fb_index,
+                        max_stats = state.con_stats.row(slot).segment(fb_index,
                                                                    sps * 2);
                     }
                 }
@@ -627,8 +628,8 @@ DecisionTree<Container>::pickSurrogates(
     Matrix cat_stats_counts(state.cat_stats * cat_agg_matrix);
     Matrix con_stats_counts(state.con_stats * con_agg_matrix);
 
-    // cat_stats_counts size = n_nodes x n_cats*2
-    // con_stats_counts size = n_nodes x n_cons*2
+    // cat_stats_counts size = n_live_nodes x n_cats*2
+    // con_stats_counts size = n_live_nodes x n_cons*2
     // *_stats_counts now contains the agreement count for each split where
     // each even col represents forward surrogate split count and
     // each odd col represents reverse surrogate split count.
@@ -643,7 +644,8 @@ DecisionTree<Container>::pickSurrogates(
         Index curr_node = n_ancestors + i;
         assert(curr_node >= 0 && curr_node < feature_indices.size());
 
-        if (feature_indices(curr_node) >= 0){
+        Index slot = state.leafSlot(i);
+        if (feature_indices(curr_node) >= 0 && slot >= 0){
             // 1. Compute the max count and corresponding split threshold for
             // each categorical and continuous feature
             ColumnVector cat_max_thres = ColumnVector::Zero(n_cats);
@@ -653,11 +655,11 @@ DecisionTree<Container>::pickSurrogates(
             for (Index each_cat=0; each_cat < n_cats; each_cat++){
                 Index n_levels = state.cat_levels_cumsum(each_cat) - prev_cum_levels;
                 Index max_label;
-                (cat_stats_counts.row(i).segment(
+                (cat_stats_counts.row(slot).segment(
                     prev_cum_levels * 2, n_levels * 2)).maxCoeff(&max_label);
                 cat_max_thres(each_cat) = static_cast<double>(max_label / 2);
                 cat_max_count(each_cat) =
-                        cat_stats_counts(i, prev_cum_levels*2 + max_label);
+                        cat_stats_counts(slot, prev_cum_levels*2 + max_label);
                 // every odd col is for reverse, hence i % 2 == 1 for reverse index i
                 cat_max_is_reverse(each_cat) = (max_label % 2 == 1) ? 1 : 0;
                 prev_cum_levels = state.cat_levels_cumsum(each_cat);
@@ -668,11 +670,11 @@ DecisionTree<Container>::pickSurrogates(
             IntegerVector con_max_is_reverse = IntegerVector::Zero(n_cons);
             for (Index each_con=0; each_con < n_cons; each_con++){
                 Index max_label;
-                (con_stats_counts.row(i).segment(
+                (con_stats_counts.row(slot).segment(
                         each_con*n_bins*2, n_bins*2)).maxCoeff(&max_label);
                 con_max_thres(each_con) = con_splits(each_con, max_label / 2);
                 con_max_count(each_con) =
-                        con_stats_counts(i, each_con*n_bins*2 + max_label);
+                        con_stats_counts(slot, each_con*n_bins*2 + max_label);
                 con_max_is_reverse(each_con) = (max_label % 2 == 1) ? 1 : 0;
             }
 
@@ -759,7 +761,8 @@ DecisionTree<Container>::expand_by_sampling(const Accumulator &state,
         Index current = n_non_leaf_nodes + i;
         if (feature_indices(current) == IN_PROCESS_LEAF) {
             // 1. Set the prediction for current node from stats of all rows
-            predictions.row(current) = state.node_stats.row(i);
+            Index slot = state.leafSlot(i);
+            predictions.row(current) = state.node_stats.row(slot);
 
             for (int j=0; j<total_cat_con_features; j++) {
                 cat_con_feature_indices[j] = j;
@@ -786,13 +789,13 @@ DecisionTree<Container>::expand_by_sampling(const Accumulator &state,
                         // each value of feature
                         Index fv_index = state.indexCatStats(f, v, true);
                         double gain = impurityGain(
-                            state.cat_stats.row(i).segment(fv_index, sps * 2), sps);
+                            state.cat_stats.row(slot).segment(fv_index, sps * 2), sps);
                         if (gain > max_impurity_gain){
                             max_impurity_gain = gain;
                             max_feat = f;
                             max_bin = v;
                             max_is_cat = true;
-                            max_stats = state.cat_stats.row(i).segment(fv_index,
+                            max_stats = state.cat_stats.row(slot).segment(fv_index,
                                                                        sps * 2);
                         }
                     }
@@ -805,13 +808,13 @@ DecisionTree<Container>::expand_by_sampling(const Accumulator &state,
                         // each bin of feature
                         Index fb_index = state.indexConStats(f, b, true);
                         double gain = impurityGain(
-                            state.con_stats.row(i).segment(fb_index, sps * 2), sps);
+                            state.con_stats.row(slot).segment(fb_index, sps * 2), sps);
                         if (gain > max_impurity_gain){
                             max_impurity_gain = gain;
                             max_feat = f;
                             max_bin = b;
                             max_is_cat = false;
-                            max_stats = state.con_stats.row(i).segment(fb_index,
+                            max_stats = state.con_stats.row(slot).segment(fb_index,
                                                                        sps * 2);
                         }
                     }
@@ -1476,14 +1479,18 @@ TreeAccumulator<Container, DTree>::bind(ByteStream_type& inStream) {
              >> n_con_features
              >> total_n_cat_levels
              >> n_leaf_nodes
+             >> n_live_leaves
              >> stats_per_split
-             >> weights_as_rows ;
+             >> weights_as_rows
+             >> is_histogram
+             >> subtract_from_parent;
 
     uint16_t n_bins_tmp = 0;
     uint16_t n_cat = 0;
     uint16_t n_con = 0;
     uint32_t tot_levels = 0;
     uint16_t n_leafs = 0;
+    uint16_t n_live = 0;
     uint16_t n_stats = 0;
 
     if (!n_rows.isNull()){
@@ -1492,14 +1499,16 @@ TreeAccumulator<Container, DTree>::bind(ByteStream_type& inStream) {
         n_con = n_con_features;
         tot_levels = total_n_cat_levels;
         n_leafs = n_leaf_nodes;
+        n_live = n_live_leaves;
         n_stats = stats_per_split;
     }
 
     inStream
         >> cat_levels_cumsum.rebind(n_cat)
-        >> cat_stats.rebind(n_leafs, tot_levels * n_stats * 2)
-        >> con_stats.rebind(n_leafs, n_con * n_bins_tmp * n_stats * 2)
-        >> node_stats.rebind(n_leafs, n_stats);
+        >> leaf_slots.rebind(n_leafs)
+        >> cat_stats.rebind(n_live, tot_levels * n_stats * 2)
+        >> con_stats.rebind(n_live, n_con * n_bins_tmp * n_stats * 2)
+        >> node_stats.rebind(n_live, n_stats);
 }
 // -------------------------------------------------------------------------
 
@@ -1507,26 +1516,54 @@ TreeAccumulator<Container, DTree>::bind(ByteStream_type& inStream) {
  * @brief Rebind all elements of the state when dimensionality elements are
  *  available
  *
+ * Statistics are allocated for the live nodes of dt at the given depth only,
+ * i.e., the nodes that are neither finished leaves nor non-existing.
  */
 template <class Container, class DTree>
+template <class DT>
 inline
 void
 TreeAccumulator<Container, DTree>::rebind(
         uint16_t in_n_bins, uint16_t in_n_cat_feat,
         uint16_t in_n_con_feat, uint32_t in_n_total_levels,
-        uint16_t tree_depth, uint16_t in_n_stats, bool in_weights_as_rows) {
+        const DT &dt, uint16_t tree_depth, uint16_t in_n_stats,
+        bool in_weights_as_rows, bool in_is_histogram) {
 
     n_bins = in_n_bins;
     n_cat_features = in_n_cat_feat;
     n_con_features = in_n_con_feat;
     total_n_cat_levels = in_n_total_levels;
     weights_as_rows = in_weights_as_rows;
+    is_histogram = in_is_histogram;
+    subtract_from_parent = false;
     if (tree_depth > 0)
         n_leaf_nodes = static_cast<uint16_t>(pow(2, tree_depth - 1));
     else
         n_leaf_nodes = 1;
     stats_per_split = in_n_stats;
+
+    Index n_non_leaf_nodes = n_leaf_nodes - 1;
+    uint16_t n_live = 0;
+    for (Index i = 0; i < n_leaf_nodes; i++) {
+        Index node = n_non_leaf_nodes + i;
+        if (node < dt.feature_indices.size() &&
+                dt.feature_indices(node) != dt.FINISHED_LEAF &&
+                dt.feature_indices(node) != dt.NODE_NON_EXISTING)
+            n_live++;
+    }
+    n_live_leaves = n_live;
     this->resize();
+
+    n_live = 0;
+    for (Index i = 0; i < n_leaf_nodes; i++) {
+        Index node = n_non_leaf_nodes + i;
+        if (node < dt.feature_indices.size() &&
+                dt.feature_indices(node) != dt.FINISHED_LEAF &&
+                dt.feature_indices(node) != dt.NODE_NON_EXISTING)
+            leaf_slots(i) = n_live++;
+        else
+            leaf_slots(i) = -1;
+    }
 }
 // -------------------------------------------------------------------------
 
@@ -1562,12 +1599,46 @@ TreeAccumulator<Container, DTree>::operator<<(const tuple_type& inTuple) {
             Index dt_search_index = dt.search(cat_features, con_features);
             if (dt.feature_indices(dt_search_index) != dt.FINISHED_LEAF &&
                  dt.feature_indices(dt_search_index) != dt.NODE_NON_EXISTING) {
-                Index row_index = dt_search_index - n_non_leaf_nodes;
+                Index row_index = leafSlot(dt_search_index - n_non_leaf_nodes);
                 assert(row_index >= 0);
                 // add this row into the stats for the node
                 updateNodeStats(static_cast<bool>(dt.is_regression), row_index,
                                 response, weight);
 
+                if (is_histogram) {
+                    // The stats of the larger child are computed from the
+                    // parent and the sibling after the scan
+                    if (isDerivedLeaf(dt, dt_search_index)) {
+                        n_rows++;
+                        return *this;
+                    }
+                    // Add the row to one histogram cell per feature. A value v
+                    // belongs to the 'true' side of every split j with v <= j
+                    // (categorical) or v <= con_splits(i, j) (continuous),
+                    // i.e., of all splits starting at its bin.
+                    for (Index i=0; i < n_cat_features; ++i){
+                        if (cat_levels(i) > 0 && !dt.isNull(cat_features(i), true)){
+                            Index col_index = (cat_features(i) < cat_levels(i)) ?
+                                indexCatStats(i, cat_features(i), true) :
+                                indexCatStats(i, cat_levels(i) - 1, false);
+                            updateStats(static_cast<bool>(dt.is_regression), true,
+                                    row_index, col_index, response, weight);
+                        }
+                    }
+                    for (Index i=0; i < n_con_features; ++i){
+                        if (n_bins > 0 && !dt.isNull(con_features(i), false)){
+                            Index bin = binIndex(i, con_features(i), con_splits);
+                            Index col_index = (bin < n_bins) ?
+                                indexConStats(i, bin, true) :
+                                indexConStats(i, n_bins - 1, false);
+                            updateStats(static_cast<bool>(dt.is_regression), false,
+                                    row_index, col_index, response, weight);
+                        }
+                    }
+                    n_rows++;
+                    return *this;
+                }
+
                 // update stats for categorical feature values in the current row
                 for (Index i=0; i < n_cat_features; ++i){
                     for (int j=0; j < cat_levels(i); ++j){
@@ -1602,6 +1673,108 @@ TreeAccumulator<Container, DTree>::operator<<(const tuple_type& inTuple) {
 // -------------------------------------------------------------------------
 
 
+/**
+ * @brief Update the accumulation state by feeding a tuple with binned
+ *     continuous features
+ *
+ * Same as above, except that the continuous features are given as bin
+ * indices (see ConBinnedFeatures), so that the row is added to its bins
+ * without comparing values to the splits. Since con_features(i) <=
+ * con_splits(i, j) if and only if the bin index is <= j, this produces the
+ * same statistics as feeding the values.
+ */
+template <class Container, class DTree>
+inline
+TreeAccumulator<Container, DTree>&
+TreeAccumulator<Container, DTree>::operator<<(const binned_tuple_type& inTuple) {
+    tree_type dt = std::get<0>(inTuple);
+    const MappedIntegerVector& cat_features = std::get<1>(inTuple);
+    const ConBinnedFeatures& con_bins = std::get<2>(inTuple);
+    const double& response = std::get<3>(inTuple);
+    const double& weight = std::get<4>(inTuple);
+    const MappedIntegerVector& cat_levels = std::get<5>(inTuple);
+    const MappedMatrix& con_splits = std::get<6>(inTuple);
+
+    if (!terminated){
+        if (!std::isfinite(response)) {
+            warning("Decision tree response variable values are not finite.");
+        } else if ((cat_features.size() + con_bins.size()) >
+                        std::numeric_limits<uint16_t>::max()) {
+            warning("Number of independent variables cannot be larger than 65535.");
+        } else if (n_cat_features != static_cast<uint16_t>(cat_features.size())) {
+            warning("Inconsistent numbers of categorical independent variables.");
+        } else if (n_con_features != static_cast<uint16_t>(con_bins.size())) {
+            warning("Inconsistent numbers of continuous independent variables.");
+        } else{
+            // The tree is searched with a value of each bin, which lies on
+            // the same side of every split as the original value
+            ColumnVector con_values(n_con_features);
+            for (Index i=0; i < n_con_features; ++i)
+                con_values(i) = con_bins.value(i, con_splits);
+
+            uint16_t n_non_leaf_nodes = static_cast<uint16_t>(n_leaf_nodes - 1);
+            Index dt_search_index = dt.search(cat_features,
+                MappedColumnVector(con_values.data(), con_values.size()));
+            if (dt.feature_indices(dt_search_index) != dt.FINISHED_LEAF &&
+                 dt.feature_indices(dt_search_index) != dt.NODE_NON_EXISTING) {
+                Index row_index = leafSlot(dt_search_index - n_non_leaf_nodes);
+                assert(row_index >= 0);
+                updateNodeStats(static_cast<bool>(dt.is_regression), row_index,
+                                response, weight);
+                if (is_histogram && isDerivedLeaf(dt, dt_search_index)) {
+                    n_rows++;
+                    return *this;
+                }
+
+                for (Index i=0; i < n_cat_features; ++i){
+                    if (dt.isNull(cat_features(i), true))
+                        continue;
+                    if (is_histogram) {
+                        if (cat_levels(i) > 0) {
+                            Index col_index = (cat_features(i) < cat_levels(i)) ?
+                                indexCatStats(i, cat_features(i), true) :
+                                indexCatStats(i, cat_levels(i) - 1, false);
+                            updateStats(static_cast<bool>(dt.is_regression), true,
+                                    row_index, col_index, response, weight);
+                        }
+                    } else {
+                        for (int j=0; j < cat_levels(i); ++j){
+                            Index col_index = indexCatStats(
+                                    i, j, (cat_features(i) <= j));
+                            updateStats(static_cast<bool>(dt.is_regression), true,
+                                    row_index, col_index, response, weight);
+                        }
+                    }
+                }
+                for (Index i=0; i < n_con_features; ++i){
+                    Index bin = con_bins(i);
+                    if (bin < 0 || n_bins == 0)
+                        continue;
+                    if (is_histogram) {
+                        Index col_index = (bin < n_bins) ?
+                            indexConStats(i, bin, true) :
+                            indexConStats(i, n_bins - 1, false);
+                        updateStats(static_cast<bool>(dt.is_regression), false,
+                                row_index, col_index, response, weight);
+                    } else {
+                        for (Index j=0; j < n_bins; ++j){
+                            Index col_index = indexConStats(i, j, bin <= j);
+                            updateStats(static_cast<bool>(dt.is_regression), false,
+                                    row_index, col_index, response, weight);
+                        }
+                    }
+                }
+            }
+            n_rows++;
+            return *this;
+        }
+        // error case for current group
+        terminated = true;
+    }
+    return *this;
+}
+// -------------------------------------------------------------------------
+
 /**
  * @brief Update the accumulation state for surrogate statistics by feeding a tuple
  */
@@ -1648,7 +1821,7 @@ TreeAccumulator<Container, DTree>::operator<<(const surr_tuple_type& inTuple) {
             bool is_primary_true = (primary_val <= primary_threshold);
 
             if (dt.feature_indices(dt_parent_index) >= 0){
-                Index row_index = dt_parent_index - n_non_surr_nodes;
+                Index row_index = leafSlot(dt_parent_index - n_non_surr_nodes);
 
                 assert(row_index >= 0 && row_index < cat_stats.rows() &&
                        row_index < con_stats.rows());
@@ -1706,7 +1879,10 @@ TreeAccumulator<Container, DTree>::operator<<(
     if (!inOther.empty()) {
         if ((n_bins != inOther.n_bins) ||
                (n_cat_features != inOther.n_cat_features) ||
-               (n_con_features != inOther.n_con_features)) {
+               (n_con_features != inOther.n_con_features) ||
+               (n_leaf_nodes != inOther.n_leaf_nodes) ||
+               (n_live_leaves != inOther.n_live_leaves) ||
+               (is_histogram != inOther.is_histogram)) {
             warning("Inconsistent states during merge.");
             terminated = true;
         } else {
@@ -1756,22 +1932,192 @@ TreeAccumulator<Container, DTree>::updateStats(bool is_regression,
                                                Index stats_index,
                                                const double response,
                                                const double weight) {
-    ColumnVector stats(stats_per_split);
-    stats.fill(0);
-    int n_rows = this->weights_as_rows ? static_cast<int>(weight) : 1; 
+    // Add directly into the matrix: this is called for every feature of
+    // every row, so we avoid building a temporary stats vector here.
+    Matrix_type &stats = is_cat ? cat_stats : con_stats;
+    int n_rows = this->weights_as_rows ? static_cast<int>(weight) : 1;
     if (is_regression){
         double w_response = weight * response;
-        stats << weight, w_response, w_response * response, n_rows;
+        stats(row_index, stats_index) += weight;
+        stats(row_index, stats_index + 1) += w_response;
+        stats(row_index, stats_index + 2) += w_response * response;
+        stats(row_index, stats_index + 3) += n_rows;
     } else {
-        stats(static_cast<uint16_t>(response)) = weight;
-        stats.tail(1)(0) = n_rows;
+        stats(row_index, stats_index + static_cast<uint16_t>(response)) += weight;
+        stats(row_index, stats_index + stats_per_split - 1) += n_rows;
     }
+}
+// -------------------------------------------------------------------------
 
-    if (is_cat) {
-        cat_stats.row(row_index).segment(stats_index, stats_per_split) += stats;
-    } else {
-        con_stats.row(row_index).segment(stats_index, stats_per_split) += stats;
+/**
+ * @brief Return the index of the first bin of a continuous feature whose
+ * threshold is not smaller than value
+ *
+ * The thresholds in each row of con_splits are sorted in ascending order, so
+ * a value satisfies 'value <= con_splits(feature_index, j)' exactly for
+ * j >= binIndex(). A return value of n_bins means that the value is larger
+ * than all thresholds.
+ */
+template <class Container, class DTree>
+inline
+Index
+TreeAccumulator<Container, DTree>::binIndex(Index feature_index,
+                                            double value,
+                                            const MappedMatrix &con_splits) const {
+    Index low = 0;
+    Index high = n_bins;
+    while (low < high) {
+        Index mid = (low + high) / 2;
+        if (con_splits(feature_index, mid) < value)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+// -------------------------------------------------------------------------
+
+/**
+ * @brief Turn per-bin histograms into cumulative split statistics
+ *
+ * For each leaf and feature, the 'true' statistics of split j become the sum
+ * of the histogram cells 0..j and the 'false' statistics become the total of
+ * the feature (including the rows beyond the last split) minus the 'true'
+ * statistics. Nothing is done if the state is not in histogram mode.
+ */
+template <class Container, class DTree>
+inline
+void
+TreeAccumulator<Container, DTree>::computeCumulativeStats() {
+    if (!is_histogram)
+        return;
+
+    const uint16_t sps = stats_per_split;
+    ColumnVector running(sps);
+    ColumnVector total(sps);
+    for (Index row = 0; row < n_live_leaves; row++) {
+        for (Index i = 0; i < n_cat_features + n_con_features; i++) {
+            bool is_cat = (i < n_cat_features);
+            Index n_splits;
+            Index start;
+            if (is_cat) {
+                n_splits = (i == 0) ? cat_levels_cumsum(0) :
+                    cat_levels_cumsum(i) - cat_levels_cumsum(i - 1);
+                start = indexCatStats(i, 0, true);
+            } else {
+                n_splits = n_bins;
+                start = indexConStats(i - n_cat_features, 0, true);
+            }
+            if (n_splits == 0)
+                continue;
+
+            Matrix_type &stats = is_cat ? cat_stats : con_stats;
+            running.setZero();
+            for (Index j = 0; j < n_splits; j++) {
+                Index true_index = start + 2 * sps * j;
+                running += trans(stats.row(row).segment(true_index, sps));
+                stats.row(row).segment(true_index, sps) = trans(running);
+            }
+            total = running + trans(stats.row(row).segment(
+                start + 2 * sps * (n_splits - 1) + sps, sps));
+            for (Index j = 0; j < n_splits; j++) {
+                Index true_index = start + 2 * sps * j;
+                stats.row(row).segment(true_index + sps, sps) =
+                    trans(total) - stats.row(row).segment(true_index, sps);
+            }
+        }
+    }
+    is_histogram = false;
+}
+// -------------------------------------------------------------------------
+
+/**
+ * @brief Return true if the statistics of a leaf are not accumulated during
+ * the scan but derived from the parent and the sibling
+ *
+ * Of two sibling leaves, the one with more rows (as estimated by the
+ * statistics from the parent's split) is derived; the false child is
+ * derived on ties.
+ */
+template <class Container, class DTree>
+template <class DT>
+inline
+bool
+TreeAccumulator<Container, DTree>::isDerivedLeaf(const DT &dt,
+                                                 Index node_index) const {
+    if (!subtract_from_parent || node_index == 0)
+        return false;
+
+    bool is_true_child = (node_index % 2 == 1);
+    Index sibling = is_true_child ? node_index + 1 : node_index - 1;
+    if (dt.feature_indices(sibling) != dt.IN_PROCESS_LEAF)
+        return false;
+
+    uint64_t count = dt.nodeCount(node_index);
+    uint64_t sibling_count = dt.nodeCount(sibling);
+    return is_true_child ? (count > sibling_count) : (count >= sibling_count);
+}
+// -------------------------------------------------------------------------
+
+/**
+ * @brief Compute the histograms of all derived leaves as parent - sibling
+ *
+ * inParent is the (histogram mode) state of the previous level, i.e., the
+ * level at which the parents of the current leaves were leaves themselves.
+ * It must have been derived itself, so that all its rows are complete.
+ * Afterwards, all rows of this state are complete, and it can serve as the
+ * parent of the next level.
+ */
+template <class Container, class DTree>
+template <class DT, class C, class PDT>
+inline
+void
+TreeAccumulator<Container, DTree>::deriveFromParent(
+        const DT &dt, const TreeAccumulator<C, PDT> &inParent) {
+    if (!subtract_from_parent)
+        return;
+
+    if (!is_histogram || !inParent.is_histogram ||
+            n_leaf_nodes != 2 * inParent.n_leaf_nodes ||
+            n_bins != inParent.n_bins ||
+            n_cat_features != inParent.n_cat_features ||
+            n_con_features != inParent.n_con_features ||
+            stats_per_split != inParent.stats_per_split ||
+            inParent.subtract_from_parent)
+        throw std::runtime_error("Inconsistent parent state for histogram "
+                                 "subtraction");
+
+    const uint16_t sps = stats_per_split;
+    Index n_non_leaf_nodes = n_leaf_nodes - 1;
+    Index n_parent_non_leaf_nodes = inParent.n_leaf_nodes - 1;
+    for (Index i = 0; i < n_leaf_nodes; i++) {
+        Index current = n_non_leaf_nodes + i;
+        if (dt.feature_indices(current) != dt.IN_PROCESS_LEAF ||
+                !isDerivedLeaf(dt, current))
+            continue;
+
+        Index row = leafSlot(i);
+        Index sibling_row = leafSlot((current % 2 == 1) ? i + 1 : i - 1);
+        Index parent_row = inParent.leafSlot(
+            dt.parentIndex(current) - n_parent_non_leaf_nodes);
+        if (row < 0 || sibling_row < 0 || parent_row < 0)
+            throw std::runtime_error("Inconsistent parent state for histogram "
+                                     "subtraction");
+        cat_stats.row(row) = inParent.cat_stats.row(parent_row) -
+            cat_stats.row(sibling_row);
+        con_stats.row(row) = inParent.con_stats.row(parent_row) -
+            con_stats.row(sibling_row);
+
+        // Weighted sums may not cancel exactly. Cells without any rows must
+        // be exactly zero, and the unweighted count (last element) is exact.
+        for (Index j = 0; j < cat_stats.cols(); j += sps)
+            if (cat_stats(row, j + sps - 1) == 0)
+                cat_stats.row(row).segment(j, sps).setZero();
+        for (Index j = 0; j < con_stats.cols(); j += sps)
+            if (con_stats(row, j + sps - 1) == 0)
+                con_stats.row(row).segment(j, sps).setZero();
     }
+    subtract_from_parent = false;
 }
 // -------------------------------------------------------------------------
 
@@ -1821,7 +2167,7 @@ TreeAccumulator<Container, DTree>::indexCatStats(Index feature_index,
                                                  int   cat_value,
                                                  bool  is_split_true) const {
     // cat_stats is a matrix
-    //   size = (n_leaf_nodes) x (total_n_cat_levels * stats_per_split * 2)
+    //   size = (n_live_leaves) x (total_n_cat_levels * stats_per_split * 2)
     assert(feature_index < n_cat_features);
     unsigned int cat_cumsum_value = (feature_index == 0) ? 0 : cat_levels_cumsum(feature_index - 1);
     return computeSubIndex(static_cast<Index>(cat_cumsum_value),
@@ -16,6 +16,7 @@
 #include <limits>  // std::numeric_limits
 
 #include <dbconnector/dbconnector.hpp>
+#include "ConSplits.hpp"
 
 namespace madlib {
 
@@ -229,6 +230,15 @@ public:
                         MappedMatrix         // split values for each continuous feature
                       > tuple_type;
 
+    typedef std::tuple< tree_type,
+                        MappedIntegerVector, // categorical feature values
+                        ConBinnedFeatures,   // continuous feature bin indices
+                        double,              // response variable
+                        double,              // weight
+                        MappedIntegerVector, // levels for each categorical feature
+                        MappedMatrix         // split values for each continuous feature
+                      > binned_tuple_type;
+
     typedef std::tuple< tree_type,
                         MappedIntegerVector, // categorical feature values
                         MappedColumnVector,  // continuous feature values
@@ -241,17 +251,32 @@ public:
     // functions
     TreeAccumulator(Init_type& inInitialization);
     void bind(ByteStream_type& inStream);
+    template <class DT>
     void rebind(uint16_t n_bins, uint16_t n_cat_feat,
                 uint16_t n_con_feat, uint32_t n_total_levels,
-                uint16_t tree_depth, uint16_t n_stats, bool weights_as_rows);
+                const DT &dt, uint16_t tree_depth, uint16_t n_stats,
+                bool weights_as_rows, bool is_histogram = false);
 
     TreeAccumulator& operator<<(const tuple_type& inTuple);
+    TreeAccumulator& operator<<(const binned_tuple_type& inTuple);
     TreeAccumulator& operator<<(const surr_tuple_type& inTuple);
 
     template <class C, class DT>
     TreeAccumulator& operator<<(const TreeAccumulator<C, DT>& inOther);
     bool empty() const { return this->n_rows == 0; }
 
+    // row of the statistics of a leaf, or -1 if the leaf is not live
+    Index leafSlot(Index leaf_index) const { return leaf_slots(leaf_index); }
+
+    // histogram mode: convert per-bin histograms into split statistics
+    void computeCumulativeStats();
+    // histogram mode: is the stats of this leaf derived as parent - sibling
+    template <class DT>
+    bool isDerivedLeaf(const DT &dt, Index node_index) const;
+    template <class DT, class C, class PDT>
+    void deriveFromParent(const DT &dt,
+                          const TreeAccumulator<C, PDT> &inParent);
+
     // cat_features[feature_index] <= cat_value
     Index indexCatStats(Index feature_index, int cat_value, bool is_split_true) const;
     // con_features[feature_index] <= bin_threshold,
@@ -266,6 +291,10 @@ public:
                      Index stats_index, const double response,
                      const double weight);
 
+    // index of the first bin whose threshold is >= value
+    Index binIndex(Index feature_index, double value,
+                   const MappedMatrix &con_splits) const;
+
     // apply the tuple using indices
     void updateSurrStats(const bool is_cat, const bool surr_agrees,
                          Index row_index, Index stats_index, const int dup_count);
@@ -283,6 +312,9 @@ public:
     uint32_type total_n_cat_levels;
     // n_leaf_nodes = 2^{dt.tree_depth-1} for dt.tree_depth > 0
     uint16_type n_leaf_nodes;
+    // number of live leaves, i.e., leaves that are neither finished nor
+    // non-existing. Statistics are only kept for these.
+    uint16_type n_live_leaves;
     // For regression, stats_per_split = 4, i.e. (w, w*y, w*y^2, 1)
     // For classification, stats_per_split = (number of class labels + 1)
     // i.e. (w_1, w_2, ..., w_c, 1)
@@ -292,6 +324,20 @@ public:
     // treat weights as duplicated rows (used for random forest)
     bool_type weights_as_rows;
 
+    // In histogram mode, each row adds its statistics to a single cell per
+    // feature (the bin its value falls into) instead of to every split.
+    // The layout of cat_stats/con_stats is the same as below, with the
+    // 'true' slot of each split holding the histogram cell for that bin and
+    // the 'false' slot of the last split holding the rows beyond the last
+    // threshold. computeCumulativeStats() turns this into the split
+    // statistics expected by DecisionTree::expand().
+    bool_type is_histogram;
+
+    // In histogram mode, only the smaller child of each split is scanned.
+    // The statistics of the larger child are derived as parent - sibling
+    // using the state of the previous level (see deriveFromParent()).
+    bool_type subtract_from_parent;
+
     // training statistics
     // cumulative sum of the levels of categorical variables
     // with first element as 0. This is helpful to compute the index into
@@ -300,13 +346,19 @@ public:
     // element = (total_n_cat_levels - last element of cat_levels)
     IntegerVector_type cat_levels_cumsum; // used as integer array
 
+    // leaf_slots maps each of the n_leaf_nodes leaves to its row in the
+    // statistics below, or to -1 if the leaf is not live. With most leaves
+    // of a deep tree finished, this keeps the state (and the data moved by
+    // merges) proportional to the leaves still being trained.
+    IntegerVector_type leaf_slots;
+
     // con_stats and cat_stats are matrices that contain the statistics used
     // during training.
     // cat_stats is a matrix of size:
-    // (n_leaf_nodes) x (total_n_cat_levels * stats_per_split * 2)
+    // (n_live_leaves) x (total_n_cat_levels * stats_per_split * 2)
     Matrix_type cat_stats;
     // con_stats is a matrix:
-    // (n_leaf_nodes) x (n_con_features * n_bins * stats_per_split * 2)
+    // (n_live_leaves) x (n_con_features * n_bins * stats_per_split * 2)
     Matrix_type con_stats;
 
     // node_stats is used to keep a statistic of all the rows that land on a
@@ -19,6 +19,7 @@
 #include "DT_proto.hpp"
 #include "DT_impl.hpp"
 #include "ConSplits.hpp"
+#include "CompiledTree.hpp"
 
 #include <math.h>       /* fabs */
 
@@ -90,8 +91,44 @@ initialize_decision_tree::run(AnyType & args){
 // Functions to capture leaf stats for picking primary splits //
 ////////////////////////////////////////////////////////////////
 
-AnyType
-compute_leaf_stats_transition::run(AnyType & args){
+static void
+addLeafStatsRow(MutableLevelState &state, const LevelState::tree_type &dt,
+                const NativeIntegerVector &cat_features,
+                const NativeColumnVector &con_features,
+                double response, double weight,
+                const NativeIntegerVector &cat_levels,
+                const MappedMatrix &con_splits) {
+    state << MutableLevelState::tuple_type(dt, cat_features, con_features,
+                                           response, weight,
+                                           cat_levels,
+                                           con_splits);
+}
+
+static void
+addLeafStatsRow(MutableLevelState &state, const LevelState::tree_type &dt,
+                const NativeIntegerVector &cat_features,
+                const ConBinnedFeatures &con_bins,
+                double response, double weight,
+                const NativeIntegerVector &cat_levels,
+                const MappedMatrix &con_splits) {
+    state << MutableLevelState::binned_tuple_type(dt, cat_features, con_bins,
+                                                  response, weight,
+                                                  cat_levels,
+                                                  con_splits);
+}
+
+/**
+ * @brief Transition function of the leaf statistics aggregate, for both
+ *     continuous feature values and bin indices
+ *
+ * @param con_splits_results Continuous splits (args[7]), con_splits size =
+ *     num_con_features x num_bins. When num_con_features = 0, the input will
+ *     be an empty string that is read as a ByteString
+ */
+template <class ConFeatures>
+static AnyType
+computeLeafStatsTransition(AnyType &args, const ConFeatures &con_features,
+        const ConSplitsResult<RootContainer> &splits_results) {
     MutableLevelState state = args[0].getAs<MutableByteString>();
     LevelState::tree_type dt = args[1].getAs<ByteString>();
 
@@ -104,22 +141,15 @@ compute_leaf_stats_transition::run(AnyType & args){
     if (weight < 0)
         throw std::runtime_error("Negative weights present in the data");
     NativeIntegerVector cat_features;
-    NativeColumnVector con_features;
     try {
         if (args[2].isNull()){
-            cat_features.rebind(this->allocateArray<int>(0));
+            cat_features.rebind(dbconnector::postgres::allocateArray<int,
+                dbal::FunctionContext, dbal::DoZero, dbal::ThrowBadAlloc>(0));
         }
         else {
             NativeIntegerVector xx_cat = args[2].getAs<NativeIntegerVector>();
             cat_features.rebind(xx_cat.memoryHandle(), xx_cat.size());
         }
-        if (args[3].isNull()){
-            con_features.rebind(this->allocateArray<double>(0));
-        }
-        else {
-            NativeColumnVector xx_con = args[3].getAs<NativeColumnVector>();
-            con_features.rebind(xx_con.memoryHandle(), xx_con.size());
-        }
     } catch (const ArrayWithNullException &e) {
         return args[0];
     }
@@ -127,7 +157,8 @@ compute_leaf_stats_transition::run(AnyType & args){
     // cat_levels size = n_cat_features
     NativeIntegerVector cat_levels;
     if (args[6].isNull()){
-        cat_levels.rebind(this->allocateArray<int>(0));
+        cat_levels.rebind(dbconnector::postgres::allocateArray<int,
+            dbal::FunctionContext, dbal::DoZero, dbal::ThrowBadAlloc>(0));
     }
     else {
         MutableNativeIntegerVector xx_cat = args[6].getAs<MutableNativeIntegerVector>();
@@ -139,11 +170,6 @@ compute_leaf_stats_transition::run(AnyType & args){
         cat_levels.rebind(xx_cat.memoryHandle(), xx_cat.size());
     }
 
-    // con_splits size = num_con_features x num_bins
-    // When num_con_features = 0, the input will be an empty string that is read
-    // as a ByteString
-    ConSplitsResult<RootContainer> splits_results = args[7].getAs<ByteString>();
-
     // n_response_labels are the number of values the dependent variable takes
     uint16_t n_response_labels = args[8].getAs<uint16_t>();
     if (!dt.is_regression && n_response_labels <= 1){
@@ -161,14 +187,30 @@ compute_leaf_stats_transition::run(AnyType & args){
         uint16_t stats_per_split = dt.is_regression ?
             REGRESS_N_STATS : static_cast<uint16_t>(n_response_labels + 1);
         const bool weights_as_rows = args[9].getAs<bool>();
+        // Leaf statistics are collected as per-bin histograms, see
+        // TreeAccumulator::is_histogram
         state.rebind(static_cast<uint16_t>(splits_results.con_splits.cols()),
                      static_cast<uint16_t>(cat_features.size()),
                      static_cast<uint16_t>(con_features.size()),
                      static_cast<uint32_t>(cat_levels.sum()),
+                     dt,
                      static_cast<uint16_t>(dt.tree_depth),
-                     stats_per_split, 
-                     weights_as_rows
+                     stats_per_split,
+                     weights_as_rows,
+                     true
                     );
+        // If the state of the previous level is available, the larger child
+        // of each split is not scanned but derived by dt_derive_leaf_stats.
+        // A parent state that has not been derived itself has incomplete
+        // rows and cannot be subtracted from.
+        if (args.numFields() > 10 && !args[10].isNull()) {
+            LevelState parent_state = args[10].getAs<ByteString>();
+            state.subtract_from_parent = (!parent_state.empty() &&
+                !parent_state.terminated &&
+                parent_state.is_histogram &&
+                !parent_state.subtract_from_parent &&
+                2 * parent_state.n_leaf_nodes == state.n_leaf_nodes);
+        }
         // compute cumulative sum of the levels of the categorical variables
         int current_sum = 0;
         for (Index i=0; i < state.n_cat_features; ++i){
@@ -185,12 +227,47 @@ compute_leaf_stats_transition::run(AnyType & args){
         }
     }
 
-    state << MutableLevelState::tuple_type(dt, cat_features, con_features,
-                                           response, weight,
-                                           cat_levels,
-                                           splits_results.con_splits);
+    addLeafStatsRow(state, dt, cat_features, con_features, response, weight,
+                    cat_levels, splits_results.con_splits);
     return state.storage();
+}
+// ------------------------------------------------------------
+
+AnyType
+compute_leaf_stats_transition::run(AnyType & args){
+    NativeColumnVector con_features;
+    try {
+        if (args[3].isNull()){
+            con_features.rebind(this->allocateArray<double>(0));
+        }
+        else {
+            NativeColumnVector xx_con = args[3].getAs<NativeColumnVector>();
+            con_features.rebind(xx_con.memoryHandle(), xx_con.size());
+        }
+    } catch (const ArrayWithNullException &e) {
+        return args[0];
+    }
+    ConSplitsResult<RootContainer> splits_results = args[7].getAs<ByteString>();
+    return computeLeafStatsTransition(args, con_features, splits_results);
 } // transition function
+// ------------------------------------------------------------
+
+/**
+ * @brief Same as compute_leaf_stats_transition, with the continuous features
+ *     given as bin indices by _dst_encode_con_features()
+ */
+AnyType
+compute_leaf_stats_binned_transition::run(AnyType & args){
+    ConSplitsResult<RootContainer> splits_results = args[7].getAs<ByteString>();
+    Index n_splits = splits_results.con_splits.cols();
+    if (args[3].isNull()) {
+        ConBinnedFeatures con_bins(NULL, 0, n_splits);
+        return computeLeafStatsTransition(args, con_bins, splits_results);
+    }
+    ByteString encoded = args[3].getAs<ByteString>();
+    ConBinnedFeatures con_bins(encoded.ptr(), encoded.size(), n_splits);
+    return computeLeafStatsTransition(args, con_bins, splits_results);
+}
 
 // ------------------------------------------------------------
 AnyType
@@ -207,13 +284,43 @@ compute_leaf_stats_merge::run(AnyType & args){
    return stateLeft.storage();
 } // merge function
 
+/**
+ * @brief Complete the leaf statistics of a level that was accumulated with
+ *     histogram subtraction
+ *
+ * The statistics of the leaves that were skipped during the scan are
+ * computed from the state of the previous level. The returned state is the
+ * one to pass to dt_apply, and to the next level as parent state.
+ */
+AnyType
+dt_derive_leaf_stats::run(AnyType & args){
+    if (args[1].isNull())
+        return Null();
+    MutableLevelState curr_level = args[1].getAs<MutableByteString>();
+    if (!curr_level.terminated && curr_level.subtract_from_parent) {
+        if (args[2].isNull())
+            throw std::runtime_error("State of the previous level is "
+                                     "required to derive leaf statistics");
+        Tree dt = args[0].getAs<ByteString>();
+        LevelState parent_level = args[2].getAs<ByteString>();
+        curr_level.deriveFromParent(dt, parent_level);
+    }
+    return curr_level.storage();
+}
+// ------------------------------------------------------------
+
 AnyType
 dt_apply::run(AnyType & args){
     MutableTree dt = args[0].getAs<MutableByteString>();
-    LevelState curr_level = args[1].getAs<ByteString>();
+    MutableLevelState curr_level = args[1].getAs<MutableByteString>();
     // 0 = running, 1 = finished training, 2 = terminated prematurely
     uint16_t return_code;
     if (!curr_level.terminated){
+        if (curr_level.subtract_from_parent)
+            throw std::runtime_error("Leaf statistics have not been derived "
+                                     "from the previous level");
+        curr_level.computeCumulativeStats();
+
         ConSplitsResult<RootContainer> con_splits_results = args[2].getAs<ByteString>();
         uint16_t min_split = args[3].getAs<uint16_t>();
         uint16_t min_bucket = args[4].getAs<uint16_t>();
@@ -299,6 +406,7 @@ compute_surr_stats_transition::run(AnyType & args){
                          static_cast<uint16_t>(cat_features.size()),
                          static_cast<uint16_t>(con_features.size()),
                          static_cast<uint32_t>(cat_levels.sum()),
+                         dt,
                          static_cast<uint16_t>(dt.tree_depth - 1),
                          2,
                          false // dummy, only used in compute_leaf_stat
@@ -331,6 +439,44 @@ dt_surr_apply::run(AnyType & args){
 } // apply function
 // -------------------------------------------------------------------------
 
+/*
+    @brief Return the compiled form of the tree in args[0]
+
+    Prediction is called once per row with (usually) the same model, so the
+    tree is compiled once and kept in the fn_extra cache of the calling
+    function. The cache is keyed by the model argument before detoasting (see
+    RawDatumKey) and rebuilt only when a different model is passed in
+    (e.g., one tree per group).
+*/
+struct CompiledTreeCache {
+    RawDatumKey key;
+    CacheBuffer<char> tree;
+};
+
+static const CompiledTree&
+getCompiledTree(AnyType &args) {
+    CompiledTreeCache *cache =
+        static_cast<CompiledTreeCache*>(args.getUserFuncContext());
+    if (cache == NULL) {
+        cache = static_cast<CompiledTreeCache*>(
+            MemoryContextAllocZero(args.getCacheMemoryContext(),
+                                   sizeof(CompiledTreeCache)));
+        args.setUserFuncContext(cache);
+    }
+
+    const void *raw = args[0].getRawPointer();
+    if (cache->key.matches(raw))
+        return *reinterpret_cast<const CompiledTree*>(cache->tree.ptr);
+
+    cache->key.invalidate();
+    Tree dt = args[0].getAs<ByteString>();
+    const CompiledTree *tree = CompiledTree::compile(cache->tree.reserve(
+        args.getCacheMemoryContext(), CompiledTree::storageSize(dt)), dt);
+    cache->key.assign(args.getCacheMemoryContext(), raw);
+    return *tree;
+}
+// -------------------------------------------------------------------------
+
 /*
     @brief Return the probabilities of classes as prediction
 */
@@ -339,7 +485,7 @@ predict_dt_prob::run(AnyType &args){
     if (args[0].isNull()){
         return Null();
     }
-    Tree dt = args[0].getAs<ByteString>();
+    const CompiledTree &dt = getCompiledTree(args);
     NativeIntegerVector cat_features;
     NativeColumnVector con_features;
     try {
@@ -360,7 +506,9 @@ predict_dt_prob::run(AnyType &args){
     } catch (const ArrayWithNullException &e) {
         return Null();
     }
-    ColumnVector prediction = dt.predict(cat_features, con_features);
+    Index leaf_index = dt.search(cat_features, con_features);
+    ColumnVector prediction = Eigen::Map<const ColumnVector>(
+        dt.prediction(leaf_index), dt.predictionWidth());
     return prediction;
 }
 
@@ -374,7 +522,7 @@ predict_dt_response::run(AnyType &args){
     if (args[0].isNull()){
         return Null();
     }
-    Tree dt = args[0].getAs<ByteString>();
+    const CompiledTree &dt = getCompiledTree(args);
     NativeIntegerVector cat_features;
     NativeColumnVector con_features;
     try {
@@ -396,7 +544,7 @@ predict_dt_response::run(AnyType &args){
         // reach here only if surrogates are not used
         return Null();
     }
-    return dt.predict_response(cat_features, con_features);
+    return dt.response(dt.search(cat_features, con_features));
 }
 
 AnyType
@@ -7,7 +7,9 @@
 DECLARE_UDF(recursive_partitioning, initialize_decision_tree)
 
 DECLARE_UDF(recursive_partitioning, compute_leaf_stats_transition)
+DECLARE_UDF(recursive_partitioning, compute_leaf_stats_binned_transition)
 DECLARE_UDF(recursive_partitioning, compute_leaf_stats_merge)
+DECLARE_UDF(recursive_partitioning, dt_derive_leaf_stats)
 DECLARE_UDF(recursive_partitioning, dt_apply)
 
 DECLARE_UDF(recursive_partitioning, compute_surr_stats_transition)
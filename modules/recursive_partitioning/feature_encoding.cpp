@@ -9,6 +9,7 @@
 
 #include <sstream>
 #include <algorithm>
+#include <cstring>
 #include <dbconnector/dbconnector.hpp>
 #include "feature_encoding.hpp"
 #include "ConSplits.hpp"
@@ -35,22 +36,25 @@ print_con_splits::run(AnyType &args){
 
 AnyType
 dst_compute_con_splits_transition::run(AnyType &args){
-    ConSplitsSample<MutableRootContainer> state = args[0].getAs<MutableByteString>();
-    if (!state.empty() && state.num_rows >= state.buff_size) {
-        return args[0];
-    }
+    ConSplitsSketch<MutableRootContainer> state = args[0].getAs<MutableByteString>();
     // NULL-handling is done in python to make sure consistency b/w
     // feature encoding and tree training
     MappedColumnVector con_features = args[1].getAs<MappedColumnVector>();
 
     if (state.empty()) {
-        uint32_t n_per_seg = args[2].getAs<uint32_t>();
+        uint32_t sketch_size = args[2].getAs<uint32_t>();
         uint16_t n_bins = args[3].getAs<uint16_t>();
+        if (sketch_size < 2) {
+            throw std::runtime_error("Decision tree error: Quantile sketch "
+                "size must be at least 2.");
+        }
 
         state.num_splits = static_cast<uint16_t>(n_bins - 1);
         state.num_features = static_cast<uint16_t>(con_features.size());
-        state.buff_size = n_per_seg;
+        state.num_levels = 1;
+        state.k = sketch_size;
         state.resize();
+        state.updateCapacities();
     }
 
     state << con_features;
@@ -59,9 +63,26 @@ dst_compute_con_splits_transition::run(AnyType &args){
 }
 // ------------------------------------------------------------
 
+AnyType
+dst_compute_con_splits_merge::run(AnyType &args){
+    ConSplitsSketch<MutableRootContainer> stateLeft =
+        args[0].getAs<MutableByteString>();
+    ConSplitsSketch<RootContainer> stateRight = args[1].getAs<ByteString>();
+
+    if (stateLeft.empty()) {
+        return stateRight.storage();
+    } else if (stateRight.empty()) {
+        return stateLeft.storage();
+    }
+
+    stateLeft << stateRight;
+    return stateLeft.storage();
+}
+// ------------------------------------------------------------
+
 AnyType
 dst_compute_con_splits_final::run(AnyType &args){
-    ConSplitsSample<RootContainer> state = args[0].getAs<ByteString>();
+    ConSplitsSketch<RootContainer> state = args[0].getAs<ByteString>();
     ConSplitsResult<MutableRootContainer> result =
             defaultAllocator().allocateByteString<
                 dbal::FunctionContext, dbal::DoZero, dbal::ThrowBadAlloc>(0);
@@ -78,17 +99,17 @@ dst_compute_con_splits_final::run(AnyType &args){
         throw std::runtime_error(error_msg.str());
     }
 
-    int bin_size = static_cast<int>(state.num_rows / (state.num_splits + 1));
+    // the j-th split is the value of rank bin_size * (j + 1), which is exact
+    // as long as the sketch has not been compacted
+    uint64_t bin_size = state.num_rows / (state.num_splits + 1);
+    ColumnVector ranks(state.num_splits);
+    for (Index j = 0; j < ranks.size(); j ++) {
+        ranks(j) = static_cast<double>(bin_size * (j + 1));
+    }
+    ColumnVector feature_i_splits;
     for (Index i = 0; i < state.num_features; i ++) {
-        // sorting the values for each feature
-        ColumnVector feature_i_sample = \
-                state.sample.row(i).segment(0, state.num_rows);
-        std::sort(feature_i_sample.data(),
-                  feature_i_sample.data() + feature_i_sample.size());
-        // binning
-        for (int j = 0; j < state.num_splits; j ++) {
-            result.con_splits(i, j) = feature_i_sample(bin_size * (j + 1) - 1);
-        }
+        state.quantiles(i, ranks, feature_i_splits);
+        result.con_splits.row(i) = trans(feature_i_splits);
     }
 
     return result.storage();
@@ -164,38 +185,159 @@ dst_compute_entropy_final::run(AnyType &args){
 }
 // ------------------------------------------------------------
 
-inline
-bool
-cmp_text(text* s1, text* s2) {
-    if (VARSIZE_ANY(s1) != VARSIZE_ANY(s2))
-        return false;
-    else {
-        return strncmp(VARDATA_ANY(s1), VARDATA_ANY(s2), VARSIZE_ANY(s1) - VARHDRSZ) == 0;
+/*
+    @brief Hash dictionary of the levels of all categorical features
+
+    The levels of all features are given as one text array, together with the
+    number of levels of each feature. Searching the levels for every value of
+    every row is slow for features with many levels, so the levels are hashed
+    once into an open-addressing table. The table is kept in the fn_extra cache
+    of the calling function, keyed by the level and count arguments as passed
+    in by the backend, and is only rebuilt if these change.
+*/
+struct CatLevelEntry {
+    uint64_t hash;
+    const char *data;
+    size_t size;
+    int feature;
+    int level;      // -1 for an empty slot
+};
+
+struct CatLevelDictionary {
+    RawDatumKey levels_key;
+    RawDatumKey counts_key;
+    CatLevelEntry *entries;
+    size_t mask;    // number of slots - 1
+    char *pool;     // copy of the level texts
+};
+
+static uint64_t
+catLevelHash(int feature, const char *data, size_t size) {
+    // FNV-1a, seeded with the feature index
+    uint64_t hash = 0xCBF29CE484222325ULL ^ static_cast<uint64_t>(feature);
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001B3ULL;
+    return hash;
+}
+
+static int
+lookupCatLevel(const CatLevelDictionary *dict, int feature, text *value) {
+    const char *data = VARDATA_ANY(value);
+    size_t size = VARSIZE_ANY_EXHDR(value);
+    uint64_t hash = catLevelHash(feature, data, size);
+    for (size_t slot = hash & dict->mask; dict->entries[slot].level >= 0;
+            slot = (slot + 1) & dict->mask) {
+        const CatLevelEntry &entry = dict->entries[slot];
+        if (entry.hash == hash && entry.feature == feature &&
+                entry.size == size && std::memcmp(entry.data, data, size) == 0)
+            return entry.level;
+    }
+    return -1;
+}
+
+static void
+buildCatLevelDictionary(AnyType &args, CatLevelDictionary *dict) {
+    ArrayHandle<text*> cat_levels = args[1].getAs<ArrayHandle<text*> >();
+    ArrayHandle<int> n_levels = args[2].getAs<ArrayHandle<int> >();
+
+    size_t n_total = 0;
+    for (size_t i = 0; i < n_levels.size(); i++) {
+        if (n_levels[i] < 0)
+            throw std::runtime_error("Decision tree error: Number of "
+                "categorical levels cannot be negative.");
+        n_total += static_cast<size_t>(n_levels[i]);
+    }
+    if (n_total > cat_levels.size())
+        throw std::runtime_error("Decision tree error: Inconsistent number "
+            "of categorical levels.");
+
+    size_t n_slots = 16;
+    while (n_slots < 2 * n_total)
+        n_slots *= 2;
+    size_t pool_size = 0;
+    for (size_t i = 0; i < n_total; i++)
+        pool_size += VARSIZE_ANY_EXHDR(cat_levels[i]);
+
+    if (dict->entries != NULL)
+        pfree(dict->entries);
+    dict->entries = NULL;
+    if (dict->pool != NULL)
+        pfree(dict->pool);
+    dict->pool = NULL;
+    dict->entries = static_cast<CatLevelEntry*>(MemoryContextAlloc(
+        args.getCacheMemoryContext(), n_slots * sizeof(CatLevelEntry)));
+    dict->pool = static_cast<char*>(MemoryContextAlloc(
+        args.getCacheMemoryContext(), std::max(pool_size, size_t(1))));
+    dict->mask = n_slots - 1;
+    for (size_t slot = 0; slot < n_slots; slot++)
+        dict->entries[slot].level = -1;
+
+    char *pool = dict->pool;
+    size_t pos = 0;
+    for (size_t i = 0; i < n_levels.size(); i++) {
+        int feature = static_cast<int>(i);
+        for (int j = 0; j < n_levels[i]; j++, pos++) {
+            text *level = cat_levels[pos];
+            // the first of duplicate levels is used
+            if (lookupCatLevel(dict, feature, level) >= 0)
+                continue;
+
+            size_t size = VARSIZE_ANY_EXHDR(level);
+            std::memcpy(pool, VARDATA_ANY(level), size);
+            uint64_t hash = catLevelHash(feature, pool, size);
+            size_t slot = hash & dict->mask;
+            while (dict->entries[slot].level >= 0)
+                slot = (slot + 1) & dict->mask;
+            CatLevelEntry &entry = dict->entries[slot];
+            entry.hash = hash;
+            entry.data = pool;
+            entry.size = size;
+            entry.feature = feature;
+            entry.level = j;
+            pool += size;
+        }
+    }
+}
+
+static const CatLevelDictionary*
+getCatLevelDictionary(AnyType &args) {
+    const void *levels_raw = args[1].getRawPointer();
+    const void *counts_raw = args[2].getRawPointer();
+
+    CatLevelDictionary *dict =
+        static_cast<CatLevelDictionary*>(args.getUserFuncContext());
+    if (dict == NULL) {
+        dict = static_cast<CatLevelDictionary*>(MemoryContextAllocZero(
+            args.getCacheMemoryContext(), sizeof(CatLevelDictionary)));
+        args.setUserFuncContext(dict);
     }
+    if (dict->levels_key.matches(levels_raw) &&
+            dict->counts_key.matches(counts_raw)) {
+        return dict;
+    }
+
+    // invalidate the cache until the new dictionary is complete
+    dict->levels_key.invalidate();
+    dict->counts_key.invalidate();
+    buildCatLevelDictionary(args, dict);
+    dict->levels_key.assign(args.getCacheMemoryContext(), levels_raw);
+    dict->counts_key.assign(args.getCacheMemoryContext(), counts_raw);
+    return dict;
 }
 // ------------------------------------------------------------
 
 AnyType
 map_catlevel_to_int::run(AnyType &args){
     ArrayHandle<text*> cat_values = args[0].getAs<ArrayHandle<text*> >();
-    ArrayHandle<text*> cat_levels = args[1].getAs<ArrayHandle<text*> >();
     ArrayHandle<int> n_levels = args[2].getAs<ArrayHandle<int> >();
+    const CatLevelDictionary *dict = getCatLevelDictionary(args);
 
     MutableArrayHandle<int> cat_int = allocateArray<int>(n_levels.size());
-    int pos = 0;
     for (size_t i = 0; i < n_levels.size(); i++) {
-        // linear search to find a match
-        int match = -1;  // if cat_values contains any not present in cat_levels,
-                         // then the mapped integer is -1. If cat_values contains
-                         // a known cat_level, then the mapped integer is
-                         // the index of that value in cat_levels
-        for (int j = 0; j < n_levels[i]; j++)
-            if (cmp_text(cat_values[i], cat_levels[pos + j])) {
-                match = j;
-                break;
-            }
-        cat_int[i] = match;
-        pos += static_cast<int>(n_levels[i]);
+        // if cat_values contains any not present in cat_levels, then the
+        // mapped integer is -1. If cat_values contains a known cat_level, then
+        // the mapped integer is the index of that value in cat_levels
+        cat_int[i] = lookupCatLevel(dict, static_cast<int>(i), cat_values[i]);
     }
     return cat_int;
 }
@@ -238,46 +380,8 @@ get_bin_index_by_value::run(AnyType &args) {
     // see TreeAccumulator::operator<<(const tuple_type&)
     // and dst_compute_con_splits_final::run(AnyType &)
     // each v_i covering ranges (-inf,v_0], ..., (v_{n-2}, v_{n-1}]
-    int result = -1;
-    int low = 0;
-    int high = static_cast<int>(con_splits_results.con_splits.cols()) - 1;
-    if (bin_value > con_splits_results.con_splits(feature_index, high)) {
-        // covering range (v_{n-1}, +inf)
-        result = high + 1;
-    }
-    while (low < high) {
-        int mid = (low + high) / 2;
-        if (bin_value <= con_splits_results.con_splits(feature_index, mid)) {
-            high = mid;
-        } else {
-            low = mid + 1;
-        }
-    }
-    result = high;
-
-#ifndef NDEBUG
-    // test code for binary search (mimic std::lower_bound())
-    if (low != high) {
-        dbout << "bin_value: " << bin_value
-            << "\ncon_splits_results.con_splits.row(feature_index): " << con_splits_results.con_splits.row(feature_index)
-            << "\nlow: " << low << ", high: " << high << std::endl;
-        throw std::runtime_error("low_bound() has bug!");
-    }
-
-    for (int i = 0; i < con_splits_results.con_splits.cols(); i ++) {
-        if (bin_value <= con_splits_results.con_splits(feature_index, i)) {
-            if (i != result) {
-                dbout << "bin_value: " << bin_value
-                    << "\ncon_splits_results.con_splits.row(feature_index): " << con_splits_results.con_splits.row(feature_index)
-                    << "\nresult: " << result << ", i: " << i << std::endl;
-                throw std::runtime_error("low_bound() has bug!");
-            }
-            return i;
-        }
-    }
-#endif
-
-    return result;
+    return static_cast<int>(conBinIndex(con_splits_results.con_splits,
+                                        feature_index, bin_value));
 }
 // --------------------------------------------------------------
 
@@ -298,31 +402,52 @@ get_bin_indices_by_values::run(AnyType &args) {
     // and dst_compute_con_splits_final::run(AnyType &)
     // each v_i covering ranges (-inf,v_0], ..., (v_{n-2}, v_{n-1}]
     for (Index i = 0; i < bin_values.size(); i ++) {
-        int low = 0;
-        int high = static_cast<int>(con_splits_results.con_splits.cols()) - 1;
         if (std::isnan(bin_values(i))) {
             // we return a -1 index is the value is NaN
             bin_indices(i) = -1;
-        } else if (bin_values(i) > con_splits_results.con_splits(i, high)) {
-            // covering range (v_{n-1}, +inf)
-            bin_indices(i) = high + 1;
         } else {
-            // binary search
-            while (low < high) {
-                int mid = (low + high) / 2;
-                if (bin_values(i) <= con_splits_results.con_splits(i, mid)) {
-                    high = mid;
-                } else {
-                    low = mid + 1;
-                }
-            }
-            bin_indices(i) = high;
+            bin_indices(i) = static_cast<int>(conBinIndex(
+                con_splits_results.con_splits, i, bin_values(i)));
         }
     }
 
     return bin_indices;
 }
 
+// ------------------------------------------------------------
+
+/**
+ * @brief Encode the continuous features of a row as bin indices
+ *
+ * See ConBinnedFeatures for the format. This is done once before training,
+ * so that the per-level scans neither read the feature values nor search
+ * the splits.
+ */
+AnyType
+dst_encode_con_features::run(AnyType &args) {
+    // Null-handling is done by declaring it as strict
+    MappedColumnVector con_features = args[0].getAs<MappedColumnVector>();
+    ConSplitsResult<RootContainer> con_splits_results = args[1].getAs<ByteString>();
+
+    const MappedMatrix &con_splits = con_splits_results.con_splits;
+    if (con_splits.cols() <= 0) { return Null(); }
+    if (con_features.size() != con_splits.rows()) {
+        throw std::runtime_error("Decision tree error: Inconsistent numbers "
+            "of continuous features.");
+    }
+
+    Index n_splits = con_splits.cols();
+    MutableByteString encoded = defaultAllocator().allocateByteString<
+        dbal::FunctionContext, dbal::DoNotZero, dbal::ThrowBadAlloc>(
+            con_features.size() * ConBinnedFeatures::width(n_splits));
+    for (Index i = 0; i < con_features.size(); i ++) {
+        Index bin = std::isnan(con_features(i)) ? -1 :
+            conBinIndex(con_splits, i, con_features(i));
+        ConBinnedFeatures::encode(encoded.ptr(), n_splits, i, bin);
+    }
+    return encoded;
+}
+
 } // namespace recursive_partitioning
 } // namespace modules
 } // namespace madlib
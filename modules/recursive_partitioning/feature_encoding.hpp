@@ -5,6 +5,7 @@
  *//* ----------------------------------------------------------------------- */
 
 DECLARE_UDF(recursive_partitioning, dst_compute_con_splits_transition)
+DECLARE_UDF(recursive_partitioning, dst_compute_con_splits_merge)
 DECLARE_UDF(recursive_partitioning, dst_compute_con_splits_final)
 
 DECLARE_UDF(recursive_partitioning, dst_compute_entropy_transition)
@@ -17,3 +18,4 @@ DECLARE_UDF(recursive_partitioning, print_con_splits)
 DECLARE_UDF(recursive_partitioning, get_bin_value_by_index)
 DECLARE_UDF(recursive_partitioning, get_bin_index_by_value)
 DECLARE_UDF(recursive_partitioning, get_bin_indices_by_values)
+DECLARE_UDF(recursive_partitioning, dst_encode_con_features)
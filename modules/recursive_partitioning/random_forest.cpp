@@ -13,6 +13,8 @@
 #include <string>
 #include <list>
 #include <iterator>
+#include <algorithm>
+#include <cmath>
 
 #include <dbconnector/dbconnector.hpp>
 #include <boost/random/discrete_distribution.hpp>
@@ -21,6 +23,7 @@
 #include "DT_proto.hpp"
 #include "DT_impl.hpp"
 #include "ConSplits.hpp"
+#include "CompiledTree.hpp"
 
 #include <math.h>       /* fabs */
 
@@ -40,6 +43,26 @@ namespace recursive_partitioning {
 
 typedef DecisionTree<RootContainer> Tree;
 
+/*
+ * Compiled forest kept in the fn_extra cache of the forest prediction
+ * functions. The buffer holds, in order: the byte offset of each compiled
+ * tree, one traversal cursor per tree, and the compiled trees themselves.
+ */
+struct CompiledForestCache {
+    RawDatumKey key;
+    CacheBuffer<char> buffer;
+    size_t n_trees;
+
+    size_t* offsets() const { return reinterpret_cast<size_t*>(buffer.ptr); }
+    Index* cursors() const {
+        return reinterpret_cast<Index*>(offsets() + n_trees);
+    }
+    const CompiledTree& tree(size_t i) const {
+        return *reinterpret_cast<const CompiledTree*>(
+            buffer.ptr + offsets()[i]);
+    }
+};
+
 /*
  * Permute each categorical variable and predict
  */
@@ -115,6 +138,196 @@ rf_cat_imp_score::run(AnyType &args) {
 }
 // ------------------------------------------------------------
 
+/*
+ * Compile the forest in args[0] (an array of serialized trees), reusing the
+ * cached compilation if the same forest was passed in before. The cache is
+ * keyed by the array argument before detoasting (see RawDatumKey), so a
+ * cache hit neither deconstructs the array nor touches the trees.
+ */
+static const CompiledForestCache&
+getCompiledForest(AnyType &args) {
+    CompiledForestCache *cache =
+        static_cast<CompiledForestCache*>(args.getUserFuncContext());
+    if (cache == NULL) {
+        cache = static_cast<CompiledForestCache*>(
+            MemoryContextAllocZero(args.getCacheMemoryContext(),
+                                   sizeof(CompiledForestCache)));
+        args.setUserFuncContext(cache);
+    }
+
+    const void *raw = args[0].getRawPointer();
+    if (cache->key.matches(raw))
+        return *cache;
+
+    cache->key.invalidate();
+    ArrayHandle<bytea*> trees = args[0].getAs<ArrayHandle<bytea*> >();
+    size_t n_trees = trees.size();
+    if (n_trees == 0)
+        throw std::invalid_argument("Random forest error: the forest is empty");
+
+    std::vector<size_t> tree_sizes(n_trees);
+    size_t required = 2 * n_trees * sizeof(size_t);
+    for (size_t i = 0; i < n_trees; i++) {
+        Tree dt = ByteString(trees[i]);
+        tree_sizes[i] = CompiledTree::storageSize(dt);
+        required += tree_sizes[i];
+    }
+    char *buffer = cache->buffer.reserve(args.getCacheMemoryContext(),
+                                         required);
+    cache->n_trees = n_trees;
+
+    size_t offset = 2 * n_trees * sizeof(size_t);
+    for (size_t i = 0; i < n_trees; i++) {
+        Tree dt = ByteString(trees[i]);
+        cache->offsets()[i] = offset;
+        CompiledTree::compile(buffer + offset, dt);
+        offset += tree_sizes[i];
+    }
+    cache->key.assign(args.getCacheMemoryContext(), raw);
+    return *cache;
+}
+// ------------------------------------------------------------
+
+/*
+ * Route a row through all trees of the forest. The trees are advanced
+ * one level at a time (breadth-first across the forest), so that the
+ * independent node loads of different trees can overlap. On return,
+ * cursors()[t] is the leaf reached in tree t.
+ */
+static void
+searchForest(const CompiledForestCache &forest,
+             const NativeIntegerVector &cat_features,
+             const NativeColumnVector &con_features) {
+    Index *cursors = forest.cursors();
+    std::fill(cursors, cursors + forest.n_trees, Index(0));
+    bool is_active = true;
+    while (is_active) {
+        is_active = false;
+        for (size_t t = 0; t < forest.n_trees; t++) {
+            const CompiledTree &tree = forest.tree(t);
+            if (!tree.isLeaf(cursors[t])) {
+                cursors[t] = tree.child(cursors[t], cat_features, con_features);
+                is_active = true;
+            }
+        }
+    }
+}
+// ------------------------------------------------------------
+
+/*
+ * Count the votes of each class across the forest
+ */
+static ColumnVector
+forestVotes(const CompiledForestCache &forest) {
+    ColumnVector votes = ColumnVector::Zero(forest.tree(0).predictionWidth());
+    for (size_t t = 0; t < forest.n_trees; t++) {
+        const CompiledTree &tree = forest.tree(t);
+        Index label = static_cast<Index>(
+            tree.response(tree.leafIndex(forest.cursors()[t])));
+        if (label >= votes.size())
+            throw std::runtime_error("Random forest error: trees in the "
+                                     "forest have different number of classes");
+        votes(label) += 1.;
+    }
+    return votes;
+}
+// ------------------------------------------------------------
+
+/*
+ * Return the forest prediction for a single row: the average response for
+ * regression, or the majority vote (lowest class index on ties) for
+ * classification.
+ */
+AnyType
+predict_rf_response::run(AnyType &args) {
+    if (args[0].isNull()) { return Null(); }
+    NativeIntegerVector cat_features;
+    NativeColumnVector con_features;
+    try {
+        if (args[1].isNull()){
+            cat_features.rebind(this->allocateArray<int>(0));
+        }
+        else {
+            NativeIntegerVector xx_cat = args[1].getAs<NativeIntegerVector>();
+            cat_features.rebind(xx_cat.memoryHandle(), xx_cat.size());
+        }
+        if (args[2].isNull()){
+            con_features.rebind(this->allocateArray<double>(0));
+        }
+        else {
+            NativeColumnVector xx_con = args[2].getAs<NativeColumnVector>();
+            con_features.rebind(xx_con.memoryHandle(), xx_con.size());
+        }
+    } catch (const ArrayWithNullException &e) {
+        return Null();
+    }
+
+    const CompiledForestCache *forest;
+    try {
+        forest = &getCompiledForest(args);
+    } catch (const ArrayWithNullException &e) {
+        return Null();
+    }
+    searchForest(*forest, cat_features, con_features);
+
+    if (forest->tree(0).isRegression()) {
+        double sum = 0.;
+        for (size_t t = 0; t < forest->n_trees; t++) {
+            const CompiledTree &tree = forest->tree(t);
+            sum += tree.response(tree.leafIndex(forest->cursors()[t]));
+        }
+        return sum / static_cast<double>(forest->n_trees);
+    }
+    Index max_label;
+    forestVotes(*forest).maxCoeff(&max_label);
+    return static_cast<double>(max_label);
+}
+// ------------------------------------------------------------
+
+/*
+ * Return the fraction of trees voting for each class for a single row
+ */
+AnyType
+predict_rf_prob::run(AnyType &args) {
+    if (args[0].isNull()) { return Null(); }
+    NativeIntegerVector cat_features;
+    NativeColumnVector con_features;
+    try {
+        if (args[1].isNull()){
+            cat_features.rebind(this->allocateArray<int>(0));
+        }
+        else {
+            NativeIntegerVector xx_cat = args[1].getAs<NativeIntegerVector>();
+            cat_features.rebind(xx_cat.memoryHandle(), xx_cat.size());
+        }
+        if (args[2].isNull()){
+            con_features.rebind(this->allocateArray<double>(0));
+        }
+        else {
+            NativeColumnVector xx_con = args[2].getAs<NativeColumnVector>();
+            con_features.rebind(xx_con.memoryHandle(), xx_con.size());
+        }
+    } catch (const ArrayWithNullException &e) {
+        return Null();
+    }
+
+    const CompiledForestCache *forest;
+    try {
+        forest = &getCompiledForest(args);
+    } catch (const ArrayWithNullException &e) {
+        return Null();
+    }
+    if (forest->tree(0).isRegression())
+        throw std::invalid_argument("Random forest error: probabilities "
+                                    "are only defined for classification");
+    searchForest(*forest, cat_features, con_features);
+
+    ColumnVector prob = forestVotes(*forest);
+    prob /= static_cast<double>(forest->n_trees);
+    return prob;
+}
+// ------------------------------------------------------------
+
 
 /*
  * Permute each continuous variable and predict
@@ -203,6 +416,66 @@ rf_con_imp_score::run(AnyType &args) {
 }
 // ------------------------------------------------------------
 
+/*
+ * Counter-based random numbers: the i-th uniform number of a key is a hash of
+ * (key, i), so the same number is drawn every time the key is seen, in any
+ * order and on any segment. The mixing function is the finalizer of
+ * SplitMix64.
+ */
+static uint64_t
+mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double
+counterUniform(uint64_t key, uint64_t counter) {
+    uint64_t z = mix64(key + (counter + 1) * 0x9E3779B97F4A7C15ULL);
+    return static_cast<double>(z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @brief Bootstrap count of a row in the sample of a tree
+ *
+ * Returns -1 if the row is not in the subsample of the tree (drawn with
+ * probability 1 - sample_ratio), and otherwise a Poisson(1) count, where 0
+ * means that the row is out-of-bag. The count only depends on (row key, tree
+ * id, seed), so that all levels of a tree see the same bootstrap sample
+ * without materializing it.
+ */
+AnyType
+rf_bootstrap_count::run(AnyType &args) {
+    const char *row_key = args[0].getAs<char*>();
+    uint64_t tree_id = static_cast<uint64_t>(args[1].getAs<int32_t>());
+    uint64_t seed = static_cast<uint64_t>(args[2].getAs<int64_t>());
+    double sample_ratio = args[3].getAs<double>();
+
+    // FNV-1a hash of the row key
+    uint64_t key = 0xCBF29CE484222325ULL;
+    for (const char *c = row_key; *c != '\0'; ++c) {
+        key = (key ^ static_cast<unsigned char>(*c)) * 0x100000001B3ULL;
+    }
+    key = mix64(key ^ mix64(seed)) ^ mix64(tree_id);
+
+    if (sample_ratio < 1. && counterUniform(key, 0) >= sample_ratio) {
+        return -1;
+    }
+
+    // Poisson(1) by inversion
+    double u = counterUniform(key, 1);
+    double p = std::exp(-1.);
+    double cdf = p;
+    int count = 0;
+    while (u > cdf && count < 64) {
+        count++;
+        p /= count;
+        cdf += p;
+    }
+    return count;
+}
+// ------------------------------------------------------------
+
 
 } // namespace recursive_partitioning
 } // namespace modules
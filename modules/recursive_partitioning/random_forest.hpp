@@ -7,3 +7,6 @@
 
 DECLARE_UDF(recursive_partitioning, rf_cat_imp_score)
 DECLARE_UDF(recursive_partitioning, rf_con_imp_score)
+DECLARE_UDF(recursive_partitioning, predict_rf_response)
+DECLARE_UDF(recursive_partitioning, predict_rf_prob)
+DECLARE_UDF(recursive_partitioning, rf_bootstrap_count)
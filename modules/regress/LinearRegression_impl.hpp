@@ -47,21 +47,32 @@ inline
 void
 LinearRegressionAccumulator<Container>::bind(ByteStream_type& inStream) {
     inStream
-        >> numRows >> widthOfX >> y_sum >> y_square_sum;
+        >> numRows >> widthOfX >> numBufferedRows >> y_sum >> y_square_sum
+        >> residual_square_sum;
     uint16_t actualWidthOfX = widthOfX.isNull()
         ? static_cast<uint16_t>(0)
         : static_cast<uint16_t>(widthOfX);
     inStream
-        >> X_transp_Y.rebind(actualWidthOfX)
-        >> X_transp_X.rebind(actualWidthOfX, actualWidthOfX);
+        >> Q_transp_Y.rebind(actualWidthOfX)
+        >> R.rebind(actualWidthOfX, actualWidthOfX)
+        >> X_buffer.rebind(BLOCK_SIZE, actualWidthOfX)
+        >> y_buffer.rebind(BLOCK_SIZE);
 }
 
 /**
  * @brief Update the accumulation state
  *
  * We update the number of rows \f$ n \f$, the partial
- * sums \f$ \sum_{i=1}^n y_i \f$ and \f$ \sum_{i=1}^n y_i^2 \f$, the matrix
- * \f$ X^T X \f$, and the vector \f$ X^T \boldsymbol y \f$.
+ * sums \f$ \sum_{i=1}^n y_i \f$ and \f$ \sum_{i=1}^n y_i^2 \f$, and the
+ * QR decomposition \f$ X = QR \f$ of the rows seen so far. Instead of
+ * \f$ X^T X \f$ and \f$ X^T \boldsymbol y \f$, the state keeps the triangular
+ * factor \f$ R \f$, the vector \f$ Q^T \boldsymbol y \f$, and the squared norm
+ * of the part of \f$ \boldsymbol y \f$ orthogonal to the column space of
+ * \f$ X \f$. Neither \f$ Q \f$ nor \f$ X \f$ is ever stored.
+ *
+ * Rows are not added to \f$ R \f$ one at a time. Instead, they are copied
+ * into \c X_buffer and \c y_buffer and eliminated together once the buffer is
+ * full. See flush().
  */
 template <class Container>
 inline
@@ -92,16 +103,98 @@ LinearRegressionAccumulator<Container>::operator<<(const tuple_type& inTuple) {
     numRows++;
     y_sum += y;
     y_square_sum += y * y;
-    X_transp_Y.noalias() += x * y;
 
-    // X^T X is symmetric, so it is sufficient to only fill a triangular part
-    // of the matrix
-    triangularView<Lower>(X_transp_X) += x * trans(x);
+    uint16_t k = static_cast<uint16_t>(numBufferedRows);
+    X_buffer.row(k) = x.transpose();
+    y_buffer(k) = y;
+    numBufferedRows++;
+    if (numBufferedRows == BLOCK_SIZE)
+        flush();
     return *this;
 }
 
+/**
+ * @brief Fold all buffered rows into \f$ R \f$ and \f$ Q^T \boldsymbol y \f$
+ *
+ * This is one step of the tall-skinny QR (TSQR) reduction: \f$ R \f$ is
+ * replaced by the triangular factor of \f$ R \f$ stacked on top of the
+ * buffered rows.
+ */
+template <class Container>
+inline
+void
+LinearRegressionAccumulator<Container>::flush() {
+    uint16_t k = static_cast<uint16_t>(numBufferedRows);
+    if (k == 0)
+        return;
+
+    eliminate(X_buffer, y_buffer, k);
+    numBufferedRows = 0;
+}
+
+/**
+ * @brief Eliminate the first rows of a block against \f$ R \f$
+ *
+ * For every column \f$ j \f$, one Householder reflection maps
+ * \f$ (R_{jj}, B_{1j}, \dots, B_{kj}) \f$ onto a multiple of the first unit
+ * vector and is applied to the remaining columns of \f$ R \f$ and of the
+ * block, and to \f$ Q^T \boldsymbol y \f$ and the right-hand side. Since
+ * \f$ R \f$ is triangular, the reflector only touches row \f$ j \f$ of
+ * \f$ R \f$, so the cost is the same \f$ O(k p^2) \f$ as that of a rank-k
+ * update of \f$ X^T X \f$. The part of the right-hand side that remains is
+ * orthogonal to the column space, and its squared norm is added to the
+ * residual sum of squares. Block and right-hand side are overwritten.
+ */
+template <class Container>
+template <class Block, class Rhs>
+inline
+void
+LinearRegressionAccumulator<Container>::eliminate(Block& ioBlock,
+    Rhs& ioRhs, uint16_t inNumRows) {
+
+    Index k = inNumRows;
+    Index p = static_cast<uint16_t>(widthOfX);
+    ColumnVector w(p);
+
+    for (Index j = 0; j < p; j++) {
+        double sigma = ioBlock.col(j).head(k).squaredNorm();
+        if (sigma == 0)
+            continue;
+
+        // Reflector H = I - tau * v v^T with v = (1, ioBlock(0:k, j) / scale)
+        double alpha = R(j, j);
+        double beta = std::sqrt(alpha * alpha + sigma);
+        if (alpha >= 0)
+            beta = -beta;
+        double tau = (beta - alpha) / beta;
+        ioBlock.col(j).head(k) /= alpha - beta;
+        R(j, j) = beta;
+
+        Index rest = p - j - 1;
+        if (rest > 0) {
+            w.head(rest) = R.row(j).tail(rest).transpose();
+            w.head(rest).noalias() += ioBlock.block(0, j + 1, k, rest)
+                .transpose() * ioBlock.col(j).head(k);
+            w.head(rest) *= tau;
+            R.row(j).tail(rest) -= w.head(rest).transpose();
+            ioBlock.block(0, j + 1, k, rest).noalias()
+                -= ioBlock.col(j).head(k) * w.head(rest).transpose();
+        }
+
+        double rhs = tau * (Q_transp_Y(j)
+            + dot(ioBlock.col(j).head(k), ioRhs.head(k)));
+        Q_transp_Y(j) -= rhs;
+        ioRhs.head(k) -= rhs * ioBlock.col(j).head(k);
+    }
+    residual_square_sum += ioRhs.head(k).squaredNorm();
+}
+
 /**
  * @brief Merge with another accumulation state
+ *
+ * The rows of the other \f$ R \f$ factor, with \f$ Q^T \boldsymbol y \f$ as
+ * right-hand side, are eliminated like a block of buffered rows, followed by
+ * the rows still buffered in the other state.
  */
 template <class Container>
 template <class OtherContainer>
@@ -120,11 +213,23 @@ LinearRegressionAccumulator<Container>::operator<<(
         throw std::runtime_error("Inconsistent numbers of independent "
             "variables.");
 
+    flush();
     numRows += inOther.numRows;
     y_sum += inOther.y_sum;
     y_square_sum += inOther.y_square_sum;
-    X_transp_Y.noalias() += inOther.X_transp_Y;
-    triangularView<Lower>(X_transp_X) += inOther.X_transp_X;
+    residual_square_sum += inOther.residual_square_sum;
+
+    // The other state is immutable, so its factor and pending rows are
+    // eliminated from copies rather than by flushing it
+    Matrix block = inOther.R;
+    ColumnVector rhs = inOther.Q_transp_Y;
+    eliminate(block, rhs, static_cast<uint16_t>(widthOfX));
+    uint16_t k = static_cast<uint16_t>(inOther.numBufferedRows);
+    if (k > 0) {
+        block = inOther.X_buffer.topRows(k);
+        rhs = inOther.y_buffer.head(k);
+        eliminate(block, rhs, k);
+    }
     return *this;
 }
 
@@ -150,9 +255,19 @@ LinearRegression::LinearRegression(
 /**
  * @brief Transform a linear-regression accumulation state into a result
  *
- * The result of the accumulation phase is \f$ X^T X \f$ and
- * \f$ X^T \boldsymbol y \f$. We first compute the pseudo-inverse, then the
- * regression coefficients, the model statistics, etc.
+ * The result of the accumulation phase is the triangular factor \f$ R \f$ of
+ * \f$ X = QR \f$ and \f$ Q^T \boldsymbol y \f$. The least-squares problem
+ * reduces to \f$ R \boldsymbol \beta = Q^T \boldsymbol y \f$, which we solve
+ * with the singular value decomposition \f$ R = U S V^T \f$. Singular values
+ * below \f$ p \cdot \epsilon \cdot s_{\max} \f$ are treated as zero,
+ * so that rank-deficient designs get the minimum-norm solution as before.
+ * Unlike with \f$ X^T X \f$, the condition number of \f$ X \f$ is not
+ * squared, so ill-conditioned designs keep about twice as many correct
+ * digits. We then compute \f$ (X^T X)^+ = V S^{+2} V^T \f$, the model
+ * statistics, etc.
+ *
+ * The state must have been flushed before, i.e., it must not contain any
+ * buffered rows.
  *
  * @sa For the mathematical description, see \ref grp_linreg.
  */
@@ -164,27 +279,51 @@ LinearRegression::compute(
 
     Allocator& allocator = defaultAllocator();
 
+    madlib_assert(inState.numBufferedRows == 0,
+        std::logic_error("Linear-regression state has not been flushed."));
+
     // The following checks were introduced with MADLIB-138. It still seems
     // useful to have clear error messages in case of infinite input values.
-    if (!dbal::eigen_integration::isfinite(inState.X_transp_X) ||
-            !dbal::eigen_integration::isfinite(inState.X_transp_Y))
+    if (!dbal::eigen_integration::isfinite(inState.R) ||
+            !dbal::eigen_integration::isfinite(inState.Q_transp_Y))
         throw std::domain_error("Design matrix is not finite.");
 
-    SymmetricPositiveDefiniteEigenDecomposition<Matrix> decomposition(
-        inState.X_transp_X, EigenvaluesOnly, ComputePseudoInverse);
-
-    // Precompute (X^T * X)^+
-    Matrix inverse_of_X_transp_X = decomposition.pseudoInverse();
-    conditionNo = decomposition.conditionNo();
+    Index p = static_cast<uint16_t>(inState.widthOfX);
+    Eigen::JacobiSVD<Matrix> svd(Matrix(inState.R),
+        Eigen::ComputeFullU | Eigen::ComputeFullV);
+    const ColumnVector& s = svd.singularValues();
+
+    // Condition number of X^T X, i.e., the square of that of R. The final
+    // function reports its square root.
+    double s_max = p > 0 ? s(0) : 0.;
+    double s_min = p > 0 ? s(p - 1) : 0.;
+    conditionNo = s_min > 0
+        ? (s_max / s_min) * (s_max / s_min)
+        : std::numeric_limits<double>::infinity();
+
+    // R is p x p, so its singular values are accurate to about
+    // p * eps * s_max, independently of the number of rows
+    double tolerance = static_cast<double>(p)
+        * std::numeric_limits<double>::epsilon() * s_max;
+    ColumnVector s_inv(p);
+    for (Index i = 0; i < p; i++)
+        s_inv(i) = s(i) > tolerance ? 1. / s(i) : 0.;
+
+    // Precompute (X^T * X)^+ = V * S^{+2} * V^T
+    Matrix V_s_inv = svd.matrixV() * s_inv.asDiagonal();
+    Matrix inverse_of_X_transp_X = V_s_inv * trans(V_s_inv);
 
     // Vector of coefficients: For efficiency reasons, we want to return this
     // by reference, so we need to bind to db memory
     coef.rebind(allocator.allocateArray<double>(inState.widthOfX));
-    coef.noalias() = inverse_of_X_transp_X * inState.X_transp_Y;
+    coef.noalias() = V_s_inv * (trans(svd.matrixU()) * inState.Q_transp_Y);
 
-    // explained sum of squares (regression sum of squares)
-    double ess = dot(inState.X_transp_Y, coef)
-        - (inState.y_sum * inState.y_sum / static_cast<double>(inState.numRows));
+    // residual sum of squares: the part of y orthogonal to the column space
+    // of X, plus the part of Q^T y not fitted by R * coef (which is nonzero
+    // only for rank-deficient designs)
+    ColumnVector fitted = inState.R * coef;
+    double rss = inState.residual_square_sum
+        + (inState.Q_transp_Y - fitted).squaredNorm();
 
     // total sum of squares
     double tss = inState.y_square_sum
@@ -196,24 +335,20 @@ LinearRegression::compute(
     // anticipate that numerical peculiarities might occur.
     if (tss < 0)
         tss = 0;
-    if (ess < 0)
-        ess = 0;
-    // Since we know tss with greater accuracy than ess, we do the following
-    // sanity adjustment to ess:
-    if (ess > tss)
-        ess = tss;
+    // Since we know tss with less accuracy than rss, we do the following
+    // sanity adjustment to rss:
+    if (rss > tss)
+        rss = tss;
+
+    // explained sum of squares (regression sum of squares)
+    // Proof: http://en.wikipedia.org/wiki/Sum_of_squares
+    double ess = tss - rss;
 
     // coefficient of determination
     // If tss == 0, then the regression perfectly fits the data, so the
     // coefficient of determination is 1.
     r2 = (tss == 0 ? 1 : ess / tss);
 
-    // In the case of linear regression:
-    // residual sum of squares (rss) = total sum of squares (tss) - explained
-    // sum of squares (ess)
-    // Proof: http://en.wikipedia.org/wiki/Sum_of_squares
-    double rss = tss - ess;
-
     // Variance is also called the mean square error
     double variance = rss / static_cast<double>(inState.numRows - inState.widthOfX);
 
@@ -292,12 +427,14 @@ template <class Container>
 inline
 void
 RobustLinearRegressionAccumulator<Container>::bind(ByteStream_type& inStream) {
-    inStream >> numRows >> widthOfX;
+    inStream >> numRows >> widthOfX >> numBufferedRows;
     uint16_t actualWidthOfX = widthOfX.isNull() ? static_cast<uint16_t>(0) : static_cast<uint16_t>(widthOfX);
     inStream
         >> ols_coef.rebind(actualWidthOfX)
         >> X_transp_X.rebind(actualWidthOfX, actualWidthOfX)
-        >> X_transp_r2_X.rebind(actualWidthOfX, actualWidthOfX);
+        >> X_transp_r2_X.rebind(actualWidthOfX, actualWidthOfX)
+        >> X_buffer.rebind(actualWidthOfX, BLOCK_SIZE)
+        >> rX_buffer.rebind(actualWidthOfX, BLOCK_SIZE);
 }
 
 /**
@@ -305,6 +442,9 @@ RobustLinearRegressionAccumulator<Container>::bind(ByteStream_type& inStream) {
  *
  * We update the number of rows \f$ n \f$, the matrix \f$ X^T X \f$,
  * and the matrix \f$ X^T diag(r_1^2, r_2^2 ... r_n^2 X \f$
+ *
+ * Both matrices are updated block-wise: we buffer \f$ x_i \f$ and
+ * \f$ r_i x_i \f$ and apply a rank-k update once the buffers are full.
  */
 template <class Container>
 inline
@@ -338,14 +478,38 @@ RobustLinearRegressionAccumulator<Container>::operator<<(const tuple_type& inTup
     numRows++;
     double r = y - trans(ols_coef)*x;
 
-    // The following matrices are symmetric, so it is sufficient to
-    // only fill a triangular part
-    triangularView<Lower>(X_transp_X) += x * trans(x);
-    triangularView<Lower>(X_transp_r2_X) += r * r * x * trans(x);
+    uint16_t k = static_cast<uint16_t>(numBufferedRows);
+    X_buffer.col(k) = x;
+    rX_buffer.col(k) = r * x;
+    numBufferedRows++;
+    if (numBufferedRows == BLOCK_SIZE)
+        flush();
 
     return *this;
 }
 
+/**
+ * @brief Fold all buffered rows into \f$ X^T X \f$ and
+ *     \f$ X^T diag(r_1^2, r_2^2 ... r_n^2) X \f$
+ *
+ * The following matrices are symmetric, so it is sufficient to only fill a
+ * triangular part.
+ */
+template <class Container>
+inline
+void
+RobustLinearRegressionAccumulator<Container>::flush() {
+    uint16_t k = static_cast<uint16_t>(numBufferedRows);
+    if (k == 0)
+        return;
+
+    X_transp_X.template selfadjointView<Eigen::Lower>().rankUpdate(
+        X_buffer.leftCols(k));
+    X_transp_r2_X.template selfadjointView<Eigen::Lower>().rankUpdate(
+        rX_buffer.leftCols(k));
+    numBufferedRows = 0;
+}
+
 /**
  * @brief Merge with another accumulation state
  */
@@ -356,9 +520,17 @@ RobustLinearRegressionAccumulator<Container>&
 RobustLinearRegressionAccumulator<Container>::operator<<(
     const RobustLinearRegressionAccumulator<OtherContainer>& inOther) {
 
+    flush();
     numRows += inOther.numRows;
     triangularView<Lower>(X_transp_X) += inOther.X_transp_X;
     triangularView<Lower>(X_transp_r2_X) += inOther.X_transp_r2_X;
+    uint16_t k = static_cast<uint16_t>(inOther.numBufferedRows);
+    if (k > 0) {
+        X_transp_X.template selfadjointView<Eigen::Lower>().rankUpdate(
+            inOther.X_buffer.leftCols(k));
+        X_transp_r2_X.template selfadjointView<Eigen::Lower>().rankUpdate(
+            inOther.rX_buffer.leftCols(k));
+    }
     return *this;
 }
 
@@ -398,6 +570,10 @@ RobustLinearRegression::compute(
 
     Allocator& allocator = defaultAllocator();
 
+    madlib_assert(inState.numBufferedRows == 0,
+        std::logic_error("Robust linear-regression state has not been "
+            "flushed."));
+
     // The following checks were introduced with MADLIB-138. It still seems
     // useful to have clear error messages in case of infinite input values.
     if (!dbal::eigen_integration::isfinite(inState.X_transp_X) ||
@@ -495,13 +671,14 @@ inline
 void
 HeteroLinearRegressionAccumulator<Container>::bind(ByteStream_type& inStream) {
     inStream
-        >> numRows >> widthOfX >> a_sum >> a_square_sum;
+        >> numRows >> widthOfX >> numBufferedRows >> a_sum >> a_square_sum;
     uint16_t actualWidthOfX = widthOfX.isNull()
         ? static_cast<uint16_t>(0)
         : static_cast<uint16_t>(widthOfX);
     inStream
         >> X_transp_A.rebind(actualWidthOfX)
-        >> X_transp_X.rebind(actualWidthOfX, actualWidthOfX);
+        >> X_transp_X.rebind(actualWidthOfX, actualWidthOfX)
+        >> X_buffer.rebind(actualWidthOfX, BLOCK_SIZE);
 }
 
 /**
@@ -547,12 +724,32 @@ HeteroLinearRegressionAccumulator<Container>::operator<<(const hetero_tuple_type
     a_square_sum += a*a;
     X_transp_A.noalias() += x * a;
 
-    // X^T X is symmetric, so it is sufficient to only fill a triangular part
-    // of the matrix
-    triangularView<Lower>(X_transp_X) += x * trans(x);
+    X_buffer.col(static_cast<uint16_t>(numBufferedRows)) = x;
+    numBufferedRows++;
+    if (numBufferedRows == BLOCK_SIZE)
+        flush();
     return *this;
 }
 
+/**
+ * @brief Fold all buffered rows into \f$ X^T X \f$
+ *
+ * \f$ X^T X \f$ is symmetric, so it is sufficient to only fill a triangular
+ * part of the matrix.
+ */
+template <class Container>
+inline
+void
+HeteroLinearRegressionAccumulator<Container>::flush() {
+    uint16_t k = static_cast<uint16_t>(numBufferedRows);
+    if (k == 0)
+        return;
+
+    X_transp_X.template selfadjointView<Eigen::Lower>().rankUpdate(
+        X_buffer.leftCols(k));
+    numBufferedRows = 0;
+}
+
 /**
  * @brief Merge with another accumulation state
  */
@@ -563,11 +760,16 @@ HeteroLinearRegressionAccumulator<Container>&
 HeteroLinearRegressionAccumulator<Container>::operator<<(
     const HeteroLinearRegressionAccumulator<OtherContainer>& inOther) {
 
+    flush();
     numRows += inOther.numRows;
     a_sum += inOther.a_sum;
     a_square_sum += inOther.a_square_sum;
     X_transp_A.noalias() += inOther.X_transp_A;
     triangularView<Lower>(X_transp_X) += inOther.X_transp_X;
+    if (inOther.numBufferedRows > 0)
+        X_transp_X.template selfadjointView<Eigen::Lower>().rankUpdate(
+            inOther.X_buffer.leftCols(
+                static_cast<uint16_t>(inOther.numBufferedRows)));
     return *this;
 }
 
@@ -605,6 +807,9 @@ HeteroLinearRegression&
 HeteroLinearRegression::compute(
     const HeteroLinearRegressionAccumulator<Container>& inState) {
 
+    madlib_assert(inState.numBufferedRows == 0,
+        std::logic_error("Heteroskedasticity state has not been flushed."));
+
     // The following checks were introduced with MADLIB-138. It still seems
     // useful to have clear error messages in case of infinite input values.
     if (!dbal::eigen_integration::isfinite(inState.X_transp_X) ||
@@ -25,6 +25,10 @@ public:
     MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
     typedef std::tuple<MappedColumnVector, double> tuple_type;
 
+    // Number of rows buffered before they are folded into the triangular
+    // factor R with one blocked Householder update
+    enum { BLOCK_SIZE = 32 };
+
     LinearRegressionAccumulator(Init_type& inInitialization);
     void bind(ByteStream_type& inStream);
     LinearRegressionAccumulator& operator<<(const tuple_type& inTuple);
@@ -32,13 +36,22 @@ public:
         const LinearRegressionAccumulator<OtherContainer>& inOther);
     template <class OtherContainer> LinearRegressionAccumulator& operator=(
         const LinearRegressionAccumulator<OtherContainer>& inOther);
+    void flush();
 
     uint64_type numRows;
     uint16_type widthOfX;
+    uint16_type numBufferedRows;
     double_type y_sum;
     double_type y_square_sum;
-    ColumnVector_type X_transp_Y;
-    Matrix_type X_transp_X;
+    double_type residual_square_sum;
+    ColumnVector_type Q_transp_Y;
+    Matrix_type R;
+    Matrix_type X_buffer;
+    ColumnVector_type y_buffer;
+
+private:
+    template <class Block, class Rhs> void eliminate(Block& ioBlock,
+        Rhs& ioRhs, uint16_t inNumRows);
 };
 
 class LinearRegression {
@@ -67,6 +80,8 @@ public:
     MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
     typedef std::tuple<MappedColumnVector, double, MappedColumnVector> tuple_type;
 
+    enum { BLOCK_SIZE = 32 };
+
     RobustLinearRegressionAccumulator(Init_type& inInitialization);
     void bind(ByteStream_type& inStream);
     RobustLinearRegressionAccumulator& operator<<(const tuple_type& inTuple);
@@ -74,12 +89,16 @@ public:
         const RobustLinearRegressionAccumulator<OtherContainer>& inOther);
     template <class OtherContainer> RobustLinearRegressionAccumulator& operator=(
         const RobustLinearRegressionAccumulator<OtherContainer>& inOther);
+    void flush();
 
     uint64_type numRows;
     uint16_type widthOfX;
+    uint16_type numBufferedRows;
     ColumnVector_type ols_coef;
     Matrix_type X_transp_X;
     Matrix_type X_transp_r2_X;
+    Matrix_type X_buffer;
+    Matrix_type rX_buffer;
 };
 
 class RobustLinearRegression {
@@ -107,6 +126,8 @@ class HeteroLinearRegressionAccumulator
 
     typedef std::tuple<MappedColumnVector, double, MappedColumnVector> hetero_tuple_type;
 
+    enum { BLOCK_SIZE = 32 };
+
     HeteroLinearRegressionAccumulator(Init_type& inInitialization);
     void bind(ByteStream_type& inStream);
 
@@ -115,13 +136,16 @@ class HeteroLinearRegressionAccumulator
         const HeteroLinearRegressionAccumulator<OtherContainer>& inOther);
     template <class OtherContainer> HeteroLinearRegressionAccumulator& operator=(
         const HeteroLinearRegressionAccumulator<OtherContainer>& inOther);
+    void flush();
 
     uint64_type numRows;
     uint16_type widthOfX;
+    uint16_type numBufferedRows;
     double_type a_sum;
     double_type a_square_sum;
     ColumnVector_type X_transp_A;
     Matrix_type X_transp_X;
+    Matrix_type X_buffer;
 };
 
 class HeteroLinearRegression
@@ -52,7 +52,7 @@ linregr_merge_states::run(AnyType& args) {
 
 AnyType
 linregr_final::run(AnyType& args) {
-    LinRegrState state = args[0].getAs<ByteString>();
+    MutableLinRegrState state = args[0].getAs<MutableByteString>();
 
     // If we haven't seen any data, just return Null. This is the standard
     // behavior of aggregate function on empty data sets (compare, e.g.,
@@ -60,6 +60,10 @@ linregr_final::run(AnyType& args) {
     if (state.numRows == 0)
         return Null();
 
+    // Fold the rows still buffered in the state into the factor R. This
+    // does not change the value of the state, so it is safe to do in place.
+    state.flush();
+
     AnyType tuple;
     LinearRegression result(state);
     tuple << result.coef
@@ -118,7 +122,7 @@ robust_linregr_merge_states::run(AnyType& args) {
 
 AnyType
 robust_linregr_final::run(AnyType& args) {
-    RobustLinRegrState state = args[0].getAs<ByteString>();
+    MutableRobustLinRegrState state = args[0].getAs<MutableByteString>();
 
     // If we haven't seen any data, just return Null. This is the standard
     // behavior of aggregate function on empty data sets (compare, e.g.,
@@ -126,6 +130,10 @@ robust_linregr_final::run(AnyType& args) {
     if (state.numRows == 0)
         return Null();
 
+    // Fold the rows still buffered in the state into the Gram matrices. This
+    // does not change the value of the state, so it is safe to do in place.
+    state.flush();
+
     AnyType tuple;
     RobustLinearRegression result(state);
 
@@ -187,7 +195,7 @@ hetero_linregr_merge_states::run(AnyType& args) {
 
 AnyType
 hetero_linregr_final::run(AnyType& args) {
-    HeteroLinRegrState state = args[0].getAs<ByteString>();
+    MutableHeteroLinRegrState state = args[0].getAs<MutableByteString>();
 
     // If we haven't seen any data, just return Null. This is the standard
     // behavior of aggregate function on empty data sets (compare, e.g.,
@@ -195,6 +203,10 @@ hetero_linregr_final::run(AnyType& args) {
     if (state.numRows == 0)
         return Null();
 
+    // Fold the rows still buffered in the state into the Gram matrices. This
+    // does not change the value of the state, so it is safe to do in place.
+    state.flush();
+
     AnyType tuple;
     HeteroLinearRegression result(state);
 
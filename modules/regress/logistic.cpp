@@ -4,13 +4,15 @@
  *
  * @brief Logistic-Regression functions
  *
- * We implement the conjugate-gradient method and the iteratively-reweighted-
- * least-squares method.
+ * We implement the conjugate-gradient method, the iteratively-reweighted-
+ * least-squares method, the incremental-gradient method, and the
+ * limited-memory BFGS method.
  *
  *//* ----------------------------------------------------------------------- */
 #include <limits>
 #include <dbconnector/dbconnector.hpp>
 #include <modules/shared/HandleTraits.hpp>
+#include <modules/shared/LBFGS.hpp>
 #include <modules/prob/boost.hpp>
 #include <boost/math/distributions.hpp>
 #include <modules/prob/student.hpp>
@@ -1019,6 +1021,347 @@ internal_logregr_igd_result::run(AnyType &args) {
                          state.status, state.numRows);
 }
 
+/**
+ * @brief Inter- and intra-iteration state for limited-memory BFGS method for
+ *        logistic regression
+ *
+ * Unlike the IRLS and conjugate-gradient states, this state does not contain
+ * a widthOfX x widthOfX matrix: besides the gradient, the optimizer only keeps
+ * the last LBFGS_NUM_CORRECTIONS correction pairs, so the state size is
+ * linear in the number of independent variables.
+ *
+ * Note: We assume that the DOUBLE PRECISION array is initialized by the
+ * database with length at least 65, and all elemenets are 0.
+ */
+template <class Handle>
+class LogRegrLBFGSTransitionState {
+    template <class OtherHandle>
+    friend class LogRegrLBFGSTransitionState;
+
+  public:
+    LogRegrLBFGSTransitionState(const AnyType &inArray)
+        : mStorage(inArray.getAs<Handle>()) {
+
+        rebind(static_cast<uint16_t>(mStorage[1]));
+    }
+
+    /**
+     * @brief Convert to backend representation
+     *
+     * We define this function so that we can use State in the
+     * argument list and as a return type.
+     */
+    inline operator AnyType() const {
+        return mStorage;
+    }
+
+    /**
+     * @brief Initialize the limited-memory BFGS state.
+     *
+     * This function is only called for the first iteration, for the first row.
+     */
+    inline void initialize(const Allocator &inAllocator, uint16_t inWidthOfX) {
+        mStorage = inAllocator.allocateArray<double, dbal::AggregateContext,
+                                             dbal::DoZero, dbal::ThrowBadAlloc>(arraySize(inWidthOfX));
+        rebind(inWidthOfX);
+        widthOfX = inWidthOfX;
+        diag.fill(1);
+    }
+
+    /**
+     * @brief We need to support assigning the previous state
+     */
+    template <class OtherHandle>
+    LogRegrLBFGSTransitionState &operator=(
+        const LogRegrLBFGSTransitionState<OtherHandle> &inOtherState) {
+
+        for (size_t i = 0; i < mStorage.size(); i++)
+            mStorage[i] = inOtherState.mStorage[i];
+        return *this;
+    }
+
+    /**
+     * @brief Merge with another State object by copying the intra-iteration
+     *     fields
+     */
+    template <class OtherHandle>
+    LogRegrLBFGSTransitionState &operator+=(
+        const LogRegrLBFGSTransitionState<OtherHandle> &inOtherState) {
+
+        if (mStorage.size() != inOtherState.mStorage.size() ||
+            widthOfX != inOtherState.widthOfX)
+            throw std::logic_error("Internal error: Incompatible transition "
+                                   "states");
+
+        numRows += inOtherState.numRows;
+        grad += inOtherState.grad;
+        logLikelihood += inOtherState.logLikelihood;
+        // merged state should have the higher status
+        // (see top of file for more on 'status' )
+        status = (inOtherState.status > status) ? inOtherState.status : status;
+        return *this;
+    }
+
+    /**
+     * @brief Reset the inter-iteration fields.
+     */
+    inline void reset() {
+        numRows = 0;
+        grad.fill(0);
+        logLikelihood = 0;
+        status = IN_PROCESS;
+    }
+
+    // The number of corrections used in the LBFGS update
+    static const uint32_t LBFGS_NUM_CORRECTIONS = 7;
+
+  private:
+    static inline uint32_t arraySize(const uint16_t inWidthOfX) {
+        return 51 + 3 * inWidthOfX
+            + LBFGS::workspaceSize(inWidthOfX, LBFGS_NUM_CORRECTIONS);
+    }
+
+    /**
+     * @brief Rebind to a new storage array
+     *
+     * @param inWidthOfX The number of independent variables.
+     *
+     * Array layout (iteration refers to one aggregate-function call):
+     * Inter-iteration components (updated in final function):
+     * - 0: iteration (current iteration)
+     * - 1: widthOfX (number of coefficients)
+     * - 2: coef (vector of coefficients)
+     * - 2 + widthOfX: diag (diagonal of the initial inverse Hessian)
+     * - 2 + 2 * widthOfX: ws (LBFGS work vector, W elements)
+     * - 2 + 2 * widthOfX + W: lbfgs_state (scalars of the LBFGS iteration)
+     * - 23 + 2 * widthOfX + W: mcsrch_state (scalars of the line search)
+     *
+     * Intra-iteration components (updated in transition step):
+     * - 48 + 2 * widthOfX + W: numRows (number of rows already processed in
+     *   this iteration)
+     * - 49 + 2 * widthOfX + W: grad (gradient of -ln(l(c)))
+     * - 49 + 3 * widthOfX + W: logLikelihood ( ln(l(c)) )
+     * - 50 + 3 * widthOfX + W: status
+     */
+    void rebind(uint16_t inWidthOfX) {
+        uint32_t W = LBFGS::workspaceSize(inWidthOfX, LBFGS_NUM_CORRECTIONS);
+        uint32_t n = inWidthOfX;
+
+        iteration.rebind(&mStorage[0]);
+        widthOfX.rebind(&mStorage[1]);
+        coef.rebind(&mStorage[2], n);
+        diag.rebind(&mStorage[2 + n], n);
+        ws.rebind(&mStorage[2 + 2 * n], W);
+        lbfgs_state.rebind(&mStorage[2 + 2 * n + W], LBFGS::LBFGS_STATE_SIZE);
+        mcsrch_state.rebind(&mStorage[23 + 2 * n + W], LBFGS::MCSRCH_STATE_SIZE);
+        numRows.rebind(&mStorage[48 + 2 * n + W]);
+        grad.rebind(&mStorage[49 + 2 * n + W], n);
+        logLikelihood.rebind(&mStorage[49 + 3 * n + W]);
+        status.rebind(&mStorage[50 + 3 * n + W]);
+    }
+
+    Handle mStorage;
+
+  public:
+    typename HandleTraits<Handle>::ReferenceToUInt32 iteration;
+    typename HandleTraits<Handle>::ReferenceToUInt16 widthOfX;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap coef;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap diag;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap ws;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap lbfgs_state;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap mcsrch_state;
+
+    typename HandleTraits<Handle>::ReferenceToUInt64 numRows;
+    typename HandleTraits<Handle>::ColumnVectorTransparentHandleMap grad;
+    typename HandleTraits<Handle>::ReferenceToDouble logLikelihood;
+    typename HandleTraits<Handle>::ReferenceToUInt16 status;
+};
+
+/**
+ * @brief Perform the logistic-regression transition step
+ *
+ * Only the log-likelihood and its gradient are accumulated.
+ */
+AnyType
+logregr_lbfgs_step_transition::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<MutableArrayHandle<double> > state = args[0];
+    if (args[1].isNull() || args[2].isNull()) { return args[0]; }
+    double y = args[1].getAs<bool>() ? 1. : -1.;
+    MappedColumnVector x;
+    try {
+        // an exception is raised in the backend if args[2] contains nulls
+        MappedColumnVector xx = args[2].getAs<MappedColumnVector>();
+        // x is a const reference, we can only rebind to change its pointer
+        x.rebind(xx.memoryHandle(), xx.size());
+    } catch (const ArrayWithNullException &e) {
+        return args[0];
+    }
+
+    // The following check was added with MADLIB-138.
+    if (!x.is_finite()){
+        warning("Design matrix is not finite.");
+        state.status = TERMINATED;
+        return state;
+    }
+
+    if (state.numRows == 0) {
+        if (x.size() > std::numeric_limits<uint16_t>::max()){
+            warning("Number of independent variables cannot be larger than 65535.");
+            state.status = TERMINATED;
+            return state;
+        }
+
+        state.initialize(*this, static_cast<uint16_t>(x.size()));
+        if (!args[3].isNull()) {
+            LogRegrLBFGSTransitionState<ArrayHandle<double> > previousState = args[3];
+
+            state = previousState;
+            state.reset();
+            // a converged optimizer stays converged (see the final step)
+            if (previousState.status == COMPLETED)
+                state.status = COMPLETED;
+        }
+    }
+
+    // Now do the transition step
+    state.numRows++;
+
+    // xc = x^T_i c
+    double xc = dot(x, state.coef);
+
+    // The optimizer minimizes -l(c), whose gradient is
+    //   -sum_i sigma(-y_i x_i c) y_i x_i
+    state.grad.noalias() -= sigma(-y * xc) * y * x;
+
+    //          n
+    //         --
+    // l(c) = -\  ln(1 + exp(-y_i * c^T x_i))
+    //         /_
+    //         i=1
+    state.logLikelihood -= std::log( 1. + std::exp(-y * xc) );
+    return state;
+}
+
+/**
+ * @brief Perform the perliminary aggregation function: Merge transition states
+ */
+AnyType
+logregr_lbfgs_step_merge_states::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<MutableArrayHandle<double> > stateLeft = args[0];
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > stateRight = args[1];
+
+    // We first handle the trivial case where this function is called with one
+    // of the states being the initial state
+    if (stateLeft.numRows == 0)
+        return stateRight;
+    else if (stateRight.numRows == 0)
+        return stateLeft;
+
+    // Merge states together and return
+    stateLeft += stateRight;
+    return stateLeft;
+}
+
+/**
+ * @brief Perform the logistic-regression final step
+ *
+ * Each iteration evaluates the objective at one point. The LBFGS step either
+ * moves the coefficients to the next point of its line search, or sets the
+ * status to COMPLETED once the gradient has become small enough. A COMPLETED
+ * state is returned unchanged, so that iterating past convergence does not
+ * restart the optimizer.
+ */
+AnyType
+logregr_lbfgs_step_final::run(AnyType &args) {
+    // We request a mutable object. Depending on the backend, this might perform
+    // a deep copy.
+    LogRegrLBFGSTransitionState<MutableArrayHandle<double> > state = args[0];
+
+    // Aggregates that haven't seen any data just return Null.
+    if (state.numRows == 0){
+        state.status = NULL_EMPTY;
+        return state;
+    }
+
+    if (state.status == COMPLETED)
+        return state;
+
+    if (!std::isfinite(static_cast<double>(state.logLikelihood)) ||
+            !state.grad.is_finite()) {
+        warning("Over- or underflow in intermediate calulation. Input data is "
+              "likely of poor numerical condition.");
+        state.status = TERMINATED;
+        return state;
+    }
+
+    double eps = 1e-5;      // accuracy of the solution to be found
+    double xtol = 1.0e-16;  // an estimate of the machine precision
+
+    LBFGS instance(state);
+    instance.lbfgs(state.widthOfX, state.LBFGS_NUM_CORRECTIONS,
+                   -static_cast<double>(state.logLikelihood), state.grad,
+                   eps, xtol);
+    instance.save_state(state);
+
+    if (instance.iflag < 0 || !state.coef.is_finite()) {
+        warning("Over- or underflow in L-BFGS step, while updating "
+              "coefficients. Input data is likely of poor numerical condition.");
+        state.status = TERMINATED;
+        return state;
+    }
+    if (instance.iflag == 0)
+        state.status = COMPLETED;
+
+    state.iteration++;
+    return state;
+}
+
+/**
+ * @brief Return the difference in log-likelihood between two states, 0 once
+ *     the optimizer has converged
+ */
+AnyType
+internal_logregr_lbfgs_step_distance::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > stateLeft = args[0];
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > stateRight = args[1];
+
+    if(stateLeft.status == NULL_EMPTY || stateRight.status == NULL_EMPTY){
+        return 0.0;
+    }
+    if (stateRight.status == COMPLETED)
+        return 0.0;
+
+    return std::abs(stateLeft.logLikelihood - stateRight.logLikelihood);
+}
+
+/**
+ * @brief Return the coefficients and diagnostic statistics of the state
+ *
+ * The state does not contain the Hessian, so the statistics that depend on
+ * its inverse (standard errors, Wald statistics, variance-covariance matrix
+ * and condition number) are NULL.
+ */
+AnyType
+internal_logregr_lbfgs_result::run(AnyType &args) {
+    LogRegrLBFGSTransitionState<ArrayHandle<double> > state = args[0];
+
+    if (state.status == NULL_EMPTY)
+        return Null();
+
+    MutableNativeColumnVector oddsRatios(
+        allocateArray<double>(state.coef.size()));
+    for (Index i = 0; i < state.coef.size(); ++i)
+        oddsRatios(i) = std::exp(state.coef(i));
+
+    AnyType tuple;
+    tuple << state.coef << static_cast<double>(state.logLikelihood)
+          << Null() << Null() << Null()
+          << oddsRatios << Null() << Null()
+          << static_cast<int>(state.status)
+          << static_cast<uint64_t>(state.numRows);
+    return tuple;
+}
+
 /**
  * @brief Compute the diagnostic statistics
  *
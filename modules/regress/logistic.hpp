@@ -90,6 +90,33 @@ DECLARE_UDF(regress, internal_logregr_igd_step_distance)
  */
 DECLARE_UDF(regress, internal_logregr_igd_result)
 
+/**
+ * @brief Logistic regression (limited-memory BFGS step): Transition function
+ */
+DECLARE_UDF(regress, logregr_lbfgs_step_transition)
+
+/**
+ * @brief Logistic regression (limited-memory BFGS step): State merge function
+ */
+DECLARE_UDF(regress, logregr_lbfgs_step_merge_states)
+
+/**
+ * @brief Logistic regression (limited-memory BFGS step): Final function
+ */
+DECLARE_UDF(regress, logregr_lbfgs_step_final)
+
+/**
+ * @brief Logistic regression (limited-memory BFGS step): Difference in
+ *     log-likelihood between two transition states
+ */
+DECLARE_UDF(regress, internal_logregr_lbfgs_step_distance)
+
+/**
+ * @brief Logistic regression (limited-memory BFGS step):
+ *     Convert transition state to result tuple
+ */
+DECLARE_UDF(regress, internal_logregr_lbfgs_result)
+
 /**
  * @brief Robust Variance Logistic regression step: Transition function
  */
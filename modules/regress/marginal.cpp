@@ -903,15 +903,15 @@ margins_mlogregr_int_transition::run(AnyType &args) {
     const uint16_t M = static_cast<uint16_t>(basis_indices.size());
     assert(N >= M);
 
-    Matrix J;  // J: N x M
-    if (args[5].isNull()){
-        J = Matrix::Zero(N, M);
-        for (Index i = 0; i < M; ++i)
-            J(static_cast<Index>(basis_indices(i)), i) = 1;
-    } else{
-        J = args[5].getAs<MappedMatrix>();
+    // J: N x M. Without interaction terms, J is the selection matrix of the
+    // basis indices, J(basis_indices(m), m) = 1, which is never formed.
+    MappedMatrix J;
+    bool has_J = !args[5].isNull();
+    if (has_J) {
+        MappedMatrix JJ = args[5].getAs<MappedMatrix>();
+        J.rebind(JJ.memoryHandle(), JJ.rows(), JJ.cols());
+        assert(J.rows() == N && J.cols() == M);
     }
-    assert(J.rows() == N && J.cols() == M);
 
     MappedColumnVector categorical_indices;
     uint16_t numCategoricalVars = 0;
@@ -952,9 +952,9 @@ margins_mlogregr_int_transition::run(AnyType &args) {
             state.numCategoricalVarsInSubset = static_cast<uint16_t>(tmp_cat_basis_indices.size());
         }
         state.initialize(*this,
-                         static_cast<uint16_t>(J.rows()),
+                         N,
                          static_cast<uint16_t>(beta.cols() + 1),
-                         static_cast<uint16_t>(J.cols()),
+                         M,
                          static_cast<uint16_t>(state.numCategoricalVarsInSubset));
 
         Matrix training_data_vcov = args[3].getAs<MappedMatrix>();
@@ -971,7 +971,13 @@ margins_mlogregr_int_transition::run(AnyType &args) {
     // all variable symbols correspond to the design document
     const uint16_t & L = state.numCategories;
     ColumnVector prob(trans(beta) * f);
-    Matrix J_trans_beta(trans(J) * beta);
+    Matrix J_trans_beta(M, L - 1);
+    if (has_J) {
+        J_trans_beta.noalias() = trans(J) * beta;
+    } else {
+        for (Index m = 0; m < M; ++m)
+            J_trans_beta.row(m) = beta.row(static_cast<Index>(basis_indices(m)));
+    }
 
     // Calculate the odds ratio
     prob = prob.array().exp();
@@ -986,8 +992,18 @@ margins_mlogregr_int_transition::run(AnyType &args) {
     //      row_index = [0, (L-1)M), col_index = [0, (L-1)N)
     // row_index(m, l) = m * (L-1) + l
     // col_index(n, l1) = n * (L-1) + l1
+    //
+    // For a fixed (m, n), the (L-1) x (L-1) block of delta is
+    //      f(n) * A_m + J(n, m) * B, where
+    //      A_m(l, l1) = (delta_l_l1 - prob(l1)) * margins(m, l)
+    //                   - prob(l) * margins(m, l1)
+    //      B(l, l1) = prob(l) * (delta_l_l1 - prob(l1))
+    // so we only form A_m and B and add scaled copies of them.
     Index row_index, col_index;
-    int delta_l_l1;
+    Matrix B = - prob * trans(prob);
+    B.diagonal() += prob;
+    Matrix A(L - 1, L - 1);
+    ColumnVector margins_m(L - 1);
     for (int m = 0; m < M; m++){
         // Skip the categorical variables
         if (state.numCategoricalVarsInSubset > 0) {
@@ -1001,19 +1017,18 @@ margins_mlogregr_int_transition::run(AnyType &args) {
                 continue;
         }
 
-        for (int l=0; l < (L-1); l++){
-            row_index = reindex(m, l, L-1);
-            for (int n=0; n < N; n++){
-                for (int l1=0; l1 < (L-1); l1++){
-                    delta_l_l1 = (l==l1) ? 1 : 0;
-                    col_index = reindex(n, l1, L-1);
-                    state.delta(row_index, col_index) +=
-                        f(n)*(delta_l_l1 - prob(l1)) * curr_margins(m, l) +
-                        prob(l) * (delta_l_l1 * J(n, m) -
-                                   f(n) * curr_margins(m, l1) -
-                                   prob(l1) * J(n, m));
-                }
-            }
+        margins_m = trans(curr_margins.row(m));
+        A = - margins_m * trans(prob) - prob * trans(margins_m);
+        A.diagonal() += margins_m;
+        row_index = reindex(m, 0, L-1);
+        for (int n = 0; n < N; n++){
+            double J_nm = has_J ? J(n, m) :
+                (static_cast<Index>(basis_indices(m)) == n ? 1. : 0.);
+            col_index = reindex(n, 0, L-1);
+            if (f(n) != 0)
+                state.delta.block(row_index, col_index, L-1, L-1) += f(n) * A;
+            if (J_nm != 0)
+                state.delta.block(row_index, col_index, L-1, L-1) += J_nm * B;
         }
     }
 
@@ -1074,19 +1089,19 @@ margins_mlogregr_int_transition::run(AnyType &args) {
         // Compute the marginal effect using difference method
         curr_margins.row(static_cast<uint16_t>(state.categorical_basis_indices(i))) = p_set - p_unset;
 
-        // Compute the delta using difference method
+        // Compute the delta using difference method. As above, the block of
+        // (m, n) is f_set(n) * B_set - f_unset(n) * B_unset, where
+        // B(l, l1) = p(l) * (delta_l_l1 - p(l1)).
         int m = static_cast<uint16_t>(state.categorical_basis_indices(i));
-        for (int l = 0; l < L - 1; l++) {
-            row_index = reindex(m, l, L - 1);
-            for (int n = 0; n < N; n++) {
-                for (int l1 = 0; l1 < L - 1; l1++) {
-                    double delta = - p_set(l) * p_set(l1) * f_set(n) + p_unset(l) * p_unset(l1) * f_unset(n);
-                    if (l1 == l)
-                        delta += p_set(l) * f_set(n) - p_unset(l) * f_unset(n);
-                    col_index = reindex(n, l1, L - 1);
-                    state.delta(row_index, col_index) += delta;
-                }
-            }
+        Matrix B_set = - trans(p_set) * p_set;
+        B_set.diagonal() += trans(p_set);
+        Matrix B_unset = - trans(p_unset) * p_unset;
+        B_unset.diagonal() += trans(p_unset);
+        row_index = reindex(m, 0, L - 1);
+        for (int n = 0; n < N; n++) {
+            col_index = reindex(n, 0, L - 1);
+            state.delta.block(row_index, col_index, L - 1, L - 1) +=
+                f_set(n) * B_set - f_unset(n) * B_unset;
         }
 
     }
@@ -325,6 +325,74 @@ public:
     typename HandleTraits<Handle>::MatrixTransparentHandleMap meat;
 };
 
+/**
+ * @brief Scratch space of the transition functions
+ *
+ * The buffer is kept in fn_extra, so that processing a row does not
+ * allocate any memory.
+ */
+static double*
+getScratch(AnyType &args, size_t inSize) {
+    CacheBuffer<double> *scratch =
+        static_cast<CacheBuffer<double>*>(args.getUserFuncContext());
+    if (scratch == NULL) {
+        scratch = static_cast<CacheBuffer<double>*>(MemoryContextAllocZero(
+            args.getCacheMemoryContext(), sizeof(CacheBuffer<double>)));
+        args.setUserFuncContext(scratch);
+    }
+    return scratch->reserve(args.getCacheMemoryContext(), inSize);
+}
+
+/**
+ * @brief Compute the category probabilities (the 'pi' vector in the
+ *     documentation) of a row
+ *
+ * @param inCoef Coefficients, with numCategories rows and widthOfX columns
+ * @param outT1 coef * x, reused for the log-likelihood
+ * @return 1 + sum(exp(coef * x)), reused for the log-likelihood
+ */
+template <class CoefType>
+static double
+computePi(const CoefType &inCoef, const MappedColumnVector &inX,
+    Eigen::Map<ColumnVector> &outT1, Eigen::Map<ColumnVector> &outPi) {
+
+    outT1.noalias() = inCoef * inX;
+    outPi = outT1.array().exp();
+    double t3 = 1 + outPi.sum();
+    outPi /= t3;
+    return t3;
+}
+
+/**
+ * @brief Add the Hessian contribution of a row to the lower triangle of
+ *     X^T A X
+ *
+ * Block (i1, i2) of the contribution is x(i1) * x(i2) * a, where
+ * a = pi * pi^T - diag(pi), i.e., the contribution is (x x^T) kron a. With
+ * v = x kron pi (= vec(pi x^T)), this equals v v^T - (x x^T) kron diag(pi):
+ * a symmetric rank-1 update followed by a correction of the diagonals of
+ * the blocks. The Kronecker product itself is never formed.
+ */
+template <class HessianType>
+static void
+accumulateHessian(HessianType &ioHessian, const MappedColumnVector &inX,
+    const Eigen::Map<ColumnVector> &inPi, Eigen::Map<ColumnVector> &ioV) {
+
+    const Index J = inPi.size();
+    const Index p = inX.size();
+
+    Eigen::Map<Matrix>(ioV.data(), J, p).noalias() = inPi * trans(inX);
+    ioHessian.template selfadjointView<Eigen::Lower>().rankUpdate(ioV);
+    for (Index i2 = 0; i2 < p; i2++) {
+        if (inX(i2) == 0)
+            continue;
+        for (Index i1 = i2; i1 < p; i1++) {
+            ioHessian.block(J * i1, J * i2, J, J).diagonal() -=
+                (inX(i1) * inX(i2)) * inPi;
+        }
+    }
+}
+
 /**
  * @brief IRLS Transition
  * @param args
@@ -410,80 +478,44 @@ __mlogregr_irls_step_transition::run(AnyType &args) {
             Storing it in this forms helps us get a nice closed form expression
     */
 
-    //To pivot around the specified reference category
-    ColumnVector y(numCategories);
-    y.fill(0);
+    //To pivot around the specified reference category. y is the 1/0
+    //indicator vector of the category, y_index the position of its 1.
+    Index y_index = -1;
     if (category > ref_category) {
-        y(category - 1) = 1;
+        y_index = category - 1;
     } else if (category < ref_category) {
-        y(category) = 1;
+        y_index = category;
     }
 
+    // Scratch layout: t1, pi, r (numCategories each), v (numCategories *
+    // widthOfX)
+    const Index J = numCategories;
+    const Index p = state.widthOfX;
+    double *scratch = getScratch(args, 3 * J + J * p);
+    Eigen::Map<ColumnVector> t1(scratch, J);
+    Eigen::Map<ColumnVector> pi(scratch + J, J);
+    Eigen::Map<ColumnVector> r(scratch + 2 * J, J);
+    Eigen::Map<ColumnVector> v(scratch + 3 * J, J * p);
+
     /*
     Compute the parameter vector (the 'pi' vector in the documentation)
     for the data point being processed.
-    Casting the coefficients into a matrix makes the calculation simple.
+    Viewing the coefficients as a matrix makes the calculation simple.
     */
-    Matrix coef = state.coef;
-    coef.resize(numCategories, state.widthOfX);
+    Eigen::Map<const Matrix> coef(state.coef.data(), J, p);
+    double t3 = computePi(coef, x, t1, pi);
 
-    //Store the intermediate calculations because we'll reuse them in the LLH
-    ColumnVector t1 = x; //t1 is vector of size state.widthOfX
-    t1 = coef*x;
-    /* Note: The above 2 lines could have been written as:
-        ColumnVector t1 = -coef*x;
+    //The gradient matrix has numCategories rows and widthOfX columns, and
+    //is stored as a vector to make the Newton step calculations easier
+    r = pi;
+    if (y_index >= 0)
+        r(y_index) -= 1;
+    Eigen::Map<Matrix>(state.gradient.data(), J, p).noalias() +=
+        r * trans(x);
 
-        but this creates warnings. These warnings are somehow related to the factor
-        that x is of an immutable type. The following alternative could resolve
-        the warnings (although not necessary the best alternative):
-    */
-
-    ColumnVector t2 = t1.array().exp();
-    double t3 = 1 + t2.sum();
-    ColumnVector pi = t2/t3;
-
-    //The gradient matrix has numCategories rows and widthOfX columns
-    Matrix grad = -y*x.transpose() + pi*x.transpose();
-    //We cast the gradient into a vector to make the Newton step calculations much easier.
-    grad.resize(numCategories*state.widthOfX,1);
-
-    /*
-         a is a matrix of size JxJ where J is the number of categories
-         a_j1j2 = -pi(j1)*(1-pi(j2))if j1 == j2
-         a_j1j2 =  pi(j1)*pi(j2) if j1 != j2
-    */
-    Matrix a(numCategories,numCategories);
-    // Compute the 'a' matrix.
-    Matrix piDiag = pi.asDiagonal();
-    a = pi * pi.transpose() - piDiag;
-    state.gradient.noalias() += grad;
+    accumulateHessian(state.X_transp_AX, x, pi, v);
 
-    //Start the Hessian calculations
-    Matrix X_transp_AX(numCategories * state.widthOfX, numCategories * state.widthOfX);
-
-    /*
-        Again: The following 3 lines could have been written as
-        Matrix XXTrans = x * x.transpose();
-        but it creates warnings related to the type of x. Here is an easy fix
-    */
-    Matrix cv_x = x;
-    Matrix XXTrans = trans(cv_x);
-    XXTrans = cv_x * XXTrans;
-
-    //Eigen doesn't supported outer-products for matrices, so we have to do our own.
-    //This operation is also known as a tensor-product.
-    for (int i1 = 0; i1 < state.widthOfX; i1++){
-         for (int i2 = 0; i2 <state.widthOfX; i2++){
-            int rowOffset = numCategories * i1;
-            int colOffset = numCategories * i2;
-
-            X_transp_AX.block(rowOffset, colOffset, numCategories,  numCategories) = XXTrans(i1,i2)*a;
-        }
-    }
-
-    triangularView<Lower>(state.X_transp_AX) += X_transp_AX;
-
-    state.logLikelihood += y.transpose()*t1 - log(t3);
+    state.logLikelihood += (y_index >= 0 ? t1(y_index) : 0.) - log(t3);
 
     return state;
 
@@ -707,82 +739,46 @@ mlogregr_robust_step_transition::run(AnyType &args) {
         Storing it in this forms helps us get a nice closed form expression
     */
 
-    //To pivot around the specified reference category
-    ColumnVector y(numCategories);
-    y.fill(0);
+    //To pivot around the specified reference category. y is the 1/0
+    //indicator vector of the category, y_index the position of its 1.
+    Index y_index = -1;
     if (category > ref_category) {
-        y(category - 1) = 1;
+        y_index = category - 1;
     } else if (category < ref_category) {
-        y(category) = 1;
+        y_index = category;
     }
 
+    // Scratch layout: t1, pi, r (numCategories each), v, grad
+    // (numCategories * widthOfX each)
+    const Index J = numCategories;
+    const Index p = state.widthOfX;
+    double *scratch = getScratch(args, 3 * J + 2 * J * p);
+    Eigen::Map<ColumnVector> t1(scratch, J);
+    Eigen::Map<ColumnVector> pi(scratch + J, J);
+    Eigen::Map<ColumnVector> r(scratch + 2 * J, J);
+    Eigen::Map<ColumnVector> v(scratch + 3 * J, J * p);
+    Eigen::Map<ColumnVector> grad(scratch + 3 * J + J * p, J * p);
+
     /*
     Compute the parameter vector (the 'pi' vector in the documentation)
     for the data point being processed.
-    Casting the coefficients into a matrix makes the calculation simple.
+    Viewing the coefficients as a matrix makes the calculation simple.
     */
+    Eigen::Map<const Matrix> coef(state.coef.data(), J, p);
+    computePi(coef, x, t1, pi);
 
-    Matrix coef = state.coef;
-    coef.resize(numCategories, state.widthOfX);
-
-    //Store the intermediate calculations because we'll reuse them in the LLH
-    ColumnVector t1 = x; //t1 is vector of size state.widthOfX
-    t1 = coef*x;
-    /*
-        Note: The above 2 lines could have been written as:
-        ColumnVector t1 = -coef*x;
-
-        but this creates warnings. These warnings are somehow related to the factor
-        that x is an immutable type.
-    */
+    //The gradient matrix has numCategories rows and widthOfX columns. We
+    //view it as a vector to make the math easier.
+    r = pi;
+    if (y_index >= 0)
+        r(y_index) -= 1;
+    Eigen::Map<Matrix>(grad.data(), J, p).noalias() = r * trans(x);
 
-    ColumnVector t2 = t1.array().exp();
-    double t3 = 1 + t2.sum();
-    ColumnVector pi = t2/t3;
+    // Only the lower triangle of the meat is accumulated. It is symmetrized
+    // in the final function.
+    state.meat.selfadjointView<Eigen::Lower>().rankUpdate(grad);
 
-	//The gradient matrix has numCategories rows and widthOfX columns
-    Matrix grad = -y * x.transpose() + pi * x.transpose();
-    //We cast the gradient into a vector to make the math easier.
-    grad.resize(numCategories * state.widthOfX, 1);
-
-    Matrix GradGradTranspose;
-    GradGradTranspose = grad * grad.transpose();
-	state.meat += GradGradTranspose;
-
-    /*
-         a is a matrix of size JxJ where J is the number of categories
-         a_j1j2 = -pi(j1)*(1-pi(j2))if j1 == j2
-         a_j1j2 =  pi(j1)*pi(j2) if j1 != j2
-    */
-    // Compute the 'a' matrix.
-    Matrix a(numCategories,numCategories);
-    Matrix piDiag = pi.asDiagonal();
-    a = pi * pi.transpose() - piDiag;
-
-    //Start the Hessian calculations
-    Matrix X_transp_AX(numCategories * state.widthOfX, numCategories * state.widthOfX);
-
-    /*
-        Again: The following 3 lines could have been written as
-        Matrix XXTrans = x * x.transpose();
-        but it creates warnings related to the type of x. Here is an easy fix
-    */
-    Matrix cv_x = x;
-    Matrix XXTrans = trans(cv_x);
-    XXTrans = cv_x * XXTrans;
-
-    //Eigen doesn't supported outer-products for matrices, so we have to do our own.
-    //This operation is also known as a tensor-product.
-    for (int i1 = 0; i1 < state.widthOfX; i1++){
-         for (int i2 = 0; i2 <state.widthOfX; i2++){
-            int rowOffset = numCategories * i1;
-            int colOffset = numCategories * i2;
-
-            X_transp_AX.block(rowOffset, colOffset, numCategories,  numCategories) = XXTrans(i1, i2) * a;
-        }
-    }
-
-    triangularView<Lower>(state.X_transp_AX) += X_transp_AX;
+    accumulateHessian(state.X_transp_AX, x, pi, v);
 
     return state;
 
@@ -864,8 +860,12 @@ mlogregr_robust_step_final::run(AnyType &args) {
 
     // Precompute (X^T * A * X)^-1
     Matrix bread = decomposition.pseudoInverse();
+
+    // The transition function only accumulates the lower triangle of the meat
+    Matrix meat = state.meat.triangularView<Eigen::StrictlyLower>();
+    meat = meat + trans(state.meat);
 	Matrix varianceMat;
-    varianceMat = bread * state.meat * bread;
+    varianceMat = bread * meat * bread;
 
     if(!state.coef.is_finite())
         throw NoSolutionFoundException("Over- or underflow in Newton step, "
@@ -0,0 +1,169 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file ValueCountState.hpp
+ *
+ * @brief Mergeable two-sample value-count histogram for rank-based tests
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_MODULES_STATS_VALUE_COUNT_STATE_HPP
+#define MADLIB_MODULES_STATS_VALUE_COUNT_STATE_HPP
+
+#include <dbconnector/dbconnector.hpp>
+
+#include <algorithm>
+
+namespace madlib {
+
+namespace modules {
+
+namespace stats {
+
+// Use Eigen
+using namespace dbal;
+using namespace dbal::eigen_integration;
+
+/**
+ * @brief Number of rows of each of the two samples that share a value
+ *
+ * All members are doubles so that an array of entries can be stored in (and
+ * mapped onto) a ColumnVector. The bounds are only used by the Wilcoxon
+ * signed-rank test, where they are the smallest value - precision and the
+ * largest value + precision seen for this value.
+ */
+struct ValueCount {
+    double value;
+    double count[2];
+    double lower;
+    double upper;
+};
+
+struct ValueCountLess {
+    bool operator()(const ValueCount& inV1, const ValueCount& inV2) const {
+        return inV1.value < inV2.value;
+    }
+};
+
+/**
+ * @brief Transition state of the unordered rank-test aggregates
+ *
+ * The state is a histogram of (value, count per sample) entries. The entries
+ * in [0, num_sorted) form a sorted run without duplicate values; new rows are
+ * appended behind it. Whenever the state is full, the appended entries are
+ * sorted and merged into the run, and equal values are collapsed. The state
+ * therefore stays proportional to the number of distinct values, and two
+ * states are merged by appending the run of one to the other. Final
+ * functions call compact() and sweep the run in ascending order, which gives
+ * the same result as an ordered aggregate without a global sort.
+ */
+template <class Container>
+class ValueCountState
+  : public DynamicStruct<ValueCountState<Container>, Container> {
+public:
+    typedef DynamicStruct<ValueCountState, Container> Base;
+    MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
+
+    ValueCountState(Init_type& inInitialization): Base(inInitialization) {
+        this->initialize();
+    }
+
+    void bind(ByteStream_type& inStream) {
+        inStream >> num_entries >> num_sorted >> capacity >> has_nan
+            >> expected_num.rebind(2);
+
+        uint32_t cap = 0u;
+        if (!capacity.isNull()) {
+            cap = capacity;
+        }
+        inStream >> entries.rebind(static_cast<Index>(cap) * kEntryWidth);
+    }
+
+    void append(const ValueCount& inEntry) {
+        if (num_entries == capacity) {
+            compact();
+            // grow unless compaction freed at least half of the space
+            if (2 * num_entries >= capacity) {
+                capacity = std::max(2u * static_cast<uint32_t>(capacity), 64u);
+                this->resize();
+            }
+        }
+        histogram()[static_cast<uint32_t>(num_entries)] = inEntry;
+        num_entries++;
+    }
+
+    void append(double inValue, int inSample, double inPrecision = 0.) {
+        ValueCount entry;
+        entry.value = inValue;
+        entry.count[0] = inSample == 0 ? 1. : 0.;
+        entry.count[1] = inSample == 0 ? 0. : 1.;
+        entry.lower = inValue - inPrecision;
+        entry.upper = inValue + inPrecision;
+        append(entry);
+    }
+
+    template <class OtherContainer>
+    ValueCountState& operator<<(const ValueCountState<OtherContainer>& inOther) {
+        const ValueCount* other = inOther.histogram();
+        for (uint32_t i = 0; i < inOther.num_entries; i++) {
+            append(other[i]);
+        }
+        has_nan = has_nan || inOther.has_nan;
+        return *this;
+    }
+
+    /**
+     * @brief Sort all entries and collapse equal values
+     */
+    void compact() {
+        ValueCount* begin = histogram();
+        ValueCount* middle = begin + static_cast<uint32_t>(num_sorted);
+        ValueCount* end = begin + static_cast<uint32_t>(num_entries);
+        ValueCountLess less;
+
+        std::sort(middle, end, less);
+        std::inplace_merge(begin, middle, end, less);
+
+        uint32_t n = 0;
+        for (ValueCount* it = begin; it != end; ++it) {
+            if (n > 0 && begin[n - 1].value == it->value) {
+                ValueCount& last = begin[n - 1];
+                last.count[0] += it->count[0];
+                last.count[1] += it->count[1];
+                last.lower = std::min(last.lower, it->lower);
+                last.upper = std::max(last.upper, it->upper);
+            } else {
+                begin[n++] = *it;
+            }
+        }
+        num_entries = n;
+        num_sorted = n;
+    }
+
+    ValueCount* histogram() {
+        return reinterpret_cast<ValueCount*>(entries.data());
+    }
+
+    const ValueCount* histogram() const {
+        return reinterpret_cast<const ValueCount*>(entries.data());
+    }
+
+    bool empty() const { return this->num_entries == 0 && !this->has_nan; }
+
+    static const uint32_t kEntryWidth = sizeof(ValueCount) / sizeof(double);
+
+    uint32_type num_entries;
+    uint32_type num_sorted;
+    uint32_type capacity;
+    bool_type has_nan;
+    // sample sizes passed to the Kolmogorov-Smirnov test
+    ColumnVector_type expected_num;
+    ColumnVector_type entries;
+};
+
+} // namespace stats
+
+} // namespace modules
+
+} // namespace madlib
+
+#endif // defined(MADLIB_MODULES_STATS_VALUE_COUNT_STATE_HPP)
@@ -14,6 +14,7 @@ namespace modules {
 
 namespace stats {
 
+using namespace dbal;
 using namespace dbal::eigen_integration;
 
 // ----------------------------------------------------------------------
@@ -83,6 +84,246 @@ correlation_final::run(AnyType& args) {
     return state;
 }
 
+// ----------------------------------------------------------------------
+
+/**
+ * @brief Transition state for the single-pass covariance aggregate
+ *
+ * The state holds the number of rows, their mean and the co-moment matrix
+ * \f$ \sum_i (x_i - \bar x)(x_i - \bar x)^T \f$, of which only the upper
+ * triangle is maintained. Rows are buffered and folded in as blocks: the
+ * deviations from the block mean enter with a rank-k update, and the block is
+ * then combined with the running moments using the pairwise update of Chan,
+ * Golub and LeVeque. Merging two states uses the same update, so the
+ * aggregate needs neither a precomputed mean nor a second pass.
+ */
+template <class Container>
+class CovarianceMomentsState
+  : public DynamicStruct<CovarianceMomentsState<Container>, Container> {
+public:
+    typedef DynamicStruct<CovarianceMomentsState, Container> Base;
+    MADLIB_DYNAMIC_STRUCT_TYPEDEFS;
+
+    enum { BLOCK_SIZE = 32 };
+
+    CovarianceMomentsState(Init_type& inInitialization)
+      : Base(inInitialization) {
+        this->initialize();
+    }
+
+    void bind(ByteStream_type& inStream) {
+        inStream >> num_rows >> num_buffered_rows >> num_cols;
+
+        uint32_t n = num_cols.isNull() ? 0u : static_cast<uint32_t>(num_cols);
+        inStream
+            >> mean.rebind(n)
+            >> comoment.rebind(n, n)
+            >> x_buffer.rebind(n, BLOCK_SIZE);
+    }
+
+    CovarianceMomentsState& operator<<(const MappedColumnVector& inX) {
+        x_buffer.col(num_buffered_rows) = inX;
+        num_buffered_rows++;
+        if (num_buffered_rows == BLOCK_SIZE) {
+            flush();
+        }
+        return *this;
+    }
+
+    template <class OtherContainer>
+    CovarianceMomentsState& operator<<(
+            const CovarianceMomentsState<OtherContainer>& inOther) {
+        if (inOther.num_rows > 0) {
+            flush();
+            combine(static_cast<uint64_t>(inOther.num_rows), inOther.mean);
+            triangularView<Upper>(comoment) += inOther.comoment;
+        }
+        for (uint32_t i = 0; i < inOther.num_buffered_rows; i++) {
+            x_buffer.col(num_buffered_rows) = inOther.x_buffer.col(i);
+            num_buffered_rows++;
+            if (num_buffered_rows == BLOCK_SIZE) {
+                flush();
+            }
+        }
+        return *this;
+    }
+
+    /**
+     * @brief Fold the buffered rows into the mean and co-moment matrix
+     */
+    void flush() {
+        uint32_t b = num_buffered_rows;
+        if (b == 0) { return; }
+
+        ColumnVector block_mean = x_buffer.leftCols(b).rowwise().sum() / b;
+        x_buffer.leftCols(b).colwise() -= block_mean;
+        comoment.template selfadjointView<Eigen::Upper>().rankUpdate(
+            x_buffer.leftCols(b));
+        combine(b, block_mean);
+        num_buffered_rows = 0;
+    }
+
+    uint64_t count() const { return num_rows + num_buffered_rows; }
+    bool empty() const { return num_cols.isNull() || count() == 0; }
+
+    uint64_type num_rows;
+    uint32_type num_buffered_rows;
+    uint32_type num_cols;
+    ColumnVector_type mean;
+    Matrix_type comoment;
+    Matrix_type x_buffer;
+
+private:
+    /**
+     * @brief Add the mean-difference term of Chan's update for another
+     *     group of inCount rows with mean inMean
+     *
+     * The co-moment matrix of the other group must be added separately.
+     */
+    template <class Derived>
+    void combine(uint64_t inCount, const Eigen::MatrixBase<Derived>& inMean) {
+        double n_a = static_cast<double>(num_rows);
+        double n_b = static_cast<double>(inCount);
+        double n = n_a + n_b;
+
+        ColumnVector delta = inMean - mean;
+        comoment.template selfadjointView<Eigen::Upper>().rankUpdate(
+            delta, n_a * n_b / n);
+        mean += delta * (n_b / n);
+        num_rows += inCount;
+    }
+};
+
+typedef CovarianceMomentsState<RootContainer> CovarianceMoments;
+typedef CovarianceMomentsState<MutableRootContainer> MutableCovarianceMoments;
+
+// ----------------------------------------------------------------------
+
+AnyType
+covariance_moments_transition::run(AnyType& args) {
+    MutableCovarianceMoments state = args[0].getAs<MutableByteString>();
+    if (args[1].isNull()) { return args[0]; }
+
+    MappedColumnVector x;
+    try {
+        MappedColumnVector xx = args[1].getAs<MappedColumnVector>();
+        x.rebind(xx.memoryHandle(), xx.size());
+    } catch (const ArrayWithNullException &e) {
+        return args[0];
+    }
+
+    if (state.num_cols.isNull() || state.num_cols == 0) {
+        state.num_cols = static_cast<uint32_t>(x.size());
+        state.resize();
+    } else if (static_cast<uint32_t>(x.size()) != state.num_cols) {
+        throw std::runtime_error("Correlation: Inconsistent numbers of "
+            "columns.");
+    }
+
+    state << x;
+    return state.storage();
+}
+
+// ----------------------------------------------------------------------
+
+AnyType
+covariance_moments_merge_states::run(AnyType& args) {
+    MutableCovarianceMoments stateLeft = args[0].getAs<MutableByteString>();
+    CovarianceMoments stateRight = args[1].getAs<ByteString>();
+
+    if (stateLeft.empty()) {
+        return stateRight.storage();
+    } else if (stateRight.empty()) {
+        return stateLeft.storage();
+    } else if (stateLeft.num_cols != stateRight.num_cols) {
+        throw std::runtime_error("Correlation: Inconsistent numbers of "
+            "columns.");
+    }
+
+    stateLeft << stateRight;
+    return stateLeft.storage();
+}
+
+// ----------------------------------------------------------------------
+
+AnyType
+covariance_moments_final::run(AnyType& args) {
+    MutableCovarianceMoments state = args[0].getAs<MutableByteString>();
+
+    // If we haven't seen any valid data, just return Null. This is the
+    // standard behavior of aggregate function on empty data sets
+    if (state.empty()) { return Null(); }
+
+    state.flush();
+    return state.storage();
+}
+
+// ----------------------------------------------------------------------
+
+AnyType
+covariance_moments_count::run(AnyType& args) {
+    CovarianceMoments state = args[0].getAs<ByteString>();
+    return static_cast<int64_t>(state.count());
+}
+
+// ----------------------------------------------------------------------
+
+AnyType
+covariance_moments_mean::run(AnyType& args) {
+    CovarianceMoments state = args[0].getAs<ByteString>();
+    if (state.empty()) { return Null(); }
+    if (state.num_buffered_rows > 0) {
+        throw std::runtime_error("Correlation: Moments state has not been "
+            "finalized.");
+    }
+
+    MutableNativeColumnVector mean(
+        this->allocateArray<double>(state.num_cols));
+    mean = state.mean;
+    return mean;
+}
+
+// ----------------------------------------------------------------------
+
+/**
+ * @brief Covariance (get_cov = true) or correlation matrix of a finalized
+ *     moments state
+ *
+ * The covariance is normalized by the number of rows, as in covariance().
+ */
+AnyType
+covariance_moments_matrix::run(AnyType& args) {
+    CovarianceMoments state = args[0].getAs<ByteString>();
+    bool get_cov = args[1].getAs<bool>();
+    if (state.empty()) { return Null(); }
+    if (state.num_buffered_rows > 0) {
+        throw std::runtime_error("Correlation: Moments state has not been "
+            "finalized.");
+    }
+
+    uint32_t n = state.num_cols;
+    MutableNativeMatrix result(
+        this->allocateArray<double>(n, n), n, n);
+    triangularView<Upper>(result) = state.comoment;
+    if (get_cov) {
+        triangularView<Upper>(result) =
+            result / static_cast<double>(state.num_rows);
+    } else {
+        ColumnVector inv_sqrt_of_diag =
+            state.comoment.diagonal().cwiseSqrt().cwiseInverse();
+        for (uint32_t j = 0; j < n; j++) {
+            result.col(j).head(j + 1) = result.col(j).head(j + 1).cwiseProduct(
+                inv_sqrt_of_diag.head(j + 1)) * inv_sqrt_of_diag(j);
+        }
+        result.diagonal().setOnes();
+    }
+    for (uint32_t j = 0; j < n; j++) {
+        result.row(j).head(j) = trans(result.col(j).head(j));
+    }
+
+    return result;
+}
+
 } // stats
 
 } // modules
@@ -19,3 +19,33 @@ DECLARE_UDF(stats, correlation_merge_states)
  * @brief correlatin: Final function
  */
 DECLARE_UDF(stats, correlation_final)
+
+/**
+ * @brief Single-pass covariance moments: Transition function
+ */
+DECLARE_UDF(stats, covariance_moments_transition)
+
+/**
+ * @brief Single-pass covariance moments: State merge function
+ */
+DECLARE_UDF(stats, covariance_moments_merge_states)
+
+/**
+ * @brief Single-pass covariance moments: Final function
+ */
+DECLARE_UDF(stats, covariance_moments_final)
+
+/**
+ * @brief Single-pass covariance moments: Number of rows
+ */
+DECLARE_UDF(stats, covariance_moments_count)
+
+/**
+ * @brief Single-pass covariance moments: Mean vector
+ */
+DECLARE_UDF(stats, covariance_moments_mean)
+
+/**
+ * @brief Single-pass covariance moments: Covariance or correlation matrix
+ */
+DECLARE_UDF(stats, covariance_moments_matrix)
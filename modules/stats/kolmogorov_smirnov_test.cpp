@@ -10,6 +10,7 @@
 #include <modules/shared/HandleTraits.hpp>
 #include <modules/prob/kolmogorov.hpp>
 
+#include "ValueCountState.hpp"
 #include "kolmogorov_smirnov_test.hpp"
 
 namespace madlib {
@@ -117,36 +118,121 @@ ks_test_transition::run(AnyType &args) {
  * Statistics Without Extensive Tables", Journal of the Royal Statistical
  * Society. Series B (Methodological), Vol. 32, No. 1. (1970), pp. 115-122.
  */
+static
 AnyType
-ks_test_final::run(AnyType &args) {
-    using boost::math::complement;
+ksTestResult(const Eigen::Vector2d &inNum, const Eigen::Vector2d &inExpectedNum,
+    double inMaxDiff) {
 
-    KSTestTransitionState<ArrayHandle<double> > state = args[0];
+    using boost::math::complement;
 
-    if (state.num != state.expectedNum) {
+    if (inNum != inExpectedNum) {
         std::stringstream tmp;
         tmp << "Actual sample sizes differ from specified sizes. "
                 "Actual/specified: "
-            << static_cast<int>(state.num(0)) << "/" << static_cast<int>(state.expectedNum(0))
+            << static_cast<int>(inNum(0)) << "/" << static_cast<int>(inExpectedNum(0))
             << " and "
-            << static_cast<int>(state.num(1)) << "/" << static_cast<int>(state.expectedNum(1));
+            << static_cast<int>(inNum(1)) << "/" << static_cast<int>(inExpectedNum(1));
         throw std::invalid_argument(tmp.str());
     }
 
-    // Note that at this point we also have state.lastDiff == 0 and thus
-    // state.lastDiff <= state.maxDiff.
-
-    double root = std::sqrt(state.num.prod() / state.num.sum());
-    double kolmogorov_statistic = (root + 0.12 + 0.11 / root) * state.maxDiff;
+    double root = std::sqrt(inNum.prod() / inNum.sum());
+    double kolmogorov_statistic = (root + 0.12 + 0.11 / root) * inMaxDiff;
 
     AnyType tuple;
     tuple
-        << static_cast<double>(state.maxDiff) // The Kolmogorov-Smirnov statistic
+        << inMaxDiff // The Kolmogorov-Smirnov statistic
         << kolmogorov_statistic
         << prob::cdf(complement(prob::kolmogorov(), kolmogorov_statistic));
     return tuple;
 }
 
+AnyType
+ks_test_final::run(AnyType &args) {
+    KSTestTransitionState<ArrayHandle<double> > state = args[0];
+
+    // Note that if the sample sizes are as specified, we also have
+    // state.lastDiff == 0 and thus state.lastDiff <= state.maxDiff.
+
+    return ksTestResult(Eigen::Vector2d(state.num),
+        Eigen::Vector2d(state.expectedNum), state.maxDiff);
+}
+
+// -----------------------------------------------------------------------
+
+/**
+ * @brief Perform the transition step of the unordered Kolmogorov-Smirnov test
+ */
+AnyType
+ks_test_unordered_transition::run(AnyType &args) {
+    ValueCountState<MutableRootContainer> state =
+        args[0].getAs<MutableByteString>();
+    int sample = args[1].getAs<bool>() ? 0 : 1;
+    double value = args[2].getAs<double>();
+    Eigen::Vector2d expectedNum;
+        expectedNum << static_cast<double>(args[3].getAs<int64_t>()),
+                       static_cast<double>(args[4].getAs<int64_t>());
+
+    if (state.empty()) {
+        state.expected_num = expectedNum;
+    } else if (state.expected_num != expectedNum) {
+        throw std::invalid_argument("Number of samples must be constant "
+            "parameters.");
+    }
+
+    if (std::isnan(value)) {
+        throw std::invalid_argument("Values must not be NaN.");
+    }
+
+    state.append(value, sample);
+    return state.storage();
+}
+
+AnyType
+ks_test_unordered_merge_states::run(AnyType &args) {
+    ValueCountState<MutableRootContainer> stateLeft =
+        args[0].getAs<MutableByteString>();
+    ValueCountState<RootContainer> stateRight = args[1].getAs<ByteString>();
+
+    if (stateLeft.empty()) {
+        return stateRight.storage();
+    } else if (stateRight.empty()) {
+        return stateLeft.storage();
+    } else if (stateLeft.expected_num != stateRight.expected_num) {
+        throw std::invalid_argument("Number of samples must be constant "
+            "parameters.");
+    }
+
+    stateLeft << stateRight;
+    return stateLeft.storage();
+}
+
+/**
+ * @brief Perform the final step of the unordered Kolmogorov-Smirnov test
+ *
+ * The empirical distribution functions are compared after each distinct
+ * value, i.e., after the last row of each group of ties (see also
+ * MADLIB-554).
+ */
+AnyType
+ks_test_unordered_final::run(AnyType &args) {
+    ValueCountState<MutableRootContainer> state =
+        args[0].getAs<MutableByteString>();
+    state.compact();
+
+    const ValueCount* histogram = state.histogram();
+    Eigen::Vector2d expectedNum = state.expected_num;
+    Eigen::Vector2d num = Eigen::Vector2d::Zero();
+    double maxDiff = 0.;
+    for (uint32_t i = 0; i < state.num_entries; i++) {
+        num(0) += histogram[i].count[0];
+        num(1) += histogram[i].count[1];
+        maxDiff = std::max(maxDiff, std::fabs(num(0) / expectedNum(0)
+                                            - num(1) / expectedNum(1)));
+    }
+
+    return ksTestResult(num, expectedNum, maxDiff);
+}
+
 } // namespace stats
 
 } // namespace modules
@@ -13,3 +13,18 @@ DECLARE_UDF(stats, ks_test_transition)
  * @brief Kolmogorov-Smirnov Test: Final function
  */
 DECLARE_UDF(stats, ks_test_final)
+
+/**
+ * @brief Kolmogorov-Smirnov test (unordered): Transition function
+ */
+DECLARE_UDF(stats, ks_test_unordered_transition)
+
+/**
+ * @brief Kolmogorov-Smirnov test (unordered): State merge function
+ */
+DECLARE_UDF(stats, ks_test_unordered_merge_states)
+
+/**
+ * @brief Kolmogorov-Smirnov test (unordered): Final function
+ */
+DECLARE_UDF(stats, ks_test_unordered_final)
@@ -11,6 +11,7 @@
 #include <modules/shared/HandleTraits.hpp>
 #include <utils/Math.hpp>
 
+#include "ValueCountState.hpp"
 #include "mann_whitney_test.hpp"
 
 namespace madlib {
@@ -85,21 +86,23 @@ mw_test_transition::run(AnyType &args) {
     return state;
 }
 
+/**
+ * @brief Compute the result tuple from the sample sizes and rank sums
+ */
+static
 AnyType
-mw_test_final::run(AnyType &args) {
+mwTestResult(const Eigen::Vector2d &inNum, const Eigen::Vector2d &inRankSum) {
     using boost::math::complement;
 
-    MWTestTransitionState<ArrayHandle<double> > state = args[0];
-
     Eigen::Vector2d U;
-    double numProd = state.num.prod();
+    double numProd = inNum.prod();
 
-    U(0) = state.rankSum(1) - state.num(1) * (state.num(1) + 1.) / 2.;
+    U(0) = inRankSum(1) - inNum(1) * (inNum(1) + 1.) / 2.;
     U(1) = numProd - U(0);
 
     double u_statistic = U.minCoeff();
     double z_statistic = (u_statistic - (numProd / 2.))
-                       / (std::sqrt( numProd * (state.num.sum() + 1) / 12. ));
+                       / (std::sqrt( numProd * (inNum.sum() + 1) / 12. ));
 
     AnyType tuple;
     tuple
@@ -110,6 +113,95 @@ mw_test_final::run(AnyType &args) {
     return tuple;
 }
 
+AnyType
+mw_test_final::run(AnyType &args) {
+    MWTestTransitionState<ArrayHandle<double> > state = args[0];
+
+    return mwTestResult(Eigen::Vector2d(state.num),
+        Eigen::Vector2d(state.rankSum));
+}
+
+// -----------------------------------------------------------------------
+
+/**
+ * @brief Perform the transition step of the unordered Mann-Whitney test
+ */
+AnyType
+mw_test_unordered_transition::run(AnyType &args) {
+    ValueCountState<MutableRootContainer> state =
+        args[0].getAs<MutableByteString>();
+    int sample = args[1].getAs<bool>() ? 0 : 1;
+    double value = args[2].getAs<double>();
+
+    if (std::isnan(value)) {
+        // If the input contains NaN, we'll have it propagate
+        state.has_nan = true;
+    } else {
+        state.append(value, sample);
+    }
+    return state.storage();
+}
+
+AnyType
+mw_test_unordered_merge_states::run(AnyType &args) {
+    ValueCountState<MutableRootContainer> stateLeft =
+        args[0].getAs<MutableByteString>();
+    ValueCountState<RootContainer> stateRight = args[1].getAs<ByteString>();
+
+    if (stateLeft.empty()) {
+        return stateRight.storage();
+    } else if (stateRight.empty()) {
+        return stateLeft.storage();
+    }
+
+    stateLeft << stateRight;
+    return stateLeft.storage();
+}
+
+/**
+ * @brief Perform the final step of the unordered Mann-Whitney test
+ *
+ * Values are visited in ascending order. As in mw_test_transition, a value
+ * ties with the previous one if both are almost equal, and each value of a
+ * group of t ties that follows r smaller values gets the average rank
+ * r + (t + 1) / 2.
+ */
+AnyType
+mw_test_unordered_final::run(AnyType &args) {
+    ValueCountState<MutableRootContainer> state =
+        args[0].getAs<MutableByteString>();
+    state.compact();
+
+    const ValueCount* histogram = state.histogram();
+    uint32_t n = state.num_entries;
+    Eigen::Vector2d num = Eigen::Vector2d::Zero();
+    Eigen::Vector2d rankSum = Eigen::Vector2d::Zero();
+
+    uint32_t begin = 0;
+    while (begin < n) {
+        // [begin, end) is a group of ties
+        Eigen::Vector2d numTies(histogram[begin].count[0],
+            histogram[begin].count[1]);
+        uint32_t end = begin + 1;
+        while (end < n && utils::almostEqual(histogram[end - 1].value,
+                histogram[end].value, 2)) {
+            numTies(0) += histogram[end].count[0];
+            numTies(1) += histogram[end].count[1];
+            end++;
+        }
+
+        double averageRank = num.sum() + (numTies.sum() + 1.) / 2.;
+        rankSum += numTies * averageRank;
+        num += numTies;
+        begin = end;
+    }
+
+    if (state.has_nan) {
+        rankSum.setConstant(std::numeric_limits<double>::quiet_NaN());
+    }
+    return mwTestResult(num, rankSum);
+}
+
 } // namespace stats
 
 } // namespace modules
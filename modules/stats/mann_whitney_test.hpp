@@ -13,3 +13,18 @@ DECLARE_UDF(stats, mw_test_transition)
  * @brief Mann-Whitney U Test: Final function
  */
 DECLARE_UDF(stats, mw_test_final)
+
+/**
+ * @brief Mann-Whitney U Test (unordered): Transition function
+ */
+DECLARE_UDF(stats, mw_test_unordered_transition)
+
+/**
+ * @brief Mann-Whitney U Test (unordered): State merge function
+ */
+DECLARE_UDF(stats, mw_test_unordered_merge_states)
+
+/**
+ * @brief Mann-Whitney U Test (unordered): Final function
+ */
+DECLARE_UDF(stats, mw_test_unordered_final)
@@ -11,6 +11,7 @@
 #include <modules/shared/HandleTraits.hpp>
 #include <utils/Math.hpp>
 
+#include "ValueCountState.hpp"
 #include "wilcoxon_signed_rank_test.hpp"
 
 namespace madlib {
@@ -123,30 +124,144 @@ wsr_test_transition::run(AnyType &args) {
     return state;
 }
 
+/**
+ * @brief Compute the result tuple from the sample sizes, rank sums and tie
+ *     correction of the variance
+ */
+static
 AnyType
-wsr_test_final::run(AnyType &args) {
-    using boost::math::complement;
+wsrTestResult(const Eigen::Vector2d &inNum, const Eigen::Vector2d &inRankSum,
+    double inReduceVariance) {
 
-    WSRTestTransitionState<ArrayHandle<double> > state = args[0];
+    using boost::math::complement;
 
-    double n_n1 = state.num.sum() * (state.num.sum() + 1);
-    double statistic = state.rankSum.minCoeff();
-    double z_statistic = (state.rankSum(0) - n_n1 / 4.)
-                       / std::sqrt(n_n1 * (2 * state.num.sum() + 1.) / 24.
-                            - state.reduceVariance);
+    double n_n1 = inNum.sum() * (inNum.sum() + 1);
+    double statistic = inRankSum.minCoeff();
+    double z_statistic = (inRankSum(0) - n_n1 / 4.)
+                       / std::sqrt(n_n1 * (2 * inNum.sum() + 1.) / 24.
+                            - inReduceVariance);
 
     AnyType tuple;
     tuple
         << statistic
-        << static_cast<double>(state.rankSum(0))
-        << static_cast<double>(state.rankSum(1))
-        << static_cast<int64_t>(state.num.sum())
+        << inRankSum(0)
+        << inRankSum(1)
+        << static_cast<int64_t>(inNum.sum())
         << z_statistic
         << prob::cdf(complement(prob::normal(), z_statistic))
         << 2. * prob::cdf(complement(prob::normal(), std::fabs(z_statistic)));
     return tuple;
 }
 
+AnyType
+wsr_test_final::run(AnyType &args) {
+    WSRTestTransitionState<ArrayHandle<double> > state = args[0];
+
+    return wsrTestResult(Eigen::Vector2d(state.num),
+        Eigen::Vector2d(state.rankSum), state.reduceVariance);
+}
+
+// -----------------------------------------------------------------------
+
+/**
+ * @brief Perform the transition step of the unordered Wilcoxon-Signed-Rank
+ *     test
+ *
+ * Sample 0 always refers to the positive values and sample 1 refers to the
+ * negative values. Absolute values are stored.
+ */
+AnyType
+wsr_test_unordered_transition::run(AnyType &args) {
+    ValueCountState<MutableRootContainer> state =
+        args[0].getAs<MutableByteString>();
+    double value = args[1].getAs<double>();
+    double precision = args.numFields() >= 3
+        ? args[2].getAs<double>()
+        : -1;
+
+    if (!std::isfinite(precision))
+        throw std::invalid_argument((boost::format(
+            "Precision must be finite, but got %1%.") % precision).str());
+    else if (precision < 0)
+        precision = std::fabs(value) * std::numeric_limits<double>::epsilon();
+
+    // Ignore values of zero.
+    if (value == 0)
+        return state.storage();
+
+    if (std::isnan(value)) {
+        state.has_nan = true;
+    } else {
+        state.append(std::fabs(value), value > 0 ? 0 : 1, precision);
+    }
+    return state.storage();
+}
+
+AnyType
+wsr_test_unordered_merge_states::run(AnyType &args) {
+    ValueCountState<MutableRootContainer> stateLeft =
+        args[0].getAs<MutableByteString>();
+    ValueCountState<RootContainer> stateRight = args[1].getAs<ByteString>();
+
+    if (stateLeft.empty()) {
+        return stateRight.storage();
+    } else if (stateRight.empty()) {
+        return stateLeft.storage();
+    }
+
+    stateLeft << stateRight;
+    return stateLeft.storage();
+}
+
+/**
+ * @brief Perform the final step of the unordered Wilcoxon-Signed-Rank test
+ *
+ * Absolute values are visited in ascending order. As in wsr_test_transition,
+ * a value starts a new group of ties unless value - precision is at most the
+ * largest value + precision seen so far. A group of t ties that follows r
+ * smaller values gets the average rank r + (t + 1) / 2 and reduces the
+ * variance by (t^3 - t) / 48.
+ */
+AnyType
+wsr_test_unordered_final::run(AnyType &args) {
+    ValueCountState<MutableRootContainer> state =
+        args[0].getAs<MutableByteString>();
+    state.compact();
+
+    const ValueCount* histogram = state.histogram();
+    uint32_t n = state.num_entries;
+    Eigen::Vector2d num = Eigen::Vector2d::Zero();
+    Eigen::Vector2d rankSum = Eigen::Vector2d::Zero();
+    double reduceVariance = 0.;
+
+    uint32_t begin = 0;
+    while (begin < n) {
+        // [begin, end) is a group of ties
+        Eigen::Vector2d numTies(histogram[begin].count[0],
+            histogram[begin].count[1]);
+        double absUpperBound = histogram[begin].upper;
+        uint32_t end = begin + 1;
+        while (end < n && histogram[end].lower <= absUpperBound) {
+            numTies(0) += histogram[end].count[0];
+            numTies(1) += histogram[end].count[1];
+            absUpperBound = std::max(absUpperBound, histogram[end].upper);
+            end++;
+        }
+
+        double t = numTies.sum();
+        double averageRank = num.sum() + (t + 1.) / 2.;
+        rankSum += numTies * averageRank;
+        reduceVariance += (t * t * t - t) / 48.;
+        num += numTies;
+        begin = end;
+    }
+
+    if (state.has_nan) {
+        rankSum.setConstant(std::numeric_limits<double>::quiet_NaN());
+    }
+    return wsrTestResult(num, rankSum, reduceVariance);
+}
+
 } // namespace stats
 
 } // namespace modules
@@ -13,3 +13,18 @@ DECLARE_UDF(stats, wsr_test_transition)
  * @brief Wilcoxon-Signed-Rank Test: Final function
  */
 DECLARE_UDF(stats, wsr_test_final)
+
+/**
+ * @brief Wilcoxon signed-rank test (unordered): Transition function
+ */
+DECLARE_UDF(stats, wsr_test_unordered_transition)
+
+/**
+ * @brief Wilcoxon signed-rank test (unordered): State merge function
+ */
+DECLARE_UDF(stats, wsr_test_unordered_merge_states)
+
+/**
+ * @brief Wilcoxon signed-rank test (unordered): Final function
+ */
+DECLARE_UDF(stats, wsr_test_unordered_final)
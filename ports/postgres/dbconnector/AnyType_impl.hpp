@@ -22,6 +22,12 @@ inline void AnyType::setUserFuncContext(void * user_fctx){
 inline MemoryContext AnyType::getCacheMemoryContext(){
     return this->mSysInfo->cacheContext;
 }
+inline const void * AnyType::getRawPointer() const {
+    if (mContentType != Scalar)
+        throw std::invalid_argument("Invalid type conversion. "
+            "Scalar value expected.");
+    return DatumGetPointer(mDatum);
+}
 
 inline
 AnyType::AnyType(FunctionCallInfo inFnCallInfo)
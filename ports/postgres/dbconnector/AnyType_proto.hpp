@@ -52,6 +52,11 @@ public:
     void * getUserFuncContext();
     void setUserFuncContext(void * user_fctx);
     MemoryContext getCacheMemoryContext();
+    // The argument as passed in by the backend, i.e., a by-reference value
+    // that has not been detoasted. It can serve as a cheap key for caching
+    // data derived from a large read-only argument in the user_fctx (see
+    // RawDatumKey).
+    const void * getRawPointer() const;
 protected:
     /**
      * @brief RAII class to temporarily change \c sLazyConversionToDatum
@@ -0,0 +1,78 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file FunctionCache_impl.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_POSTGRES_FUNCTIONCACHE_IMPL_HPP
+#define MADLIB_POSTGRES_FUNCTIONCACHE_IMPL_HPP
+
+namespace madlib {
+
+namespace dbconnector {
+
+namespace postgres {
+
+/**
+ * @brief Return a buffer of at least inSize elements
+ *
+ * The buffer is only reallocated if it is too small. The old buffer is
+ * released first, and the capacity is reset before allocating, so that a
+ * failed allocation leaves an empty buffer behind.
+ */
+template <typename T>
+inline
+T*
+CacheBuffer<T>::reserve(MemoryContext inContext, std::size_t inSize) {
+    if (inSize > capacity) {
+        if (ptr != NULL)
+            pfree(ptr);
+        ptr = NULL;
+        capacity = 0;
+        ptr = static_cast<T*>(MemoryContextAlloc(inContext, inSize * sizeof(T)));
+        capacity = inSize;
+    }
+    return ptr;
+}
+
+/**
+ * @brief Return whether the key holds the same bytes as the given argument
+ */
+inline
+bool
+RawDatumKey::matches(const void *inDatum) const {
+    return size > 0 && size == VARSIZE_ANY(inDatum)
+        && std::memcmp(raw.ptr, inDatum, size) == 0;
+}
+
+/**
+ * @brief Set the key to the given argument
+ */
+inline
+void
+RawDatumKey::assign(MemoryContext inContext, const void *inDatum) {
+    std::size_t inSize = VARSIZE_ANY(inDatum);
+    size = 0;
+    std::memcpy(raw.reserve(inContext, inSize), inDatum, inSize);
+    size = inSize;
+}
+
+/**
+ * @brief Clear the key
+ *
+ * Call before rebuilding the cached data, so that a failed rebuild does not
+ * leave a valid key behind.
+ */
+inline
+void
+RawDatumKey::invalidate() {
+    size = 0;
+}
+
+} // namespace postgres
+
+} // namespace dbconnector
+
+} // namespace madlib
+
+#endif // defined(MADLIB_POSTGRES_FUNCTIONCACHE_IMPL_HPP)
@@ -0,0 +1,55 @@
+/* ----------------------------------------------------------------------- *//**
+ *
+ * @file FunctionCache_proto.hpp
+ *
+ *//* ----------------------------------------------------------------------- */
+
+#ifndef MADLIB_POSTGRES_FUNCTIONCACHE_PROTO_HPP
+#define MADLIB_POSTGRES_FUNCTIONCACHE_PROTO_HPP
+
+namespace madlib {
+
+namespace dbconnector {
+
+namespace postgres {
+
+/**
+ * @brief Growable array for data kept in the user_fctx of a function
+ *
+ * The cache object stored with AnyType::setUserFuncContext() is allocated
+ * zeroed in AnyType::getCacheMemoryContext(), so a CacheBuffer member starts
+ * out empty and has no constructor. Growing the buffer discards its contents.
+ */
+template <typename T>
+struct CacheBuffer {
+    T *ptr;
+    std::size_t capacity;   // number of elements allocated
+
+    T *reserve(MemoryContext inContext, std::size_t inSize);
+};
+
+/**
+ * @brief Cache key for a large read-only argument
+ *
+ * The key is a copy of the argument as passed in by the backend (see
+ * AnyType::getRawPointer()). For a value read from a table, that is just the
+ * TOAST pointer, so checking the key does not detoast the value. The datum
+ * address is not a valid key by itself, since the backend reuses addresses
+ * for different values; the bytes are always compared.
+ */
+struct RawDatumKey {
+    CacheBuffer<char> raw;
+    std::size_t size;       // 0 if the key is not set
+
+    bool matches(const void *inDatum) const;
+    void assign(MemoryContext inContext, const void *inDatum);
+    void invalidate();
+};
+
+} // namespace postgres
+
+} // namespace dbconnector
+
+} // namespace madlib
+
+#endif // defined(MADLIB_POSTGRES_FUNCTIONCACHE_PROTO_HPP)
@@ -352,6 +352,17 @@ struct TypeTraits<ArrayHandle<text*> > {
     );
 };
 
+template <>
+struct TypeTraits<ArrayHandle<bytea*> >
+  : public TypeTraitsBase<ArrayHandle<bytea*> > {
+    enum { typeClass = dbal::ArrayType };
+    WITH_TYPE_NAME("_bytea8");
+    WITH_TO_PG_CONVERSION( PointerGetDatum(value.array()) );
+    WITH_TO_CXX_CONVERSION(
+        reinterpret_cast<ArrayType*>(madlib_DatumGetArrayTypeP(value))
+    );
+};
+
 // Note: See the comment for PG_FREE_IF_COPY in fmgr.h. Essentially, when
 // writing UDFs, we do not have to worry about deallocating copies of immutable
 // arrays. They will simply be garbage collected.
@@ -87,6 +87,7 @@ extern "C" {
 #include <boost/tr1/tuple.hpp>
 #include <algorithm>
 #include <complex>
+#include <cstring>
 #include <limits>
 #include <stdexcept>
 #include <vector>
@@ -207,6 +208,7 @@ madlib ## _ ## _pgfunc _arglist { \
 #include "UDF_proto.hpp"
 // Need to move FunctionHandle down because it has dependencies
 #include "FunctionHandle_proto.hpp"
+#include "FunctionCache_proto.hpp"
 
 // Several backend functions (APIs) need a wrapper, so that they can be called
 // safely from a C++ context.
@@ -219,10 +221,12 @@ using dbconnector::postgres::Allocator;
 using dbconnector::postgres::AnyType;
 using dbconnector::postgres::ArrayHandle;
 using dbconnector::postgres::ByteString;
+using dbconnector::postgres::CacheBuffer;
 using dbconnector::postgres::FunctionHandle;
 using dbconnector::postgres::MutableArrayHandle;
 using dbconnector::postgres::MutableByteString;
 using dbconnector::postgres::NativeRandomNumberGenerator;
+using dbconnector::postgres::RawDatumKey;
 using dbconnector::postgres::TransparentHandle;
 
 // Import MADlib functions into madlib namespace
@@ -273,6 +277,7 @@ inline void warning(std::string msg){
 #include "ArrayHandle_impl.hpp"
 #include "ByteString_impl.hpp"
 #include "EigenIntegration_impl.hpp"
+#include "FunctionCache_impl.hpp"
 #include "FunctionHandle_impl.hpp"
 #include "NativeRandomNumberGenerator_impl.hpp"
 #include "OutputStreamBuffer_impl.hpp"